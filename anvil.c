@@ -172,12 +172,7 @@ void anvil_insert_chunk(mca * region, int32_t X, int32_t Z, nbt_t *nbt) {
 }
 
 nbt_t * anvil_tile_entities(gschunk * ch) {
-    nbt_t *tent = NULL;
-    if (ch->tent)
-        tent = nbt_clone(ch->tent);
-    else
-        tent = nbt_new(NBT_LIST, "TileEntities", 0);
-    return tent;
+    return chunk_tile_entities(ch);
 }
 
 // generate chunk NBT from chunk_t data
@@ -817,25 +817,37 @@ int huddraw_map() {
     int32_t x = (int32_t)floor(gs.own.x);
     int32_t y = (int32_t)floor(gs.own.y);
     int32_t z = (int32_t)floor(gs.own.z);
-    extent_t ex = { { x-80, y-12, z-80 }, { x+80, y+3, z+80 } };
-    cuboid_t cb = export_cuboid_extent(ex);
 
-    int r,c,i,j;
-    int32_t off = cb.boff + 16*cb.sa.x + 16;
+    // vertical range shown on the map
+    int32_t yl = y-12, yh = y+3;
+
+    int r,c;
     for(r=0; r<128; r++) {
+        int32_t bz = z-64+r;
+        gschunk *gc = NULL;
         for(c=0; c<128; c++) {
-            int poff = off+r*cb.sa.x+c;
-            for(j=0; j<16; j++) {
-                if ( cb.data[j][poff].bid ) {
-                    int8_t color = BLOCK_COLORMAP[cb.data[j][poff].bid][cb.data[j][poff].meta];
-                    hud_image[r*128+c] = color*4 + shading[j];
+            int32_t bx = x-64+c;
+            if (c==0 || (bx&15)==0)
+                gc = find_chunk(gs.world, bx>>4, bz>>4, 0);
+            if (!gc) continue;
+
+            // use the surface index, unless the column is covered above the visible range
+            int col = (bz&15)*16+(bx&15);
+            int32_t h = gc->height[col];
+            bid_t b = gc->surface[col];
+            if (h > yh) {
+                for(h=MIN(yh,255); h>=yl && h>=0; h--) {
+                    b = gc->blocks[h*256+col];
+                    if (b.raw) break;
                 }
             }
+            if (h < yl || h < 0) continue;
+
+            int8_t color = BLOCK_COLORMAP[b.bid][b.meta];
+            hud_image[r*128+c] = color*4 + shading[h-yl];
         }
     }
 
-    for(i=0; i<256; i++) lh_free(cb.data[i]);
-
     hud_image[64*128+64] = 126;
 
     char text[256];
@@ -905,7 +917,7 @@ int huddraw_tunnel() {
     return 1;
 }
 
-#define MATS_PER_PAGE 20
+#define MATS_PER_PAGE 18
 
 int huddraw_build() {
     build_info * bi = get_build_info(hud_build_plan);
@@ -989,6 +1001,27 @@ int huddraw_build() {
         draw_text(0, 6*i+8, buf);
     }
 
+    // next route waypoint
+    if (!hud_build_plan && bi->wpcount > 0) {
+        if (bi->wpnum < bi->wpcount)
+            sprintf(buf, "WP %d/%d %d,%d,%d", bi->wpnum+1, bi->wpcount, bi->wpx, bi->wpy, bi->wpz);
+        else
+            sprintf(buf, "WP %d/%d done", bi->wpcount, bi->wpcount);
+        fg_color = B3(COLOR_GOLD_YELLOW);
+        bg_color = B0(COLOR_BLUE);
+        draw_text(0, 6*MATS_PER_PAGE+8, buf);
+        bg_color = 0;
+    }
+
+    // live placement rate
+    if (!hud_build_plan && bi->adaptive) {
+        sprintf(buf, "%4.1f/s W%d %dms %4.1ftps", bi->rate, bi->window, bi->latency, bi->tps);
+        fg_color = B3(COLOR_YELLOW);
+        bg_color = B0(COLOR_BLUE);
+        draw_text(0, 6*MATS_PER_PAGE+14, buf);
+        bg_color = 0;
+    }
+
     return 1;
 }
 
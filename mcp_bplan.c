@@ -107,62 +107,26 @@ int bplan_add(bplan *bp, blkr block) {
 
 blkr abs2rel(pivot_t pv, blkr b) {
     blkr r;
-    const char *axis = db_get_blk_propval(b.b.raw ,"axis");
-    const char *facing = db_get_blk_propval(b.b.raw ,"facing");
+    r.b = b.b;
     switch(pv.dir) {
         case DIR_SOUTH:
             r.x=pv.pos.x-b.x;
             r.z=pv.pos.z-b.z;
-            if (axis) {
-                r.b=b.b;
-            }
-            else if (facing) {
-                if (!strcmp(facing,"north")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "south");
-                else if (!strcmp(facing,"east")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "west");
-                else if (!strcmp(facing,"south")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "north");
-                else if (!strcmp(facing,"west")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "east");
-                else r.b=b.b;
-            }
-            else r.b=b.b;
+            r.b.raw = db_blk_transform(b.b.raw, DB_ROT180);
             break;
         case DIR_NORTH:
             r.x=b.x-pv.pos.x;
             r.z=b.z-pv.pos.z;
-            r.b=b.b;
             break;
         case DIR_EAST:
             r.x=b.z-pv.pos.z;
             r.z=pv.pos.x-b.x;
-            if (axis) {
-                if (!strcmp(axis,"x")) r.b.raw = db_blk_property_change(b.b.raw, "axis", "z");
-                else if (!strcmp(axis,"z")) r.b.raw = db_blk_property_change(b.b.raw, "axis", "x");
-                else r.b=b.b;
-            }
-            else if (facing) {
-                if (!strcmp(facing,"north")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "west");
-                else if (!strcmp(facing,"east")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "north");
-                else if (!strcmp(facing,"south")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "east");
-                else if (!strcmp(facing,"west")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "south");
-                else r.b=b.b;
-            }
-            else r.b=b.b;
+            r.b.raw = db_blk_transform(b.b.raw, DB_ROT270);
             break;
         case DIR_WEST:
             r.x=pv.pos.z-b.z;
             r.z=b.x-pv.pos.x;
-            if (axis) {
-                if (!strcmp(axis,"x")) r.b.raw = db_blk_property_change(b.b.raw, "axis", "z");
-                else if (!strcmp(axis,"z")) r.b.raw = db_blk_property_change(b.b.raw, "axis", "x");
-                else r.b=b.b;
-            }
-            else if (facing) {
-                if (!strcmp(facing,"north")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "east");
-                else if (!strcmp(facing,"east")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "south");
-                else if (!strcmp(facing,"south")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "west");
-                else if (!strcmp(facing,"west")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "north");
-                else r.b=b.b;
-            }
-            else r.b=b.b;
+            r.b.raw = db_blk_transform(b.b.raw, DB_ROT90);
             break;
         default: assert(0);
     }
@@ -172,62 +136,26 @@ blkr abs2rel(pivot_t pv, blkr b) {
 
 blkr rel2abs(pivot_t pv, blkr b) {
     blkr r;
-    const char *axis = db_get_blk_propval(b.b.raw ,"axis");
-    const char *facing = db_get_blk_propval(b.b.raw ,"facing");
+    r.b = b.b;
     switch(pv.dir) {
         case DIR_SOUTH:
             r.x=pv.pos.x-b.x;
             r.z=pv.pos.z-b.z;
-            if (axis) {
-                r.b=b.b;
-            }
-            else if (facing) {
-                if (!strcmp(facing,"north")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "south");
-                else if (!strcmp(facing,"east")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "west");
-                else if (!strcmp(facing,"south")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "north");
-                else if (!strcmp(facing,"west")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "east");
-                else r.b=b.b;
-            }
-            else r.b=b.b;
+            r.b.raw = db_blk_transform(b.b.raw, DB_ROT180);
             break;
         case DIR_NORTH:
             r.x=pv.pos.x+b.x;
             r.z=pv.pos.z+b.z;
-            r.b=b.b;
             break;
         case DIR_EAST:
             r.x=pv.pos.x-b.z;
             r.z=pv.pos.z+b.x;
-            if (axis) {
-                if (!strcmp(axis,"x")) r.b.raw = db_blk_property_change(b.b.raw, "axis", "z");
-                else if (!strcmp(axis,"z")) r.b.raw = db_blk_property_change(b.b.raw, "axis", "x");
-                else r.b=b.b;
-            }
-            else if (facing) {
-                if (!strcmp(facing,"north")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "east");
-                else if (!strcmp(facing,"east")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "south");
-                else if (!strcmp(facing,"south")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "west");
-                else if (!strcmp(facing,"west")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "north");
-                else r.b=b.b;
-            }
-            else r.b=b.b;
+            r.b.raw = db_blk_transform(b.b.raw, DB_ROT90);
             break;
         case DIR_WEST:
             r.x=pv.pos.x+b.z;
             r.z=pv.pos.z-b.x;
-            if (axis) {
-                if (!strcmp(axis,"x")) r.b.raw = db_blk_property_change(b.b.raw, "axis", "z");
-                else if (!strcmp(axis,"z")) r.b.raw = db_blk_property_change(b.b.raw, "axis", "x");
-                else r.b=b.b;
-            }
-            else if (facing) {
-                if (!strcmp(facing,"north")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "west");
-                else if (!strcmp(facing,"east")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "north");
-                else if (!strcmp(facing,"south")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "east");
-                else if (!strcmp(facing,"west")) r.b.raw = db_blk_property_change(b.b.raw, "facing", "south");
-                else r.b=b.b;
-            }
-            else r.b=b.b;
+            r.b.raw = db_blk_transform(b.b.raw, DB_ROT270);
             break;
         default: assert(0);
     }
@@ -610,15 +538,15 @@ void bplan_flip(bplan *bp, char mode) {
         switch (mode) {
             case 'x':
                 b->x = -b->x;
-                b->b = flip_meta(b->b, 'x');
+                b->b.raw = db_blk_transform(b->b.raw, DB_FLIPX);
                 break;
             case 'y':
                 b->y = -b->y;
-                b->b = flip_meta_y(b->b);
+                b->b.raw = db_blk_transform(b->b.raw, DB_FLIPY);
                 break;
             case 'z':
                 b->z = -b->z;
-                b->b = flip_meta(b->b, 'z');
+                b->b.raw = db_blk_transform(b->b.raw, DB_FLIPZ);
                 break;
         }
     }
@@ -643,7 +571,7 @@ void bplan_tilt(bplan *bp, char mode) {
                 z = b->x;
                 b->x = x;
                 b->z = z;
-                b->b = rotate_meta(b->b, 1);
+                b->b.raw = db_blk_transform(b->b.raw, DB_ROT90);
                 break;
             case 'z':
                 x = b->y;
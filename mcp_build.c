@@ -8,11 +8,13 @@
  2 of the License, or (at your option) any later version.
 */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <strings.h>
 #include <math.h>
+#include <unistd.h>
 
 #include <lh_buffers.h>
 #include <lh_files.h>
@@ -26,6 +28,7 @@
 #include "mcp_gamestate.h"
 #include "mcp_game.h"
 #include "mcp_arg.h"
+#include "hud.h"
 #include "mcp_packet.h"
 
 
@@ -109,12 +112,12 @@ uint16_t DOTS_NONE[15] = {
 // this structure is used to define an absolute block placement
 // in the active building process - one block of the 'buildtask'
 typedef struct {
-    int32_t     x,y,z;          // coordinates of the block to place
+    int32_t     x,z;            // coordinates of the block to place
+    int16_t     y;
     bid_t       b;              // block type, including the meta
     bid_t       current;        // block that is currently in the world at this position
-
-    int         rdir;           // required placement direction
-                                // one of the DIR_* constants, -1 if doesn't matter
+    bid_t       shown;          // block the client preview shows at this position,
+                                // 0 if the client sees the actual world block
 
     // state flags
     union {
@@ -127,6 +130,7 @@ typedef struct {
             int8_t blocked : 1; // true if this block is obstructed by something else
             int8_t inreach : 1; // this block is close enough to place
             int8_t pending : 1; // block was placed but pending confirmation from the server
+            int8_t avail   : 1; // cached 'empty' state from the world, before the seal mode
         };
     };
 
@@ -144,19 +148,81 @@ typedef struct {
         };
     };
 
-    bid_t nblocks[6];           // types of blocks at the neighbor positions
+    int rslot;                  // index of the placement data in build.rdata, -1 if
+                                // the block is not around the player
 
-    uint16_t dots[6][15];       // usable dots on the 6 neighbor faces to place the block
-    int ndots;                  // number of dots on this block we can use to place it correctly
+    int wave;                   // support wave - 0 if supported by the world, otherwise
+                                // one more than the task block it can be placed against
+} blk;
 
-    double dist;                // distance to the block center
+// placement data of a block around the player - only kept for the blocks
+// in build.reach, so the buildtask entries stay small
+typedef struct {
+    bid_t       nblocks[6];     // types of blocks at the neighbor positions
+    int8_t      rdir;           // required placement direction
+                                // one of the DIR_* constants, -1 if doesn't matter
+    int16_t     ndots;          // number of dots on this block we can use to place it correctly
+    int         dslot;          // index of the usable dots in build.dots, -1 if none
+    double      dist;           // distance to the block center, then the maximum reach
+                                // distance of the faces with usable dots
+    uint64_t    last;           // last timestamp when we attempted to place this block
+} brdata;
 
-    uint64_t last;              // last timestamp when we attempted to place this block
-} blk;
+#define BRD(b) (P(build.rdata)+(b)->rslot)
 
-// maximum number of blocks in the buildable list
+// a placement awaiting confirmation from the server
+typedef struct {
+    int         idx;            // buildtask index
+    uint64_t    ts;             // timestamp the placement was sent at
+} bpend;
+
+// maximum number of pending blocks from the build recorder
 #define MAXBUILDABLE 1024
 
+// usable dots on the 6 neighbor faces to place the block
+typedef struct {
+    uint16_t f[6][15];
+} bdots;
+
+#define BDOTS(b) (P(build.dots)[BRD(b)->dslot].f)
+
+// support wave of the blocks that can't be connected to any support
+#define WAVE_NONE INT32_MAX
+
+// spatial index of the buildtask - blocks are grouped into cells of 8x8x8,
+// so only the cells around the player need to be visited
+#define BCELL_SHIFT 3
+
+typedef struct {
+    int32_t x,y,z;              // cell coordinates (block coordinates >> BCELL_SHIFT)
+    int     first;              // index of the first block in build.cidx
+    int     count;              // number of blocks in this cell
+    int     dirty;              // world state of the blocks needs to be updated
+} bcell;
+
+// route planning - standing positions are planned for columns and layers of
+// blocks, the column size is chosen so its diagonal stays within MAXREACH
+#define ROUTE_XZ_SIZE  ((int)(MAXREACH/M_SQRT2)+1)
+#define ROUTE_Y_SIZE   2
+#define ROUTE_2OPT    20        // max number of 2-opt passes per layer
+#define ROUTE_2OPT_WIN 32       // 2-opt only reverses sections up to this length
+#define ROUTE_MAXNN  1024       // larger layers are ordered in serpentine rows
+#define ROUTE_BUDGET 50000      // time budget for the 2-opt improvement (us)
+
+// in-game preview is generated per chunk section (16x16x16 blocks)
+typedef struct {
+    int32_t X,Y,Z;              // section coordinates
+    int     first;              // index of the first block in build.sidx
+    int     count;              // number of blocks in this section
+    int     dirty;              // preview of this section needs to be refreshed
+} bsection;
+
+typedef struct {
+    int32_t x,y,z;              // standing position
+    int     first;              // index of the first block in build.wpidx
+    int     count;              // number of blocks to place from here
+} bwaypt;
+
 struct {
     int64_t lastbuild;         // timestamp of last block placement
 
@@ -175,13 +241,42 @@ struct {
 
     pivot_t pv;                // pivot
 
-    int bq[MAXBUILDABLE];      // list of buildable blocks from the task
-    int nbq;                   // number of buildable blocks
+    lh_arr_declare(int,bqh);   // priority queue (binary heap) of the buildable blocks
+    lh_arr_declare(int,bq);    // buildable blocks taken from bqh so far, in priority order
+    lh_arr_declare(bdots,dots);// dots of the blocks in reach, rebuilt on each update
+
+    lh_arr_declare(bcell,cell);// cells of the buildtask, sorted by coordinates
+    int *cidx;                 // buildtask indices, grouped by cell
+    int *pidx;                 // position hash -> buildtask index, -1 for unused slots
+    int pidxsize;
+    lh_arr_declare(int,reach); // buildtask blocks around the player position
+    lh_arr_declare(brdata,rdata); // placement data of the blocks in build.reach
+    lh_arr_declare(int,rcell); // cells around the player position
+    int32_t rx,ry,rz;          // player block position the reach list was made for
+    int rvalid;                // reach list is valid
+
+    lh_arr_declare(bwaypt,route); // planned standing positions, in visiting order
+    int *wpidx;                // buildtask indices, grouped by waypoint
+    int wpnext;                // waypoint the player should visit next
+
+    // adaptive placement rate
+    lh_arr_declare(bpend,pend);// buildtask blocks placed, but not confirmed by the server yet
+    lh_arr_declare(int,unconf);// buildtask blocks placed with material from an unconfirmed swap
+    double window;             // allowed number of unconfirmed placements
+    int interval;              // current interval between placements (us)
+    double rtt;                // smoothed confirmation latency (us)
+    int64_t rate_ts;           // start of the current rate measurement
+    int rate_cnt;              // placements confirmed since rate_ts
+    double rate;               // confirmed placements per second
 
     int32_t     xmin,xmax,ymin,ymax,zmin,zmax;
 
     int64_t preview_last_ts;
     MCPacketQueue preview_queue;
+    lh_arr_declare(bsection,sect); // chunk sections of the buildtask, sorted by coordinates
+    int *sidx;                 // buildtask indices, grouped by section
+    int pmode;                 // current preview mode, PREVIEW_REMOVE if not shown
+    int pdirty;                // some sections need a preview refresh
 } build;
 
 #define BTASK GAR(build.task)
@@ -206,6 +301,9 @@ struct {
                            // is canceled, otherwise phantom blocks will stay there until
                            // chunks are removed. This option overrides this behavior and
                            // retains the phantom blocks.
+    int adaptive;          // adapt the placement rate to the server confirmations and TPS
+    int bldmax;            // longest interval between placing any block in adaptive mode
+    int winmax;            // max number of unconfirmed placements in adaptive mode
 } buildopts = { 0 };
 
 typedef struct {
@@ -218,6 +316,8 @@ typedef struct {
 #define BUILD_BLKINT  1000000
 #define BUILD_BLDINT   150000
 #define BUILD_BLKMAX        1
+#define BUILD_BLDMAX  1000000
+#define BUILD_WINMAX        4
 
 bopt_t OPTIONS[] = {
     { "blkint", "interval (us) between attempting to place same block", &buildopts.blkint, BUILD_BLKINT},
@@ -229,12 +329,18 @@ bopt_t OPTIONS[] = {
     { "anyface", "place on any faces even if they look away from player",   &buildopts.anyface, 0},
     { "bjump", "build while jumping/falling/swimming",                  &buildopts.bjump, 0},
     { "preview_retain", "Retain preview when buildtask is canceled",    &buildopts.preview_retain, 0},
+    { "adaptive", "adapt placement rate to server latency and TPS",     &buildopts.adaptive, 0},
+    { "bldmax", "max interval (us) between placing blocks in adaptive mode", &buildopts.bldmax, BUILD_BLDMAX},
+    { "winmax", "max unconfirmed placements in adaptive mode",          &buildopts.winmax, BUILD_WINMAX},
     { NULL, NULL, NULL, 0 }, //list terminator
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 
 static void build_update_placed();
+static void route_progress(MCPacketQueue *cq);
+static int bq_get(int i);
+static int journal_get(blk *b, int *placed);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Inventory
@@ -242,56 +348,109 @@ static void build_update_placed();
 // slot range in the quickbar that can be used for material fetching
 int matl=0, math=8;
 
-// timestamps when the material slots were last accessed - used to select evictable slots
-int64_t mat_last[9];
+// number of upcoming placements considered when planning the quickbar contents
+#define MAT_LOOKAHEAD 64
 
-// find a suitable slot in the quickbar where we can swap in materials from the main inventory
-int find_evictable_slot() {
+// item IDs of the upcoming placements, in the build queue order
+static int mat_plan[MAT_LOOKAHEAD];
+static int mat_nplan = 0;
+
+// refresh the material plan from the sorted build queue
+static void plan_materials() {
+    int bi;
+    mat_nplan = 0;
+    while (mat_nplan<MAT_LOOKAHEAD && (bi=bq_get(mat_nplan))>=0) {
+        blk *b = P(build.task)+bi;
+        mat_plan[mat_nplan++] = db_get_item_id_from_blk_id(b->b.raw);
+    }
+}
+
+// position of the next use of an item in the material plan, starting at 'from'
+// returns mat_nplan if the item is not needed in the look-ahead window
+static int next_use(int item_id, int from) {
+    int i;
+    for(i=from; i<mat_nplan; i++)
+        if (mat_plan[i] == item_id) return i;
+    return mat_nplan;
+}
+
+// find the quickbar slot whose material is needed farthest in the future
+static int find_evictable_slot_from(int from, int *use) {
     int i;
-    int best_s = matl;
-    int64_t best_ts = mat_last[matl];
+    int best_s = matl, best_use = -1;
 
     for(i=matl; i<=math; i++) {
-        if (gs.inv.slots[i+36].item == -1)
-            return i; // empty slot is the best candidate
+        if (gs.inv.slots[i+36].item == -1) {
+            // empty slot is the best candidate
+            if (use) *use = INT32_MAX;
+            return i;
+        }
 
-        if (mat_last[i] < best_ts) {
+        int u = next_use(gs.inv.slots[i+36].item, from);
+        if (u > best_use) {
             best_s = i;
-            best_ts = mat_last[i];
+            best_use = u;
         }
     }
 
-    return best_s; // return slot that has not been used longest
+    if (use) *use = best_use;
+    return best_s;
 }
 
-// fetch necessary material to the quickbar
-int prefetch_material(MCPacketQueue *sq, MCPacketQueue *cq, blid_t blk_id) {
+// find a suitable slot in the quickbar where we can swap in materials from the main inventory
+int find_evictable_slot() {
+    return find_evictable_slot_from(0, NULL);
+}
+
+// find the inventory slot holding an item, quickbar first
+static int find_material_slot(int item_id) {
     int i;
+    for(i=44; i>8; i--)
+        if (gs.inv.slots[i].item == item_id)
+            return i;
+    return -1;
+}
 
+// fetch necessary material to the quickbar
+int prefetch_material(MCPacketQueue *sq, MCPacketQueue *cq, blid_t blk_id) {
     // determine item ID suitable for placing this block type
-    const char *blk_name = db_get_blk_name(blk_id);
-    assert(blk_name);
-    int item_id = db_get_item_id(blk_name);
-    //printf("prefetch_material: blk_id=%d, blk_name=%s, item_id=%d\n", blk_id, blk_name, item_id);
+    int item_id = db_get_item_id_from_blk_id(blk_id);
 
     // try to find the suitable material in any inventory slot, starting from quickbar
-    int mslot = -1;
-    for(i=44; i>8; i--)
-        if (gs.inv.slots[i].item == item_id) {
-            mslot = i;
-            break;
-        }
+    int mslot = find_material_slot(item_id);
     if (mslot<0) return -1; // material not available in the inventory
-    //printf("Found in slot %d\n", mslot);
 
     if (mslot>=36 && mslot<=44) return mslot-36; // found in the quickbar
 
-    // fetch the material from main inventory to a suitable quickbar slot
+    // fetch the material from main inventory to a suitable quickbar slot -
+    // the clicks are queued ahead of any placement we send afterwards
     int eslot = find_evictable_slot();
-    //printf("swapping slots: %d %d\n", mslot, eslot+36);
-    gmi_swap_slots(sq, cq, mslot, eslot+36);
+    if (!gmi_swap_slots(sq, cq, mslot, eslot+36))
+        return -2; // too many inventory actions in flight
 
-    return -2; //material being fetched
+    return eslot;
+}
+
+// swap in the upcoming materials missing from the quickbar, earliest first,
+// while we wait for the next placement anyway - returns the number of swaps started
+static int prefetch_ahead(MCPacketQueue *sq, MCPacketQueue *cq) {
+    int i, ns=0;
+    for(i=0; i<mat_nplan; i++) {
+        int item_id = mat_plan[i];
+        if (next_use(item_id, 0) < i) continue; // already checked
+
+        int mslot = find_material_slot(item_id);
+        if (mslot<0 || mslot>=36) continue; // missing or already in the quickbar
+
+        // only evict a material that is needed later than this one
+        int use;
+        int eslot = find_evictable_slot_from(0, &use);
+        if (use <= i) break;
+
+        if (!gmi_swap_slots(sq, cq, mslot, eslot+36)) break;
+        ns++;
+    }
+    return ns;
 }
 
 static int build_info_compar(const void *a, const void *b) {
@@ -360,6 +519,19 @@ build_info * get_build_info(int plan) {
 
     // other info
     bi->limit = build.limit;
+    bi->adaptive = buildopts.adaptive;
+    bi->rate = build.rate;
+    bi->window = (int)build.window;
+    bi->latency = (int)(build.rtt/1000);
+    bi->tps = gs.tick.tps;
+    bi->wpnum = build.wpnext;
+    bi->wpcount = C(build.route);
+    if (build.wpnext < C(build.route)) {
+        bwaypt *w = P(build.route)+build.wpnext;
+        bi->wpx = w->x;
+        bi->wpy = w->y;
+        bi->wpz = w->z;
+    }
 
     // sort by number of blocks to be placed
     qsort(P(bi->mat), C(bi->mat), sizeof(P(bi->mat)[0]), build_info_compar);
@@ -422,84 +594,293 @@ static dotpos_t DOTPOS[6] = {
     [DIR_WEST]  = { 32, 2, 2,  0,2,0,  0,0,2, }, // Z-Y
 };
 
-// from all the dots which can be used to place a block correctly,
-// remove those out of player's reach by updating the dot masks
-static void remove_distant_dots(blk *b) {
-    // reset distance to the block
-    // this will be now replaced with the max dot distance
-    b->dist = 0;
+// Dot visibility masks - for the faces around the player, the dots in reach
+// and the dots matching each look direction are stored as bitboards of
+// 15 rows x 15 bits. Dots hidden behind other blocks are excluded. The masks
+// only depend on the player position and the blocks around, so each dot is
+// checked the first time a block asks for it, and the result is reused until
+// the player moves or a block its line of sight passes through changes
+
+// range of the neighbor block offsets relative to the player block
+#define DOTMASK_R 8
+#define DOTMASK_N (2*DOTMASK_R+1)
+
+typedef struct {
+    uint32_t gen;               // position generation the masks were computed for
+    uint16_t done[15];          // dots already checked for reach and line of sight
+    uint16_t reach[15];         // dots within MAXREACH and in line of sight
+    uint16_t ddone[15];         // dots with the look direction determined
+    uint16_t dir[4][15];        // dots within reach, for DIR_SOUTH..DIR_WEST look direction
+} dotmask_t;
+
+static struct {
+    dotmask_t *m;               // [DOTMASK_N^3][6], allocated on first use
+    uint32_t gen;               // incremented when the player position changes
+    double   x,y,z;             // player position of the current generation
+    int32_t  bx,by,bz;          // player block position
+    int32_t  ey;                // block of the player's eye
+    int8_t  *occ;               // solid blocks around the player block, -1 if not known yet
+    int      occvalid;          // occ is set up for the current player block
+} dotmask;
+
+// range of the occupancy cache - one more than the mask range
+#define OCC_R (DOTMASK_R+1)
+#define OCC_N (2*OCC_R+1)
+
+// true if the block at this position obstructs the line of sight
+static int voxel_solid(int32_t x, int32_t y, int32_t z) {
+    int dx = x-dotmask.bx+OCC_R;
+    int dy = y-dotmask.by+OCC_R;
+    int dz = z-dotmask.bz+OCC_R;
+    if (dx<0 || dx>=OCC_N || dy<0 || dy>=OCC_N || dz<0 || dz>=OCC_N)
+        return !db_blk_is_empty(get_block_at(x,z,y).raw);
+
+    if (!dotmask.occ)
+        dotmask.occ = malloc(OCC_N*OCC_N*OCC_N);
+    if (!dotmask.occvalid) {
+        memset(dotmask.occ, 0xff, OCC_N*OCC_N*OCC_N);
+        dotmask.occvalid = 1;
+    }
+
+    int8_t *o = dotmask.occ + (dy*OCC_N+dz)*OCC_N+dx;
+    if (*o < 0)
+        *o = !db_blk_is_empty(get_block_at(x,z,y).raw);
+    return *o;
+}
+
+// 3D DDA raycast from the eye to a dot on the face of the target block -
+// returns true if any solid block lies in between
+static int ray_blocked(double x0, double y0, double z0, double x1, double y1, double z1,
+                       int32_t tx, int32_t ty, int32_t tz) {
+    double dx = x1-x0, dy = y1-y0, dz = z1-z0;
+    int32_t ix = floor(x0), iy = floor(y0), iz = floor(z0);
+    int sx = (dx>0) ? 1 : -1, sy = (dy>0) ? 1 : -1, sz = (dz>0) ? 1 : -1;
+
+    // ray parameter increment for one block along each axis, and the
+    // parameter where the ray crosses the next block boundary
+    double tdx = (dx!=0) ? fabs(1/dx) : INFINITY;
+    double tdy = (dy!=0) ? fabs(1/dy) : INFINITY;
+    double tdz = (dz!=0) ? fabs(1/dz) : INFINITY;
+    double tmx = (dx>0) ? (ix+1-x0)*tdx : (x0-ix)*tdx;
+    double tmy = (dy>0) ? (iy+1-y0)*tdy : (y0-iy)*tdy;
+    double tmz = (dz>0) ? (iz+1-z0)*tdz : (z0-iz)*tdz;
+
+    while (1) {
+        if (tmx<=tmy && tmx<=tmz) {
+            if (tmx >= 1.0) break;
+            ix += sx; tmx += tdx;
+        }
+        else if (tmy<=tmz) {
+            if (tmy >= 1.0) break;
+            iy += sy; tmy += tdy;
+        }
+        else {
+            if (tmz >= 1.0) break;
+            iz += sz; tmz += tdz;
+        }
 
+        // the dot is on the boundary of the target block - the ray ends there
+        if (ix==tx && iy==ty && iz==tz) break;
+        if (voxel_solid(ix,iy,iz)) return 1;
+    }
+    return 0;
+}
+
+// blocks in the box x0..x1,y0..y1,z0..z1 have changed - forget them in the
+// occupancy cache, and drop the masks whose lines of sight may pass through.
+// A ray from the eye to a dot on the face of the neighbor block n only visits
+// the blocks between the eye block and n+-1, so along each axis only the
+// masks on the far side of the box from the eye are affected
+static void invalidate_dotmask(int32_t x0, int32_t x1, int32_t y0, int32_t y1,
+                               int32_t z0, int32_t z1) {
+    if (!dotmask.gen) return;
+    if (x1 < dotmask.bx-OCC_R || x0 > dotmask.bx+OCC_R ||
+        y1 < dotmask.by-OCC_R || y0 > dotmask.by+OCC_R ||
+        z1 < dotmask.bz-OCC_R || z0 > dotmask.bz+OCC_R) return;
+
+    int x,y,z,f;
+    if (dotmask.occvalid) {
+        for(y=MAX(y0,dotmask.by-OCC_R); y<=MIN(y1,dotmask.by+OCC_R); y++)
+            for(z=MAX(z0,dotmask.bz-OCC_R); z<=MIN(z1,dotmask.bz+OCC_R); z++)
+                for(x=MAX(x0,dotmask.bx-OCC_R); x<=MIN(x1,dotmask.bx+OCC_R); x++)
+                    dotmask.occ[((y-dotmask.by+OCC_R)*OCC_N+(z-dotmask.bz+OCC_R))*OCC_N
+                                +(x-dotmask.bx+OCC_R)] = -1;
+    }
+    if (!dotmask.m) return;
+
+    // range of the affected neighbor blocks, relative to the player block
+    int xmin = (dotmask.bx >= x0) ? -DOTMASK_R : MAX(x0-1-dotmask.bx, -DOTMASK_R);
+    int xmax = (dotmask.bx <= x1) ?  DOTMASK_R : MIN(x1+1-dotmask.bx,  DOTMASK_R);
+    int ymin = (dotmask.ey >= y0) ? -DOTMASK_R : MAX(y0-1-dotmask.by, -DOTMASK_R);
+    int ymax = (dotmask.ey <= y1) ?  DOTMASK_R : MIN(y1+1-dotmask.by,  DOTMASK_R);
+    int zmin = (dotmask.bz >= z0) ? -DOTMASK_R : MAX(z0-1-dotmask.bz, -DOTMASK_R);
+    int zmax = (dotmask.bz <= z1) ?  DOTMASK_R : MIN(z1+1-dotmask.bz,  DOTMASK_R);
+
+    for(y=ymin; y<=ymax; y++)
+        for(z=zmin; z<=zmax; z++)
+            for(x=xmin; x<=xmax; x++) {
+                dotmask_t *m = dotmask.m + (((y+DOTMASK_R)*DOTMASK_N+(z+DOTMASK_R))*DOTMASK_N
+                                            +(x+DOTMASK_R))*6;
+                for(f=0; f<6; f++)
+                    m[f].gen = 0;
+            }
+}
+
+// drop all masks and the occupancy cache
+static void reset_dotmask() {
+    dotmask.gen++;
+    dotmask.occvalid = 0;
+}
+
+// coordinates of the dot dr,dc on the face f of the neighbor block nx,ny,nz
+static inline void dot_coords(int f, int32_t nx, int32_t ny, int32_t nz, int dr, int dc,
+                              double *x, double *y, double *z) {
+    dotpos_t dotpos = DOTPOS[f];
+    *x = nx + dotpos.x/32 + dotpos.rx*dr/32 + dotpos.cx*dc/32;
+    *y = ny + dotpos.y/32 + dotpos.ry*dr/32 + dotpos.cy*dc/32;
+    *z = nz + dotpos.z/32 + dotpos.rz*dr/32 + dotpos.cz*dc/32;
+}
+
+// fill in the masks of one face for the dots in need not checked yet -
+// the look direction is only determined if the block requires one
+static void compute_dotmask(dotmask_t *m, int32_t nx, int32_t ny, int32_t nz, int f,
+                            uint16_t *need, int rdir) {
     double px = gs.own.x;
     double pz = gs.own.z;
     double py = gs.own.y+EYEHEIGHT;
 
-    int f;
-    for(f=0; f<6; f++) {
-        if (!((b->neigh>>f)&1) && !b->needadj) continue; // no neighbor - skip this face
-        uint16_t *dots = b->dots[f];
-        dotpos_t dotpos = DOTPOS[f];
+    // the block we are placing, the dots are on its boundary
+    int32_t tx = nx-NOFF[f][0];
+    int32_t tz = nz-NOFF[f][1];
+    int32_t ty = ny-NOFF[f][2];
+
+    int dr;
+    for(dr=0; dr<15; dr++) {
+        uint16_t todo = need[dr] & ~m->done[dr] & 0x7fff;
+        m->done[dr] |= todo;
+        while (todo) {
+            int dc = __builtin_ctz(todo);
+            todo &= todo-1;
+
+            double x,y,z;
+            dot_coords(f, nx,ny,nz, dr,dc, &x,&y,&z);
+            if (SQ(x-px)+SQ(z-pz)+SQ(y-py) > SQ(MAXREACH)) continue; // this dot is too far away
+            if (ray_blocked(px,py,pz, x,y,z, tx,ty,tz)) continue; // obstructed
+            m->reach[dr] |= 1<<dc;
+        }
 
-        // coordinates of the adjacent block
-        double nx = (b->x+NOFF[f][0]);
-        double nz = (b->z+NOFF[f][1]);
-        double ny = (b->y+NOFF[f][2]);
+        if (rdir == DIR_ANY) continue;
 
-        int dr,dc;
-        for(dr=0; dr<15; dr++) {
-            uint16_t drow = dots[dr];
-            if (!drow) continue; // skip disabled rows
+        // look direction the player would have when placing on these dots
+        todo = need[dr] & m->reach[dr] & ~m->ddone[dr];
+        m->ddone[dr] |= todo;
+        while (todo) {
+            int dc = __builtin_ctz(todo);
+            todo &= todo-1;
+
+            double x,y,z,yaw,pitch;
+            dot_coords(f, nx,ny,nz, dr,dc, &x,&y,&z);
+            int yawdir = calculate_yaw_pitch(x, z, y, &yaw, &pitch);
+            if (yawdir >= DIR_SOUTH)
+                m->dir[yawdir-DIR_SOUTH][dr] |= 1<<dc;
+        }
+    }
+}
 
-            // dot dr,0 coordinates in 3D space
-            double rx = nx + dotpos.x/32 + dotpos.rx*dr/32;
-            double ry = ny + dotpos.y/32 + dotpos.ry*dr/32;
-            double rz = nz + dotpos.z/32 + dotpos.rz*dr/32;
+// get the masks for the face f of the neighbor block at nx,ny,nz,
+// NULL if it is too far away from the player
+static dotmask_t *get_dotmask(int32_t nx, int32_t ny, int32_t nz, int f) {
+    if (!dotmask.m)
+        dotmask.m = calloc(DOTMASK_N*DOTMASK_N*DOTMASK_N*6, sizeof(dotmask_t));
+
+    // start a new generation when the player has moved - the occupancy
+    // cache is kept while the player stays in the same block
+    if (!dotmask.gen || gs.own.x != dotmask.x || gs.own.y != dotmask.y || gs.own.z != dotmask.z) {
+        int32_t bx = floor(gs.own.x);
+        int32_t by = floor(gs.own.y);
+        int32_t bz = floor(gs.own.z);
+        if (bx != dotmask.bx || by != dotmask.by || bz != dotmask.bz)
+            dotmask.occvalid = 0;
+
+        dotmask.gen++;
+        dotmask.x = gs.own.x;
+        dotmask.y = gs.own.y;
+        dotmask.z = gs.own.z;
+        dotmask.bx = bx;
+        dotmask.by = by;
+        dotmask.bz = bz;
+        dotmask.ey = floor(gs.own.y+EYEHEIGHT);
+    }
 
-            for(dc=0; dc<15; dc++) {
-                uint16_t mask = 1<<dc;
-                if (!(drow&mask)) continue; // skip disabled dots
+    int dx = nx-dotmask.bx+DOTMASK_R;
+    int dy = ny-dotmask.by+DOTMASK_R;
+    int dz = nz-dotmask.bz+DOTMASK_R;
+    if (dx<0 || dx>=DOTMASK_N || dy<0 || dy>=DOTMASK_N || dz<0 || dz>=DOTMASK_N)
+        return NULL;
 
-                double x = rx + dotpos.cx*dc/32;
-                double y = ry + dotpos.cy*dc/32;
-                double z = rz + dotpos.cz*dc/32;
+    dotmask_t *m = dotmask.m + ((dy*DOTMASK_N+dz)*DOTMASK_N+dx)*6+f;
+    if (m->gen != dotmask.gen) {
+        memset(m, 0, sizeof(*m));
+        m->gen = dotmask.gen;
+    }
+    return m;
+}
 
-                double dist = sqrt(SQ(x-px)+SQ(z-pz)+SQ(y-py));
+// from all the dots which can be used to place a block correctly,
+// remove those out of player's reach by updating the dot masks.
+// The block distance becomes the distance to the farthest dot left
+static void remove_distant_dots(blk *b) {
+    brdata *rd = BRD(b);
+    double px = gs.own.x;
+    double pz = gs.own.z;
+    double py = gs.own.y+EYEHEIGHT;
+    double dmax = 0;
 
-                if (dist > MAXREACH) {
-                    dots[dr] &= ~mask; // this dot is too far away - disable it
-                    drow = dots[dr];
-                    continue;
-                }
+    int f,dr;
+    for(f=0; f<6; f++) {
+        if (!((b->neigh>>f)&1) && !b->needadj) continue; // no neighbor - skip this face
+        uint16_t *dots = BDOTS(b)[f];
+
+        // masks of the adjacent block face
+        int32_t nx = b->x+NOFF[f][0];
+        int32_t nz = b->z+NOFF[f][1];
+        int32_t ny = b->y+NOFF[f][2];
+        dotmask_t *m = get_dotmask(nx, ny, nz, f);
+        if (!m || (rd->rdir != DIR_ANY && rd->rdir < DIR_SOUTH)) {
+            memset(dots, 0, sizeof(DOTS_ALL));
+            continue;
+        }
+        compute_dotmask(m, nx, ny, nz, f, dots, rd->rdir);
 
-                if (b->rdir != DIR_ANY) {
-                    // this block requires a certain player look direction on placement
-                    double yaw,pitch;
-                    int yawdir = calculate_yaw_pitch(x, z, y, &yaw, &pitch);
-                    if (yawdir != b->rdir) {
-                        // direction does not match - we can't place this block
-                        // as needed from player's perspective
-                        dots[dr] &= ~mask;
-                        drow = dots[dr];
-                        continue;
-                    }
-                }
+        // if this block requires a certain player look direction on placement,
+        // use only the dots matching it
+        uint16_t *mask = (rd->rdir != DIR_ANY) ? m->dir[rd->rdir-DIR_SOUTH] : m->reach;
 
-                // update block distance - necessary for the decision
-                // which block to place first
-                if (b->dist < dist)
-                    b->dist = dist;
+        for(dr=0; dr<15; dr++) {
+            dots[dr] &= mask[dr];
+            if (!dots[dr]) continue;
+
+            // update block distance - necessary for the decision which block
+            // to place first. The distance along a row is convex, so the
+            // farthest dot is one of the outermost ones
+            int dc[2] = { __builtin_ctz(dots[dr]), 31-__builtin_clz(dots[dr]) };
+            int i;
+            for(i=0; i<2; i++) {
+                double x,y,z;
+                dot_coords(f, nx,ny,nz, dr,dc[i], &x,&y,&z);
+                double d = SQ(x-px)+SQ(z-pz)+SQ(y-py);
+                if (dmax < d) dmax = d;
             }
         }
     }
 
-    b->inreach = (b->dist > 0);
+    rd->dist = sqrt(dmax);
+    b->inreach = (rd->dist > 0);
 }
 
 // cound how many active dots are in a row
 static inline int count_dots_row(uint16_t dots) {
-    int i,c=0;
-    for (i=0; i<15; dots>>=1,i++)
-        c += (dots&1);
-    return c;
+    return __builtin_popcount(dots&0x7fff);
 }
 
 // count how many active dots are on all faces of the block
@@ -509,57 +890,130 @@ static inline int count_dots(blk *b) {
     for(f=0; f<6; f++) {
         int dr;
         for(dr=0; dr<15; dr++) {
-            c += count_dots_row(b->dots[f][dr]);
+            c += count_dots_row(BDOTS(b)[f][dr]);
         }
     }
 
     return c;
 }
 
+// handles of the slab properties - looked up again when the database changes
+static struct {
+    uint32_t gen;
+    dbstr_t  type, top, bottom, dbl;
+} slabstr;
+
+static void slab_strings() {
+    if (slabstr.gen == db_generation()) return;
+    slabstr.type   = db_str("type");
+    slabstr.top    = db_str("top");
+    slabstr.bottom = db_str("bottom");
+    slabstr.dbl    = db_str("double");
+    slabstr.gen    = db_generation();
+}
+
 // if neighbor is a halfslab, there are only half the dots available on that face.
 // remove the empty half of the neighbor by updating the dot masks
 static void remove_slab_dots(blk *b) {
     int st = count_dots(b);
+    bid_t *nblocks = BRD(b)->nblocks;
+    slab_strings();
+    dbstr_t type = slabstr.type, top = slabstr.top, bottom = slabstr.bottom;
     for (int j=2; j<6;j++) { // j = DIR_SOUTH, DIR_NORTH, DIR_EAST, DIR_WEST
-        if (!b->nblocks[j].raw) continue;
+        if (!nblocks[j].raw) continue;
         // if neighbor is a halfslab, we only have half the dots available on its face
-        if ( db_item_is_slab(db_get_item_id_from_blk_id( b->nblocks[j].raw ))) {
-            if (!strcmp(db_get_blk_propval(b->nblocks[j].raw ,"type"),"top")) {
+        if ( db_blk_is_slab(nblocks[j].raw)) {
+            dbstr_t half = db_get_blk_propval_h(nblocks[j].raw, type);
+            if (half == top) {
                 // neighbor is upper slab
                 for (int i=0;i<15;i++) {
-                    b->dots[j][i] &= DOTS_UPPER[i];
+                    BDOTS(b)[j][i] &= DOTS_UPPER[i];
                 }
             }
-            else if (!strcmp(db_get_blk_propval(b->nblocks[j].raw ,"type"),"bottom")) {
+            else if (half == bottom) {
                 // neighbor is upper slab
                 for (int i=0;i<15;i++) {
-                    b->dots[j][i] &= DOTS_LOWER[i];
+                    BDOTS(b)[j][i] &= DOTS_LOWER[i];
                 }
             }
         }
     }
 }
 
-// predicate function to sort the blocks by their distance to the player
+// predicate function to sort the blocks by their distance to the player -
+// the distance to their farthest usable dot, see remove_distant_dots
 static int sort_blocks(const void *a, const void *b) {
-    int ia = *((int *)a);
-    int ib = *((int *)b);
+    blk *ba = P(build.task)+*((int *)a);
+    blk *bb = P(build.task)+*((int *)b);
 
-    if (P(build.task)[ia].dist > P(build.task)[ib].dist) return -1;
-    if (P(build.task)[ia].dist < P(build.task)[ib].dist) return 1;
+    // supports first, so the build never strands itself
+    if (ba->wave < bb->wave) return -1;
+    if (ba->wave > bb->wave) return 1;
+
+    if (BRD(ba)->dist > BRD(bb)->dist) return -1;
+    if (BRD(ba)->dist < BRD(bb)->dist) return 1;
 
     return 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Buildable queue - a binary heap ordered by sort_blocks, the blocks are taken
+// out of it in priority order only as far as the consumers need them
+
+static void bq_clear() {
+    C(build.bqh) = 0;
+    C(build.bq) = 0;
+}
+
+static void bq_push(int idx) {
+    *lh_arr_new(GAR(build.bqh)) = idx;
+
+    int *h = P(build.bqh);
+    int i = C(build.bqh)-1;
+    while (i>0) {
+        int p = (i-1)/2;
+        if (sort_blocks(&h[p], &idx) <= 0) break;
+        h[i] = h[p];
+        i = p;
+    }
+    h[i] = idx;
+}
+
+static int bq_pop() {
+    int *h = P(build.bqh);
+    int n = --C(build.bqh);
+    int top = h[0];
+    int last = h[n];
+
+    int i = 0;
+    while (2*i+1 < n) {
+        int c = 2*i+1;
+        if (c+1 < n && sort_blocks(&h[c+1], &h[c]) < 0) c++;
+        if (sort_blocks(&last, &h[c]) <= 0) break;
+        h[i] = h[c];
+        i = c;
+    }
+    if (n>0) h[i] = last;
+
+    return top;
+}
+
+// get the i-th buildable block in priority order, -1 past the end of the queue
+static int bq_get(int i) {
+    while (C(build.bq) <= i && C(build.bqh) > 0)
+        *lh_arr_new(GAR(build.bq)) = bq_pop();
+    return (i < C(build.bq)) ? P(build.bq)[i] : -1;
+}
+
 // set all dot faces on the block
 static inline void setdots(blk *b, uint16_t *u, uint16_t *d,
                            uint16_t *s, uint16_t *n, uint16_t *e, uint16_t *w) {
-    if (b->n_yp) memcpy(b->dots[DIR_UP],    u, sizeof(DOTS_ALL));
-    if (b->n_yn) memcpy(b->dots[DIR_DOWN],  d, sizeof(DOTS_ALL));
-    if (b->n_xp) memcpy(b->dots[DIR_EAST],  e, sizeof(DOTS_ALL));
-    if (b->n_xn) memcpy(b->dots[DIR_WEST],  w, sizeof(DOTS_ALL));
-    if (b->n_zp) memcpy(b->dots[DIR_SOUTH], s, sizeof(DOTS_ALL));
-    if (b->n_zn) memcpy(b->dots[DIR_NORTH], n, sizeof(DOTS_ALL));
+    if (b->n_yp) memcpy(BDOTS(b)[DIR_UP],    u, sizeof(DOTS_ALL));
+    if (b->n_yn) memcpy(BDOTS(b)[DIR_DOWN],  d, sizeof(DOTS_ALL));
+    if (b->n_xp) memcpy(BDOTS(b)[DIR_EAST],  e, sizeof(DOTS_ALL));
+    if (b->n_xn) memcpy(BDOTS(b)[DIR_WEST],  w, sizeof(DOTS_ALL));
+    if (b->n_zp) memcpy(BDOTS(b)[DIR_SOUTH], s, sizeof(DOTS_ALL));
+    if (b->n_zn) memcpy(BDOTS(b)[DIR_NORTH], n, sizeof(DOTS_ALL));
 }
 
 // update placed/empty flags of a buildtask only -
@@ -574,6 +1028,15 @@ static void build_update_placed() {
     int i;
     for(i=0; i<C(build.task); i++) {
         blk *b = P(build.task)+i;
+
+        // the world shows the blocks of missing chunks as air
+        int placed;
+        if (journal_get(b, &placed)) {
+            b->placed = placed;
+            b->empty  = 0;
+            continue;
+        }
+
         bid_t *slice = c.data[b->y-build.ymin]+c.boff;
         bid_t *row = slice+(b->z-build.zmin)*c.sa.x;
         bid_t bl = row[b->x-build.xmin];
@@ -596,7 +1059,7 @@ static void build_update_placed() {
 
 void set_block_dots(blk *b) {
     // determine usable dots on the neighbor faces
-    lh_clear_obj(b->dots);
+    memset(BDOTS(b), 0, sizeof(bdots));
 
     //const item_id *it = &ITEMS[b->b.bid];
     const int item_id = db_get_item_id_from_blk_id(b->b.raw);
@@ -628,10 +1091,10 @@ void set_block_dots(blk *b) {
         // Stairs
         const char *facing = db_get_blk_propval(b->b.raw,"facing");
         assert (facing);
-        if (!strcmp(facing, "north")) b->rdir = DIR_NORTH;
-        else if (!strcmp(facing, "south")) b->rdir = DIR_SOUTH;
-        else if (!strcmp(facing, "east")) b->rdir = DIR_EAST;
-        else if (!strcmp(facing, "west")) b->rdir = DIR_WEST;
+        if (!strcmp(facing, "north")) BRD(b)->rdir = DIR_NORTH;
+        else if (!strcmp(facing, "south")) BRD(b)->rdir = DIR_SOUTH;
+        else if (!strcmp(facing, "east")) BRD(b)->rdir = DIR_EAST;
+        else if (!strcmp(facing, "west")) BRD(b)->rdir = DIR_WEST;
         else assert(0);
 
         const char *half = db_get_blk_propval(b->b.raw,"half");
@@ -640,7 +1103,7 @@ void set_block_dots(blk *b) {
         else if (!strcmp(half, "bottom")) setdots(b, DOTS_NONE, DOTS_ALL, DOTS_LOWER, DOTS_LOWER, DOTS_LOWER, DOTS_LOWER);
         else assert(0);
         // determine the required look direction for the correct block placement
-        //b->rdir = (b->b.meta&2) ?
+        //BRD(b)->rdir = (b->b.meta&2) ?
         //    ((b->b.meta&1) ? DIR_NORTH : DIR_SOUTH ) :
         //    ((b->b.meta&1) ? DIR_WEST  : DIR_EAST );
         // the direction will be checked for each dot in remove_distant_dots()
@@ -695,7 +1158,7 @@ void set_block_dots(blk *b) {
 
     // else if (it->flags&I_RSRC) { // Redstone Repeater / Comparator
     //     // required look direction for the correct block placement
-    //     b->rdir = (b->b.meta&1) ?
+    //     BRD(b)->rdir = (b->b.meta&1) ?
     //         ((b->b.meta&2) ? DIR_WEST  : DIR_EAST ) :
     //         ((b->b.meta&2) ? DIR_SOUTH : DIR_NORTH);
     //     PLACE_ALL(b);
@@ -740,10 +1203,10 @@ void set_block_dots(blk *b) {
         // printf("NESWUD dx=%d, dz=%d, by=%d py=%d\n", dx, dz, b->y, py);
         if (obs ? !strcmp(facing, "up") : !strcmp(facing, "down"))       {if (dx>-2 && dx<2 && dz>-2 && dz<2 && b->y>py+2 )      { PLACE_CEIL(b); } else { PLACE_NONE(b); }}
         else if (obs ? !strcmp(facing, "down") : !strcmp(facing, "up"))    {if (dx>-2 && dx<2 && dz>-2 && dz<2 && b->y<py )        { PLACE_FLOOR(b); } else { PLACE_NONE(b); }}
-        else if (obs ? !strcmp(facing, "south") : !strcmp(facing, "north")) {if (dx==0 && (dz>2 || dz<-2) && b->y>=py && b->y<py+2) { PLACE_ALL(b); b->rdir=DIR_SOUTH; } else { PLACE_NONE(b); }}
-        else if (obs ? !strcmp(facing, "north") : !strcmp(facing, "south")) {if (dx==0 && (dz>2 || dz<-2) && b->y>=py && b->y<py+2) { PLACE_ALL(b); b->rdir=DIR_NORTH; } else { PLACE_NONE(b); }}
-        else if (obs ? !strcmp(facing, "west") : !strcmp(facing, "east"))  {if (dz==0 && (dx>2 || dx<-2) && b->y>=py && b->y<py+2) { PLACE_ALL(b); b->rdir=DIR_WEST; } else { PLACE_NONE(b); }}
-        else if (obs ? !strcmp(facing, "east") : !strcmp(facing, "west"))  {if (dz==0 && (dx>2 || dx<-2) && b->y>=py && b->y<py+2) { PLACE_ALL(b); b->rdir=DIR_EAST; } else { PLACE_NONE(b); }}
+        else if (obs ? !strcmp(facing, "south") : !strcmp(facing, "north")) {if (dx==0 && (dz>2 || dz<-2) && b->y>=py && b->y<py+2) { PLACE_ALL(b); BRD(b)->rdir=DIR_SOUTH; } else { PLACE_NONE(b); }}
+        else if (obs ? !strcmp(facing, "north") : !strcmp(facing, "south")) {if (dx==0 && (dz>2 || dz<-2) && b->y>=py && b->y<py+2) { PLACE_ALL(b); BRD(b)->rdir=DIR_NORTH; } else { PLACE_NONE(b); }}
+        else if (obs ? !strcmp(facing, "west") : !strcmp(facing, "east"))  {if (dz==0 && (dx>2 || dx<-2) && b->y>=py && b->y<py+2) { PLACE_ALL(b); BRD(b)->rdir=DIR_WEST; } else { PLACE_NONE(b); }}
+        else if (obs ? !strcmp(facing, "east") : !strcmp(facing, "west"))  {if (dz==0 && (dx>2 || dx<-2) && b->y>=py && b->y<py+2) { PLACE_ALL(b); BRD(b)->rdir=DIR_EAST; } else { PLACE_NONE(b); }}
         else PLACE_NONE(b);
 
     // else if (it->flags&I_RSDEV) { // Pistons, Dispensers and Droppers
@@ -761,19 +1224,19 @@ void set_block_dots(blk *b) {
     //         switch(b->b.meta&7) {
     //             case 0: if (b->y>=py+2) { PLACE_ALL(b); } else { PLACE_NONE(b); } break;
     //             case 1: if (b->y<py) { PLACE_ALL(b); } else { PLACE_NONE(b); } break;
-    //             case 2: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); b->rdir=DIR_SOUTH; } else { PLACE_NONE(b); } break;
-    //             case 3: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); b->rdir=DIR_NORTH; } else { PLACE_NONE(b); } break;
-    //             case 4: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); b->rdir=DIR_EAST; } else { PLACE_NONE(b); } break;
-    //             case 5: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); b->rdir=DIR_WEST; } else { PLACE_NONE(b); } break;
+    //             case 2: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); BRD(b)->rdir=DIR_SOUTH; } else { PLACE_NONE(b); } break;
+    //             case 3: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); BRD(b)->rdir=DIR_NORTH; } else { PLACE_NONE(b); } break;
+    //             case 4: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); BRD(b)->rdir=DIR_EAST; } else { PLACE_NONE(b); } break;
+    //             case 5: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); BRD(b)->rdir=DIR_WEST; } else { PLACE_NONE(b); } break;
     //             default: PLACE_NONE(b); break;
     //         }
     //     }
     //     else {
     //         switch(b->b.meta&7) {
-    //             case 2:  PLACE_ALL(b);  b->rdir=DIR_SOUTH; break;
-    //             case 3:  PLACE_ALL(b);  b->rdir=DIR_NORTH; break;
-    //             case 4:  PLACE_ALL(b);  b->rdir=DIR_EAST;  break;
-    //             case 5:  PLACE_ALL(b);  b->rdir=DIR_WEST;  break;
+    //             case 2:  PLACE_ALL(b);  BRD(b)->rdir=DIR_SOUTH; break;
+    //             case 3:  PLACE_ALL(b);  BRD(b)->rdir=DIR_NORTH; break;
+    //             case 4:  PLACE_ALL(b);  BRD(b)->rdir=DIR_EAST;  break;
+    //             case 5:  PLACE_ALL(b);  BRD(b)->rdir=DIR_WEST;  break;
     //             default: PLACE_NONE(b); break;
     //         }
     //     }
@@ -795,19 +1258,19 @@ void set_block_dots(blk *b) {
     //         switch(b->b.meta&7) {
     //             case 0: if (b->y>=py+2) { PLACE_ALL(b); } else { PLACE_NONE(b); } break;
     //             case 1: if (b->y<py) { PLACE_ALL(b); } else { PLACE_NONE(b); } break;
-    //             case 2: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); b->rdir=DIR_NORTH; } else { PLACE_NONE(b); } break;
-    //             case 3: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); b->rdir=DIR_SOUTH; } else { PLACE_NONE(b); } break;
-    //             case 4: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); b->rdir=DIR_WEST; } else { PLACE_NONE(b); } break;
-    //             case 5: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); b->rdir=DIR_EAST; } else { PLACE_NONE(b); } break;
+    //             case 2: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); BRD(b)->rdir=DIR_NORTH; } else { PLACE_NONE(b); } break;
+    //             case 3: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); BRD(b)->rdir=DIR_SOUTH; } else { PLACE_NONE(b); } break;
+    //             case 4: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); BRD(b)->rdir=DIR_WEST; } else { PLACE_NONE(b); } break;
+    //             case 5: if (b->y>=py && b->y<py+2) { PLACE_ALL(b); BRD(b)->rdir=DIR_EAST; } else { PLACE_NONE(b); } break;
     //             default: PLACE_NONE(b); break;
     //         }
     //     }
     //     else {
     //         switch(b->b.meta&7) {
-    //             case 2:  PLACE_ALL(b);  b->rdir=DIR_NORTH; break;
-    //             case 3:  PLACE_ALL(b);  b->rdir=DIR_SOUTH; break;
-    //             case 4:  PLACE_ALL(b);  b->rdir=DIR_WEST;  break;
-    //             case 5:  PLACE_ALL(b);  b->rdir=DIR_EAST;  break;
+    //             case 2:  PLACE_ALL(b);  BRD(b)->rdir=DIR_NORTH; break;
+    //             case 3:  PLACE_ALL(b);  BRD(b)->rdir=DIR_SOUTH; break;
+    //             case 4:  PLACE_ALL(b);  BRD(b)->rdir=DIR_WEST;  break;
+    //             case 5:  PLACE_ALL(b);  BRD(b)->rdir=DIR_EAST;  break;
     //             default: PLACE_NONE(b); break;
     //         }
     //     }
@@ -820,10 +1283,10 @@ void set_block_dots(blk *b) {
         else if (!strcmp(half, "lower")) {
             const char *facing = db_get_blk_propval(b->b.raw,"facing");
             assert (facing);
-            if (!strcmp(facing, "north")) b->rdir = DIR_NORTH;
-            else if (!strcmp(facing, "south")) b->rdir = DIR_SOUTH;
-            else if (!strcmp(facing, "east")) b->rdir = DIR_EAST;
-            else if (!strcmp(facing, "west")) b->rdir = DIR_WEST;
+            if (!strcmp(facing, "north")) BRD(b)->rdir = DIR_NORTH;
+            else if (!strcmp(facing, "south")) BRD(b)->rdir = DIR_SOUTH;
+            else if (!strcmp(facing, "east")) BRD(b)->rdir = DIR_EAST;
+            else if (!strcmp(facing, "west")) BRD(b)->rdir = DIR_WEST;
             else assert(0);
 
             const char *hinge = db_get_blk_propval(b->b.raw,"hinge");
@@ -839,7 +1302,7 @@ void set_block_dots(blk *b) {
         //     PLACE_NONE(b);
         // }
         // else {
-        //     b->rdir = (b->b.meta&1) ?
+        //     BRD(b)->rdir = (b->b.meta&1) ?
         //         ((b->b.meta&2) ? DIR_NORTH : DIR_SOUTH) :
         //         ((b->b.meta&2) ? DIR_WEST  : DIR_EAST );
 
@@ -889,10 +1352,10 @@ void set_block_dots(blk *b) {
     // else if (b->b.bid == 26) { // bed
     //     if (b->b.meta < 8) { // only place the foot of the bed
     //         switch (b->b.meta&3) { // ignore the occupied bit
-    //             case 0: b->rdir = DIR_SOUTH; break;
-    //             case 1: b->rdir = DIR_WEST; break;
-    //             case 2: b->rdir = DIR_NORTH; break;
-    //             case 3: b->rdir = DIR_EAST; break;
+    //             case 0: BRD(b)->rdir = DIR_SOUTH; break;
+    //             case 1: BRD(b)->rdir = DIR_WEST; break;
+    //             case 2: BRD(b)->rdir = DIR_NORTH; break;
+    //             case 3: BRD(b)->rdir = DIR_EAST; break;
     //         }
     //         PLACE_FLOOR(b);
     //     }
@@ -903,7 +1366,7 @@ void set_block_dots(blk *b) {
 
     // else if (it->flags&I_PLANT) {
     //     PLACE_FLOOR(b);
-    //     int fl = b->nblocks[DIR_DOWN].bid;
+    //     int fl = BRD(b)->nblocks[DIR_DOWN].bid;
 
     //     switch (b->b.bid) {
     //         case 0x06: // Sapling
@@ -941,21 +1404,21 @@ void set_block_dots(blk *b) {
 
     // else if (it->flags&I_CHEST) {
     //     switch (b->b.meta&7) {
-    //         case 2: b->rdir = DIR_SOUTH; break;
-    //         case 3: b->rdir = DIR_NORTH; break;
-    //         case 4: b->rdir = DIR_EAST; break;
-    //         case 5: b->rdir = DIR_WEST; break;
+    //         case 2: BRD(b)->rdir = DIR_SOUTH; break;
+    //         case 3: BRD(b)->rdir = DIR_NORTH; break;
+    //         case 4: BRD(b)->rdir = DIR_EAST; break;
+    //         case 5: BRD(b)->rdir = DIR_WEST; break;
     //     }
     //     PLACE_ALL(b);
     // }
 
     // else if (b->b.bid == 69) { // Lever
     //     switch(b->b.meta&7) {
-    //         case 0: PLACE_CEIL(b); b->rdir=DIR_SOUTH; break;
-    //         case 7: PLACE_CEIL(b); b->rdir=DIR_EAST; break;
+    //         case 0: PLACE_CEIL(b); BRD(b)->rdir=DIR_SOUTH; break;
+    //         case 7: PLACE_CEIL(b); BRD(b)->rdir=DIR_EAST; break;
 
-    //         case 5: PLACE_FLOOR(b); b->rdir=DIR_SOUTH; break;
-    //         case 6: PLACE_FLOOR(b); b->rdir=DIR_EAST; break;
+    //         case 5: PLACE_FLOOR(b); BRD(b)->rdir=DIR_SOUTH; break;
+    //         case 6: PLACE_FLOOR(b); BRD(b)->rdir=DIR_EAST; break;
 
     //         case 1: PLACE_EAST(b); break;
     //         case 2: PLACE_WEST(b); break;
@@ -978,10 +1441,10 @@ void set_block_dots(blk *b) {
 
     // else if (it->flags&I_GATE) {
     //     switch (b->b.meta&3) {
-    //         case 0: b->rdir = DIR_SOUTH; break;
-    //         case 1: b->rdir = DIR_WEST;  break;
-    //         case 2: b->rdir = DIR_NORTH; break;
-    //         case 3: b->rdir = DIR_EAST;  break;
+    //         case 0: BRD(b)->rdir = DIR_SOUTH; break;
+    //         case 1: BRD(b)->rdir = DIR_WEST;  break;
+    //         case 2: BRD(b)->rdir = DIR_NORTH; break;
+    //         case 3: BRD(b)->rdir = DIR_EAST;  break;
     //     }
     //     PLACE_ALL(b);
     // }
@@ -1001,18 +1464,18 @@ void set_block_dots(blk *b) {
     else if (db_item_is_facing_nesw(item_id)) {  // Terracotta & various others (facing with NESW variants)
         const char *facing = db_get_blk_propval(b->b.raw,"facing");
         assert (facing);
-        if (!strcmp(facing, "north")) {b->rdir = DIR_SOUTH;}
-        else if (!strcmp(facing, "south")) {b->rdir = DIR_NORTH;}
-        else if (!strcmp(facing, "east")) {b->rdir = DIR_WEST;}
-        else if (!strcmp(facing, "west")) {b->rdir = DIR_EAST;}
+        if (!strcmp(facing, "north")) {BRD(b)->rdir = DIR_SOUTH;}
+        else if (!strcmp(facing, "south")) {BRD(b)->rdir = DIR_NORTH;}
+        else if (!strcmp(facing, "east")) {BRD(b)->rdir = DIR_WEST;}
+        else if (!strcmp(facing, "west")) {BRD(b)->rdir = DIR_EAST;}
         else assert(0);
         PLACE_ALL(b);
         // else if (it->flags&I_TERRACOTA) { // Glazed Terracota
         //     switch (b->b.meta) {
-        //         case 0: b->rdir = DIR_NORTH; break;
-        //         case 1: b->rdir = DIR_EAST;  break;
-        //         case 2: b->rdir = DIR_SOUTH; break;
-        //         case 3: b->rdir = DIR_WEST;  break;
+        //         case 0: BRD(b)->rdir = DIR_NORTH; break;
+        //         case 1: BRD(b)->rdir = DIR_EAST;  break;
+        //         case 2: BRD(b)->rdir = DIR_SOUTH; break;
+        //         case 3: BRD(b)->rdir = DIR_WEST;  break;
         //     }
         //     PLACE_ALL(b);
         // }
@@ -1032,7 +1495,526 @@ void set_block_dots(blk *b) {
     int f;
     for (f=0; f<6; f++)
         if (!((b->neigh>>f)&1))
-            memset(b->dots[f], 0, sizeof(DOTS_ALL));
+            memset(BDOTS(b)[f], 0, sizeof(DOTS_ALL));
+}
+
+// Private: cell coordinates ordering - by X, Z, then Y
+static inline int cell_cmp(int32_t ax, int32_t ay, int32_t az, int32_t bx, int32_t by, int32_t bz) {
+    if (ax != bx) return (ax<bx) ? -1 : 1;
+    if (az != bz) return (az<bz) ? -1 : 1;
+    if (ay != by) return (ay<by) ? -1 : 1;
+    return 0;
+}
+
+typedef struct {
+    int32_t x,y,z;
+    int     idx;
+} cellblk;
+
+static int cellblk_compar(const void *a, const void *b) {
+    const cellblk *ca = a, *cb = b;
+    int c = cell_cmp(ca->x, ca->y, ca->z, cb->x, cb->y, cb->z);
+    return c ? c : ca->idx - cb->idx;
+}
+
+// find the cell with given cell coordinates, NULL if the task has no blocks there
+static bcell *find_cell(int32_t x, int32_t y, int32_t z) {
+    int lo=0, hi=C(build.cell)-1;
+    while (lo<=hi) {
+        int mid = (lo+hi)/2;
+        bcell *c = P(build.cell)+mid;
+        int r = cell_cmp(x, y, z, c->x, c->y, c->z);
+        if (!r) return c;
+        if (r<0) hi=mid-1; else lo=mid+1;
+    }
+    return NULL;
+}
+
+// find the chunk section with given coordinates, NULL if the task has no blocks there
+static bsection *find_section(int32_t X, int32_t Y, int32_t Z) {
+    int lo=0, hi=C(build.sect)-1;
+    while (lo<=hi) {
+        int mid = (lo+hi)/2;
+        bsection *s = P(build.sect)+mid;
+        int r = cell_cmp(X, Y, Z, s->X, s->Y, s->Z);
+        if (!r) return s;
+        if (r<0) hi=mid-1; else lo=mid+1;
+    }
+    return NULL;
+}
+
+// mark a section for the preview refresh
+static void invalidate_section(int32_t X, int32_t Y, int32_t Z) {
+    bsection *s = find_section(X, Y, Z);
+    if (!s) return;
+    s->dirty = 1;
+    build.pdirty = 1;
+}
+
+// position hash of the buildtask entries
+static inline uint32_t pos_hash(int32_t x, int32_t y, int32_t z) {
+    return ((uint32_t)x*73856093u) ^ ((uint32_t)y*19349663u) ^ ((uint32_t)z*83492791u);
+}
+
+// index of a buildtask block at this position, -1 if none
+static int task_at(int32_t x, int32_t y, int32_t z) {
+    if (!build.pidxsize) return -1;
+    uint32_t h = pos_hash(x,y,z)&(build.pidxsize-1);
+    for(; build.pidx[h]>=0; h=(h+1)&(build.pidxsize-1)) {
+        blk *b = P(build.task)+build.pidx[h];
+        if (b->x==x && b->y==y && b->z==z) return build.pidx[h];
+    }
+    return -1;
+}
+
+// Support dependencies - blocks can be placed only against a neighbor, so the
+// task blocks form a DAG from the blocks supported by the world outwards.
+// Gravity blocks are only supported from below. The blocks are assigned to
+// waves in topological order with a BFS, and placed wave by wave
+
+// true if a block has a supporting block in the world
+static int world_support(blk *b) {
+    int f, grav = db_blk_flags(b->b.raw)&BF_GRAVITY;
+    for(f=0; f<6; f++) {
+        if (grav && f!=DIR_DOWN) continue;
+        bid_t nb = get_block_at(b->x+NOFF[f][0], b->z+NOFF[f][1], b->y+NOFF[f][2]);
+        if (!db_blk_is_empty(nb.raw)) return 1;
+    }
+    return 0;
+}
+
+// every block in the queue becomes a support for its neighbors in the next
+// wave - the neighbors are lowered to that wave if they had a later one
+static void spread_waves(int *queue, int qh, int qt) {
+    int f;
+    while (qh<qt) {
+        blk *s = P(build.task)+queue[qh++];
+        for(f=0; f<6; f++) {
+            int d = task_at(s->x+NOFF[f][0], s->y+NOFF[f][2], s->z+NOFF[f][1]);
+            if (d<0) continue;
+            blk *b = P(build.task)+d;
+            if (b->wave <= s->wave+1) continue;
+            if ((db_blk_flags(b->b.raw)&BF_GRAVITY) && f!=DIR_UP) continue; // s must be below
+            b->wave = s->wave+1;
+            queue[qt++] = d;
+        }
+    }
+}
+
+static void build_waves() {
+    int i, n=C(build.task);
+    int *queue = malloc(n*sizeof(*queue));
+    int qt=0;
+
+    // wave 0 - blocks with a supporting block in the world
+    for(i=0; i<n; i++) {
+        blk *b = P(build.task)+i;
+        b->wave = WAVE_NONE;
+        if (world_support(b)) {
+            b->wave = 0;
+            queue[qt++] = i;
+        }
+    }
+
+    spread_waves(queue, 0, qt);
+    free(queue);
+}
+
+// a chunk has arrived - the blocks in it and along its border may have
+// got a world support they didn't have while the chunk was missing
+static void update_waves_chunk(int32_t X, int32_t Z) {
+    int i, j, qt=0;
+    int *queue = NULL;
+
+    for(i=0; i<C(build.sect); i++) {
+        bsection *s = P(build.sect)+i;
+        if (abs(s->X-X)>1 || abs(s->Z-Z)>1) continue;
+        for(j=s->first; j<s->first+s->count; j++) {
+            blk *b = P(build.task)+build.sidx[j];
+            if (!b->wave) continue;
+            if (((b->x-1)>>4)>X || ((b->x+1)>>4)<X || ((b->z-1)>>4)>Z || ((b->z+1)>>4)<Z)
+                continue; // not touching the chunk
+            if (!world_support(b)) continue;
+
+            if (!queue) lh_alloc_num(queue, C(build.task));
+            b->wave = 0;
+            queue[qt++] = build.sidx[j];
+        }
+    }
+    if (!queue) return;
+
+    spread_waves(queue, 0, qt);
+    free(queue);
+}
+
+// group the buildtask blocks into cells - must be called whenever the buildtask changes
+static void build_index() {
+    lh_arr_free(GAR(build.cell));
+    lh_free(build.cidx);
+    lh_free(build.pidx);
+    build.pidxsize = 0;
+    lh_arr_free(GAR(build.reach));
+    lh_arr_free(GAR(build.rdata));
+    lh_arr_free(GAR(build.rcell));
+    build.rvalid = 0;
+    lh_arr_free(GAR(build.bqh));
+    lh_arr_free(GAR(build.bq));
+    lh_arr_free(GAR(build.dots));
+    lh_arr_free(GAR(build.sect));
+    lh_free(build.sidx);
+
+    // world changes are not tracked without a buildtask
+    reset_dotmask();
+    if (!C(build.task)) return;
+
+    int i, n=C(build.task);
+    cellblk *cb = malloc(n*sizeof(*cb));
+    for(i=0; i<n; i++) {
+        blk *b = P(build.task)+i;
+        b->rslot = -1;
+        cb[i].x = b->x>>BCELL_SHIFT;
+        cb[i].y = b->y>>BCELL_SHIFT;
+        cb[i].z = b->z>>BCELL_SHIFT;
+        cb[i].idx = i;
+    }
+    qsort(cb, n, sizeof(*cb), cellblk_compar);
+
+    build.cidx = malloc(n*sizeof(*build.cidx));
+    bcell *c = NULL;
+    for(i=0; i<n; i++) {
+        if (!c || cell_cmp(cb[i].x, cb[i].y, cb[i].z, c->x, c->y, c->z)) {
+            c = lh_arr_new_c(GAR(build.cell));
+            c->x = cb[i].x;
+            c->y = cb[i].y;
+            c->z = cb[i].z;
+            c->first = i;
+            c->dirty = 1;
+        }
+        c->count++;
+        build.cidx[i] = cb[i].idx;
+    }
+
+    // same grouping by chunk sections for the preview
+    for(i=0; i<n; i++) {
+        blk *b = P(build.task)+i;
+        cb[i].x = b->x>>4;
+        cb[i].y = b->y>>4;
+        cb[i].z = b->z>>4;
+        cb[i].idx = i;
+    }
+    qsort(cb, n, sizeof(*cb), cellblk_compar);
+
+    build.sidx = malloc(n*sizeof(*build.sidx));
+    bsection *s = NULL;
+    for(i=0; i<n; i++) {
+        if (!s || cell_cmp(cb[i].x, cb[i].y, cb[i].z, s->X, s->Y, s->Z)) {
+            s = lh_arr_new_c(GAR(build.sect));
+            s->X = cb[i].x;
+            s->Y = cb[i].y;
+            s->Z = cb[i].z;
+            s->first = i;
+            s->dirty = 1;
+        }
+        s->count++;
+        build.sidx[i] = cb[i].idx;
+    }
+    free(cb);
+
+    // a preview is shown - bring it up to date with the new task
+    if (build.pmode) build.pdirty = 1;
+
+    // reverse index - world position to buildtask entries, at most half full
+    build.pidxsize = 64;
+    while (build.pidxsize < n*2) build.pidxsize <<= 1;
+    build.pidx = malloc(build.pidxsize*sizeof(*build.pidx));
+    memset(build.pidx, 0xff, build.pidxsize*sizeof(*build.pidx));
+    for(i=0; i<n; i++) {
+        blk *b = P(build.task)+i;
+        uint32_t h = pos_hash(b->x,b->y,b->z)&(build.pidxsize-1);
+        while (build.pidx[h]>=0) h=(h+1)&(build.pidxsize-1);
+        build.pidx[h] = i;
+    }
+
+    build_waves();
+}
+
+// Adaptive placement rate - the number of unconfirmed placements and the
+// interval between placements are adjusted AIMD-style: confirmations from
+// the server increase the rate additively, lost placements halve it
+
+#define RATE_STEP        10000  // interval decrease per confirmation (us)
+#define PEND_TIMEOUT   2000000  // placements unconfirmed this long are considered lost (us)
+
+static void rate_reset() {
+    build.window   = 1;
+    build.interval = buildopts.bldint;
+    build.rtt      = 0;
+    build.rate_ts  = gettimestamp();
+    build.rate_cnt = 0;
+    build.rate     = 0;
+}
+
+// forget all placements awaiting confirmation
+static void rate_clear_pending() {
+    int i;
+    for(i=0; i<C(build.pend); i++)
+        P(build.task)[P(build.pend)[i].idx].pending = 0;
+    C(build.pend) = 0;
+    build.window = 0;
+}
+
+// returns the timestamp the placement was sent at
+static uint64_t rate_remove_pending(blk *b) {
+    int i, idx = b-P(build.task);
+    uint64_t sent = 0;
+    for(i=0; i<C(build.pend); i++) {
+        if (P(build.pend)[i].idx == idx) {
+            sent = P(build.pend)[i].ts;
+            lh_arr_delete(GAR(build.pend),i);
+            break;
+        }
+    }
+    b->pending = 0;
+    return sent;
+}
+
+// the server has confirmed a placement - additive increase
+static void rate_confirm(blk *b, uint64_t ts) {
+    uint64_t sent = rate_remove_pending(b);
+
+    double lat = ts-sent;
+    build.rtt = build.rtt ? build.rtt*0.875+lat*0.125 : lat;
+
+    build.window += 1.0/build.window;
+    if (build.window > buildopts.winmax) build.window = buildopts.winmax;
+    build.interval -= RATE_STEP;
+    if (build.interval < buildopts.bldint) build.interval = buildopts.bldint;
+
+    // placements per second, measured over intervals of at least 1s
+    build.rate_cnt++;
+    if (ts > build.rate_ts+1000000) {
+        build.rate = (double)build.rate_cnt*1000000/(ts-build.rate_ts);
+        build.rate_ts = ts;
+        build.rate_cnt = 0;
+    }
+    hud_invalidate(HUDINV_BUILD);
+}
+
+// a placement was lost or refused - multiplicative decrease
+static void rate_decrease() {
+    build.window = MAX(1, build.window/2);
+    build.interval = MIN(buildopts.bldmax, build.interval*2);
+    hud_invalidate(HUDINV_BUILD);
+}
+
+// the server has answered a placement with a different block - it was refused
+static void rate_reject(blk *b) {
+    rate_remove_pending(b);
+    rate_decrease();
+}
+
+// expire the placements the server never confirmed
+static void rate_timeout(uint64_t ts) {
+    uint64_t timeout = MAX(PEND_TIMEOUT, 4*build.rtt);
+    int i;
+    for(i=C(build.pend)-1; i>=0; i--) {
+        bpend *pe = P(build.pend)+i;
+        if (ts-pe->ts < timeout) continue;
+
+        P(build.task)[pe->idx].pending = 0;
+        lh_arr_delete(GAR(build.pend),i);
+        rate_decrease();
+    }
+}
+
+static void update_world_state(blk *b);
+static void get_neighbors(blk *b, bid_t *nbl);
+static void journal_record(int idx, int placed);
+static void journal_sync_chunk(int32_t X, int32_t Z);
+
+// a block in the world has changed - update the buildtask entries at this
+// position and those having it as a neighbor directly
+static void invalidate_block(int32_t x, int32_t y, int32_t z) {
+    if (!build.pidxsize) return;
+
+    int f;
+    for(f=-1; f<6; f++) {
+        int32_t nx=x, ny=y, nz=z;
+        if (f>=0) {
+            nx += NOFF[f][0];
+            nz += NOFF[f][1];
+            ny += NOFF[f][2];
+        }
+
+        uint32_t h = pos_hash(nx,ny,nz)&(build.pidxsize-1);
+        for(; build.pidx[h]>=0; h=(h+1)&(build.pidxsize-1)) {
+            blk *b = P(build.task)+build.pidx[h];
+            if (b->x!=nx || b->y!=ny || b->z!=nz) continue;
+            if (f<0) b->shown.raw = 0; // the client shows the world block now
+            update_world_state(b);
+
+            // a refused placement is answered with the old block
+            if (f<0 && b->pending) {
+                if (b->placed)
+                    rate_confirm(b, gettimestamp());
+                else
+                    rate_reject(b);
+            }
+            if (f<0) journal_record(build.pidx[h], b->placed);
+            b->empty = b->inreach && b->avail;
+        }
+    }
+
+    invalidate_section(x>>4, y>>4, z>>4);
+    invalidate_dotmask(x,x, y,y, z,z);
+}
+
+// mark all cells in a chunk (and the bordering cells of the neighbor chunks) for update
+static void invalidate_chunk(int32_t X, int32_t Z) {
+    int32_t xmin = (X*16-1)>>BCELL_SHIFT, xmax = (X*16+16)>>BCELL_SHIFT;
+    int32_t zmin = (Z*16-1)>>BCELL_SHIFT, zmax = (Z*16+16)>>BCELL_SHIFT;
+    int i;
+    for(i=0; i<C(build.cell); i++) {
+        bcell *c = P(build.cell)+i;
+        if (c->x>=xmin && c->x<=xmax && c->z>=zmin && c->z<=zmax)
+            c->dirty = 1;
+    }
+
+    // the chunk data replaces whatever preview the client had there
+    for(i=0; i<C(build.sect); i++) {
+        bsection *s = P(build.sect)+i;
+        if (s->X!=X || s->Z!=Z) continue;
+        int j;
+        for(j=s->first; j<s->first+s->count; j++)
+            P(build.task)[build.sidx[j]].shown.raw = 0;
+        s->dirty = 1;
+        build.pdirty = 1;
+    }
+    invalidate_dotmask(X*16, X*16+15, dotmask.by-OCC_R, dotmask.by+OCC_R, Z*16, Z*16+15);
+}
+
+// update the cached buildtask state affected by world changes -
+// must be called after the gamestate has processed the packet
+void build_invalidate(MCPacket *pkt) {
+    if (!C(build.cell)) return;
+
+    int i;
+    switch (pkt->pid) {
+        case SP_BlockChange: {
+            SP_BlockChange_pkt *tpkt = &pkt->_SP_BlockChange;
+            invalidate_block(tpkt->pos.x, tpkt->pos.y, tpkt->pos.z);
+            break;
+        }
+        case SP_MultiBlockChange: {
+            SP_MultiBlockChange_pkt *tpkt = &pkt->_SP_MultiBlockChange;
+            for(i=0; i<tpkt->count; i++) {
+                blkrec *br = tpkt->blocks+i;
+                invalidate_block(tpkt->X*16+br->x, br->y, tpkt->Z*16+br->z);
+            }
+            break;
+        }
+        case SP_Explosion: {
+            SP_Explosion_pkt *tpkt = &pkt->_SP_Explosion;
+            for(i=0; i<tpkt->count; i++)
+                invalidate_block((int)tpkt->x+tpkt->blocks[i].dx,
+                                 (int)tpkt->y+tpkt->blocks[i].dy,
+                                 (int)tpkt->z+tpkt->blocks[i].dz);
+            break;
+        }
+        case SP_ChunkData: {
+            SP_ChunkData_pkt *tpkt = &pkt->_SP_ChunkData;
+            invalidate_chunk(tpkt->chunk.X, tpkt->chunk.Z);
+            journal_sync_chunk(tpkt->chunk.X, tpkt->chunk.Z);
+            update_waves_chunk(tpkt->chunk.X, tpkt->chunk.Z);
+            break;
+        }
+        case SP_UnloadChunk: {
+            SP_UnloadChunk_pkt *tpkt = &pkt->_SP_UnloadChunk;
+            invalidate_chunk(tpkt->X, tpkt->Z);
+            break;
+        }
+        case SP_JoinGame:
+        case SP_Respawn:
+            for(i=0; i<C(build.cell); i++)
+                P(build.cell)[i].dirty = 1;
+            for(i=0; i<C(build.sect); i++)
+                P(build.sect)[i].dirty = 1;
+            for(i=0; i<C(build.task); i++)
+                P(build.task)[i].shown.raw = 0;
+            build.pdirty = 1;
+            reset_dotmask();
+            break;
+    }
+}
+
+// collect the buildtask blocks around the player position - only the cells
+// intersecting the reach sphere are visited, and the list is reused while
+// the player stays in the same block
+static void update_reach() {
+    int32_t px = floor(gs.own.x);
+    int32_t py = floor(gs.own.y);
+    int32_t pz = floor(gs.own.z);
+    if (build.rvalid && px==build.rx && py==build.ry && pz==build.rz) return;
+
+    // keep the previous list - the placement data of the blocks staying in reach is reused
+    int *oreach = P(build.reach);
+    ssize_t onum = C(build.reach);
+    brdata *ordata = P(build.rdata);
+    P(build.reach) = NULL;
+    P(build.rdata) = NULL;
+    C(build.reach) = C(build.rdata) = 0;
+    lh_arr_free(GAR(build.rcell));
+
+    int i;
+
+    // coarse reach from anywhere within the player's block
+    int r = (int)ceil(MAXREACH_COARSE)+2;
+    int32_t cx,cy,cz;
+    for(cx=(px-r)>>BCELL_SHIFT; cx<=(px+r)>>BCELL_SHIFT; cx++) {
+        for(cz=(pz-r)>>BCELL_SHIFT; cz<=(pz+r)>>BCELL_SHIFT; cz++) {
+            for(cy=(py-r)>>BCELL_SHIFT; cy<=(py+r)>>BCELL_SHIFT; cy++) {
+                bcell *c = find_cell(cx,cy,cz);
+                if (!c) continue;
+                *lh_arr_new(GAR(build.rcell)) = c-P(build.cell);
+
+                for(i=c->first; i<c->first+c->count; i++) {
+                    blk *b = P(build.task)+build.cidx[i];
+                    if (SQ(b->x-px)+SQ(b->y-py)+SQ(b->z-pz) <= r*r)
+                        *lh_arr_new(GAR(build.reach)) = build.cidx[i];
+                }
+            }
+        }
+    }
+
+    lh_arr_allocate_c(GAR(build.rdata), C(build.reach));
+    for(i=0; i<C(build.reach); i++) {
+        blk *b = P(build.task)+P(build.reach)[i];
+        brdata *rd = P(build.rdata)+i;
+        if (b->rslot >= 0) {
+            *rd = ordata[b->rslot];
+        }
+        else {
+            get_neighbors(b, rd->nblocks);
+            rd->rdir = DIR_ANY;
+        }
+        rd->dslot = -1;
+    }
+
+    for(i=0; i<onum; i++) {
+        blk *b = P(build.task)+oreach[i];
+        b->inreach = 0;
+        b->empty = 0;
+        b->rslot = -1;
+    }
+    for(i=0; i<C(build.reach); i++)
+        P(build.task)[P(build.reach)[i]].rslot = i;
+    lh_free(oreach);
+    lh_free(ordata);
+
+    build.rx = px;
+    build.ry = py;
+    build.rz = pz;
+    build.rvalid = 1;
 }
 
 // update inreach flag for the blocks - calculate which
@@ -1040,9 +2022,11 @@ void set_block_dots(blk *b) {
 int update_inreach() {
     int i, num_inreach=0;
 
-    for(i=0; i<C(build.task); i++) {
-        blk *b = P(build.task)+i;
-        b->state = 0; // clear flags
+    update_reach();
+
+    for(i=0; i<C(build.reach); i++) {
+        blk *b = P(build.task)+P(build.reach)[i];
+        b->empty = 0;
         b->inreach = 1;
 
         // make sure we're not building outside of the y coord range
@@ -1061,104 +2045,147 @@ int update_inreach() {
         double dx = gs.own.x - b->x + 0.5;
         double dy = gs.own.y - b->y + 0.5;
         double dz = gs.own.z - b->z + 0.5;
-        b->dist = sqrt((SQ(dx)+SQ(dy)+SQ(dz)));
+        BRD(b)->dist = sqrt((SQ(dx)+SQ(dy)+SQ(dz)));
 
-        b->inreach = (b->dist<MAXREACH_COARSE);
+        b->inreach = (BRD(b)->dist<MAXREACH_COARSE);
         num_inreach += b->inreach;
     }
 
     return num_inreach;
 }
 
-// update placed and avail flags for the blocks in the buildtask, and
-// the neighbor mask
-int update_placed() {
-    int i, num_avail=0;
-
-    // determine which blocks are occupied and which neighbors are available
-    build.nbq = 0;
-    for(i=0; i<C(build.task); i++) {
-        blk *b = P(build.task)+i;
-        b->placed  = 0;
-        b->needadj = 0;
-        b->empty   = 0;
+// types of the world blocks at the neighbor positions
+static void get_neighbors(blk *b, bid_t *nbl) {
+    nbl[DIR_UP]    = get_block_at(b->x,b->z,b->y+1);
+    nbl[DIR_DOWN]  = get_block_at(b->x,b->z,b->y-1);
+    nbl[DIR_SOUTH] = get_block_at(b->x,b->z+1,b->y);
+    nbl[DIR_NORTH] = get_block_at(b->x,b->z-1,b->y);
+    nbl[DIR_EAST]  = get_block_at(b->x+1,b->z,b->y);
+    nbl[DIR_WEST]  = get_block_at(b->x-1,b->z,b->y);
+}
 
-        if (!b->inreach) continue;
+// check if a world block counts as the placed task block - the same rule as in
+// update_world_state: a block of the same type in another state is accepted,
+// except for slabs
+static int block_placed(blk *b, bid_t bl) {
+    if (bl.raw == b->b.raw) return 1;
+    if (db_get_blk_default_id(bl.raw) != db_get_blk_default_id(b->b.raw)) return 0;
+    return !db_blk_is_slab(b->b.raw);
+}
 
-        // world block at the position this btask block would be placed
-        bid_t bl = get_block_at(b->x, b->z, b->y);
+// update the cached placed and avail flags and the neighbor mask of one block
+static void update_world_state(blk *b) {
+    b->placed  = 0;
+    b->needadj = 0;
+    b->empty   = 0;
+
+    // blocks in the chunks we don't have keep their journaled state
+    int placed;
+    if (journal_get(b, &placed)) {
+        b->placed = placed;
+        b->avail  = 0;
+        b->neigh  = 0;
+        return;
+    }
 
-        //const item_id *it = &ITEMS[b->b.bid];
-        //int smask = (it->flags&I_STATE_MASK)^15;
+    // world block at the position this btask block would be placed
+    bid_t bl = get_block_at(b->x, b->z, b->y);
 
-        // check if this block is already correctly placed (including meta)
-        if ( bl.raw == b->b.raw ) {
-            //raws match - TODO also allow waterlogged differences.
-            b->placed = 1;
-        }
-        else if (db_get_blk_default_id(bl.raw ) == db_get_blk_default_id(b->b.raw ) ) {
-            //printf("Block match but different state ID %i vs %i\n", bl.raw,b->b.raw);
+    //const item_id *it = &ITEMS[b->b.bid];
+    //int smask = (it->flags&I_STATE_MASK)^15;
 
-            if ( db_item_is_slab(db_get_item_id_from_blk_id(b->b.raw)) ) {
-                //item is a slab
-                if ( !strcmp(db_get_blk_propval(b->b.raw ,"type"),"double") )  {
-                    // we want to place a doubleslab here and the block already contains
-                    // a suitable slab - mark it as empty, so we can place the second slab
-                    if ( !strcmp(db_get_blk_propval(bl.raw ,"type"),"bottom") ||
-                         !strcmp(db_get_blk_propval(bl.raw ,"type"),"top") )
-                        b->empty = 1;
-                }
+    // check if this block is already correctly placed (including meta)
+    if ( bl.raw == b->b.raw ) {
+        //raws match - TODO also allow waterlogged differences.
+        b->placed = 1;
+    }
+    else if (db_get_blk_default_id(bl.raw ) == db_get_blk_default_id(b->b.raw ) ) {
+        //printf("Block match but different state ID %i vs %i\n", bl.raw,b->b.raw);
+
+        if ( db_blk_is_slab(b->b.raw) ) {
+            //item is a slab
+            slab_strings();
+            dbstr_t type = slabstr.type;
+            if ( db_get_blk_propval_h(b->b.raw, type) == slabstr.dbl )  {
+                // we want to place a doubleslab here and the block already contains
+                // a suitable slab - mark it as empty, so we can place the second slab
+                dbstr_t half = db_get_blk_propval_h(bl.raw, type);
+                if ( half == slabstr.bottom || half == slabstr.top )
+                    b->empty = 1;
             }
-            //TODO: else if ( adjustable ) { }
-
-            else b->placed = 1;  //I guess just mark it placed for now...defaults are matching.  Need to do better
-
-            //else if (it->flags&I_ADJ) {
-                // meta is not correct, but this block is adjustable
-                // consider it placed, but mark it for adjustment
-            //        b->placed = 1;
-            //        b->needadj = 1;
-            //    }
-            // else - some block with the correct ID, but incorrect meta was placed
-            // (e.g. wrong wool color)
-            // }
         }
-        else {
-            // else - the block is occupied by something insuitable
-        }
-        //else if ( (bl.bid == 0x97 && b->b.bid == 0xb2) || (bl.bid == 0xb2 && b->b.bid == 0x97) ) {
-            // special case - daylight sensor
-            // adjustment toggles between two block IDs instead of meta
-        //    b->placed = 1;
-        //    b->needadj = 1;
-        //}
-        // else - placed is set to 0
-
-
-        // check if the block is empty, but ignore those that are already
-        // placed - this way we can support "empty" blocks like water in our buildplan
-        if (!b->empty)
-            b->empty = db_blk_is_empty(bl.raw) && !b->placed;
-        // from now on, b->empty indicates that this block can be technically placed here
-
-        //TODO: when placing a double slab, prevent obstruction - place the slab further away first
-        //TODO: take care when placing a slab over a slab - prevent a doubleslab creation
-
-        // determine which neighbors do we have
-        bid_t nbl;
-        nbl = b->nblocks[DIR_UP] = get_block_at(b->x,b->z,b->y+1);
-        b->n_yp = !db_blk_is_empty(nbl.raw);
-        nbl = b->nblocks[DIR_DOWN] = get_block_at(b->x,b->z,b->y-1);
-        b->n_yn = !db_blk_is_empty(nbl.raw);
-        nbl = b->nblocks[DIR_SOUTH] = get_block_at(b->x,b->z+1,b->y);
-        b->n_zp = !db_blk_is_empty(nbl.raw);
-        nbl = b->nblocks[DIR_NORTH] = get_block_at(b->x,b->z-1,b->y);
-        b->n_zn = !db_blk_is_empty(nbl.raw);
-        nbl = b->nblocks[DIR_EAST]  = get_block_at(b->x+1,b->z,b->y);
-        b->n_xp = !db_blk_is_empty(nbl.raw);
-        nbl = b->nblocks[DIR_WEST]  = get_block_at(b->x-1,b->z,b->y);
-        b->n_xn = !db_blk_is_empty(nbl.raw);
+        //TODO: else if ( adjustable ) { }
+
+        else b->placed = 1;  //I guess just mark it placed for now...defaults are matching.  Need to do better
+
+        //else if (it->flags&I_ADJ) {
+            // meta is not correct, but this block is adjustable
+            // consider it placed, but mark it for adjustment
+        //        b->placed = 1;
+        //        b->needadj = 1;
+        //    }
+        // else - some block with the correct ID, but incorrect meta was placed
+        // (e.g. wrong wool color)
+        // }
+    }
+    else {
+        // else - the block is occupied by something insuitable
+    }
+    //else if ( (bl.bid == 0x97 && b->b.bid == 0xb2) || (bl.bid == 0xb2 && b->b.bid == 0x97) ) {
+        // special case - daylight sensor
+        // adjustment toggles between two block IDs instead of meta
+    //    b->placed = 1;
+    //    b->needadj = 1;
+    //}
+    // else - placed is set to 0
+
+
+    // check if the block is empty, but ignore those that are already
+    // placed - this way we can support "empty" blocks like water in our buildplan
+    if (!b->empty)
+        b->empty = db_blk_is_empty(bl.raw) && !b->placed;
+    // from now on, b->avail indicates that this block can be technically placed here
+    b->avail = b->empty;
+
+    //TODO: when placing a double slab, prevent obstruction - place the slab further away first
+    //TODO: take care when placing a slab over a slab - prevent a doubleslab creation
+
+    // determine which neighbors do we have - the neighbor types are
+    // only kept for the blocks around the player
+    bid_t nbt[6], *nbl = (b->rslot>=0) ? BRD(b)->nblocks : nbt;
+    get_neighbors(b, nbl);
+    b->n_yp = !db_blk_is_empty(nbl[DIR_UP].raw);
+    b->n_yn = !db_blk_is_empty(nbl[DIR_DOWN].raw);
+    b->n_zp = !db_blk_is_empty(nbl[DIR_SOUTH].raw);
+    b->n_zn = !db_blk_is_empty(nbl[DIR_NORTH].raw);
+    b->n_xp = !db_blk_is_empty(nbl[DIR_EAST].raw);
+    b->n_xn = !db_blk_is_empty(nbl[DIR_WEST].raw);
+
+    // blocks become candidates only once they have a support, gravity
+    // blocks need it beneath
+    if (db_blk_flags(b->b.raw)&BF_GRAVITY) {
+        if (!b->n_yn) b->avail = 0;
+    }
+    else if (!b->neigh) b->avail = 0;
+}
+
+// update placed and avail flags for the blocks in the buildtask, and
+// the neighbor mask - only the cells with world changes are updated
+int update_placed() {
+    int i, j, num_avail=0;
+
+    bq_clear();
+    for(i=0; i<C(build.rcell); i++) {
+        bcell *c = P(build.cell)+P(build.rcell)[i];
+        if (!c->dirty) continue;
+        for(j=c->first; j<c->first+c->count; j++)
+            update_world_state(P(build.task)+build.cidx[j]);
+        c->dirty = 0;
+    }
 
+    for(i=0; i<C(build.reach); i++) {
+        blk *b = P(build.task)+P(build.reach)[i];
+        b->empty = b->inreach && b->avail;
         if (b->empty) num_avail++;
     }
 
@@ -1174,8 +2201,8 @@ void update_seal() {
     int num_empty=0;
 
     // determine limits for blocks in btask that still need placing
-    for(i=0; i<C(build.task); i++) {
-        blk *b = P(build.task)+i;
+    for(i=0; i<C(build.reach); i++) {
+        blk *b = P(build.task)+P(build.reach)[i];
 
         if (b->empty) {
             if (b->x<minx || !num_empty) minx=b->x;
@@ -1190,8 +2217,8 @@ void update_seal() {
 
     // depending on pivot direction, mark only blocks on certain side of
     // btask as suitable for seal mode
-    for(i=0; i<C(build.task); i++) {
-        blk *b = P(build.task)+i;
+    for(i=0; i<C(build.reach); i++) {
+        blk *b = P(build.task)+P(build.reach)[i];
         if (!b->empty) continue;
 
         switch (build.pv.dir) {
@@ -1205,9 +2232,15 @@ void update_seal() {
 
 void update_dots() {
     int i;
-    for(i=0; i<C(build.task); i++) {
-        blk *b = P(build.task)+i;
-        b->rdir = DIR_ANY;
+    C(build.dots) = 0;
+    for(i=0; i<C(build.reach); i++) {
+        blk *b = P(build.task)+P(build.reach)[i];
+        brdata *rd = BRD(b);
+        rd->dslot = -1;
+        if (!b->inreach) continue;
+        rd->rdir = DIR_ANY;
+        rd->dslot = C(build.dots);
+        lh_arr_new_c(GAR(build.dots));
 
         if (b->needadj) {
             // we can handle adjustment clicks on the block itself in similar fashion
@@ -1219,12 +2252,12 @@ void update_dots() {
             // disable faces looking away from you
             // note - this is opposite from what we do below for building blocks!
             if (!buildopts.anyface) {
-                if (b->y > gs.own.ly+1) memset(b->dots[DIR_UP],    0, sizeof(DOTS_ALL));
-                if (b->y < gs.own.ly+2) memset(b->dots[DIR_DOWN],  0, sizeof(DOTS_ALL));
-                if (b->x > gs.own.lx)   memset(b->dots[DIR_EAST],  0, sizeof(DOTS_ALL));
-                if (b->x < gs.own.lx)   memset(b->dots[DIR_WEST],  0, sizeof(DOTS_ALL));
-                if (b->z > gs.own.lz)   memset(b->dots[DIR_SOUTH], 0, sizeof(DOTS_ALL));
-                if (b->z < gs.own.lz)   memset(b->dots[DIR_NORTH], 0, sizeof(DOTS_ALL));
+                if (b->y > gs.own.ly+1) memset(BDOTS(b)[DIR_UP],    0, sizeof(DOTS_ALL));
+                if (b->y < gs.own.ly+2) memset(BDOTS(b)[DIR_DOWN],  0, sizeof(DOTS_ALL));
+                if (b->x > gs.own.lx)   memset(BDOTS(b)[DIR_EAST],  0, sizeof(DOTS_ALL));
+                if (b->x < gs.own.lx)   memset(BDOTS(b)[DIR_WEST],  0, sizeof(DOTS_ALL));
+                if (b->z > gs.own.lz)   memset(BDOTS(b)[DIR_SOUTH], 0, sizeof(DOTS_ALL));
+                if (b->z < gs.own.lz)   memset(BDOTS(b)[DIR_NORTH], 0, sizeof(DOTS_ALL));
             }
         }
         else {
@@ -1237,12 +2270,12 @@ void update_dots() {
 
             // disable faces looking away from you
             if (!buildopts.anyface) {
-                if (b->y < gs.own.ly+1) memset(b->dots[DIR_UP],    0, sizeof(DOTS_ALL));
-                if (b->y > gs.own.ly+2) memset(b->dots[DIR_DOWN],  0, sizeof(DOTS_ALL));
-                if (b->x < gs.own.lx)   memset(b->dots[DIR_EAST],  0, sizeof(DOTS_ALL));
-                if (b->x > gs.own.lx)   memset(b->dots[DIR_WEST],  0, sizeof(DOTS_ALL));
-                if (b->z < gs.own.lz)   memset(b->dots[DIR_SOUTH], 0, sizeof(DOTS_ALL));
-                if (b->z > gs.own.lz)   memset(b->dots[DIR_NORTH], 0, sizeof(DOTS_ALL));
+                if (b->y < gs.own.ly+1) memset(BDOTS(b)[DIR_UP],    0, sizeof(DOTS_ALL));
+                if (b->y > gs.own.ly+2) memset(BDOTS(b)[DIR_DOWN],  0, sizeof(DOTS_ALL));
+                if (b->x < gs.own.lx)   memset(BDOTS(b)[DIR_EAST],  0, sizeof(DOTS_ALL));
+                if (b->x > gs.own.lx)   memset(BDOTS(b)[DIR_WEST],  0, sizeof(DOTS_ALL));
+                if (b->z < gs.own.lz)   memset(BDOTS(b)[DIR_SOUTH], 0, sizeof(DOTS_ALL));
+                if (b->z > gs.own.lz)   memset(BDOTS(b)[DIR_NORTH], 0, sizeof(DOTS_ALL));
             }
         }
     }
@@ -1264,6 +2297,12 @@ void update_boundary() {
         build.zmin = MIN(build.zmin, P(build.task)[i].z);
         build.zmax = MAX(build.zmax, P(build.task)[i].z);
     }
+
+    // keep the chunks of the buildtask resident in the gamestate
+    extent_t ex = { { build.xmin, build.ymin, build.zmin }, { build.xmax, build.ymax, build.zmax } };
+    gs_pin_extent(&ex);
+
+    build_index();
     //printf("Buildtask boundary: X: %d - %d   Z: %d - %d   Y: %d - %d\n",
     //       build.xmin, build.xmax, build.zmin, build.zmax, build.ymin, build.ymax);
 }
@@ -1272,67 +2311,67 @@ void update_boundary() {
 void build_update() {
     if (!build.active) return;
 
-    int i,f;
+    int i;
 
     if (!update_inreach() || !update_placed() ) {
         // no potentially buildable blocks nearby - don't bother with the rest
-        build.nbq = 0;
-        build.bq[0] = -1;
+        bq_clear();
+        mat_nplan = 0;
         return;
     }
 
     if (buildopts.sealmode) update_seal();
     update_dots();
 
-    build.nbq = 0;
-    for(i=0; i<C(build.task); i++) {
-        blk *b = P(build.task)+i;
-        if (!b->empty) continue;
+    bq_clear();
+    for(i=0; i<C(build.reach); i++) {
+        blk *b = P(build.task)+P(build.reach)[i];
+        if (!b->empty || BRD(b)->dslot<0) continue;
         remove_slab_dots(b);
         remove_distant_dots(b);
-        b->ndots = count_dots(b);
-        if (b->ndots>0 && build.nbq<MAXBUILDABLE)
-            build.bq[build.nbq++] = i;
+        BRD(b)->ndots = count_dots(b);
+        if (BRD(b)->ndots>0)
+            bq_push(P(build.reach)[i]);
     }
-    build.bq[build.nbq] = -1;
 
-    qsort(build.bq, build.nbq, sizeof(build.bq[0]), sort_blocks);
+    plan_materials();
 
-    //TODO: calculate obstruction
     //TODO: allow less restricted placement rules through option
 }
 
 // randomly choose which of the suitable dots we are going to use to place the block
 static int choose_dot(blk *b, int8_t *face, int8_t *cx, int8_t *cy, int8_t *cz) {
     int f,dr,dc;
-    int i=random()%b->ndots;
+    int i=random()%BRD(b)->ndots;
 
     for(f=0; f<6; f++) {
         if (!((b->neigh>>f)&1)) continue;
         for(dr=0; dr<15; dr++) {
-            uint16_t dots = b->dots[f][dr];
-            if (!dots) continue;
-            for(dc=0; dc<15; dc++) {
-                if ((dots>>dc)&1) {
-                    i--;
-                    if (i<0) {
-                        dotpos_t dotpos = DOTPOS[f];
-                        *face = f;
-                        *cx = (dotpos.x+dotpos.rx*dr+dotpos.cx*dc)/2;
-                        *cy = (dotpos.y+dotpos.ry*dr+dotpos.cy*dc)/2;
-                        *cz = (dotpos.z+dotpos.rz*dr+dotpos.cz*dc)/2;
-                        //printf("choose_dot: face=%d dot=%d,%d, cur=%d,%d,%d\n",*face,dr,dc,*cx,*cy,*cz);
-                        return 1;
-                    }
-                }
+            uint16_t dots = BDOTS(b)[f][dr]&0x7fff;
+            int n = count_dots_row(dots);
+            if (i >= n) {
+                i -= n;
+                continue;
             }
+
+            // select the i-th set bit in this row
+            for(; i>0; i--) dots &= dots-1;
+            dc = __builtin_ctz(dots);
+
+            dotpos_t dotpos = DOTPOS[f];
+            *face = f;
+            *cx = (dotpos.x+dotpos.rx*dr+dotpos.cx*dc)/2;
+            *cy = (dotpos.y+dotpos.ry*dr+dotpos.cy*dc)/2;
+            *cz = (dotpos.z+dotpos.rz*dr+dotpos.cz*dc)/2;
+            //printf("choose_dot: face=%d dot=%d,%d, cur=%d,%d,%d\n",*face,dr,dc,*cx,*cy,*cz);
+            return 1;
         }
     }
 
     char name[256];
     double dist = sqrt(SQ((double)b->x-gs.own.x)+SQ((double)b->y-gs.own.y)+SQ((double)b->z-gs.own.z));
     printf("Warning: choose_dot failed : coord=%d,%d,%d, dist=%.1f (%.1f), mat=%d (%s), state=%02x, neigh=%02x, ndots=%d\n",
-           b->x,b->y,b->z,b->dist,dist,b->b.raw, db_get_blk_name(b->b.raw), b->state, b->neigh, b->ndots);
+           b->x,b->y,b->z,BRD(b)->dist,dist,b->b.raw, db_get_blk_name(b->b.raw), b->state, b->neigh, BRD(b)->ndots);
 
     return 0;
 }
@@ -1342,27 +2381,60 @@ void build_progress(MCPacketQueue *sq, MCPacketQueue *cq) {
     // time update - try to build any blocks from the placeable blocks list
     if (!build.active) return;
 
+    route_progress(cq);
+
     // do not attempt to build while jumping or falling (i.e. feet not on ground)
     if (!(gs.own.onground || buildopts.bjump)) return;
 
     uint64_t ts = gettimestamp();
 
-    if (ts < build.lastbuild+buildopts.bldint) return;
+    // placements are tracked until confirmed in the adaptive mode only,
+    // otherwise the blocks are retried after blkint as before
+    if (buildopts.adaptive) {
+        if (!build.window) rate_reset();
+        rate_timeout(ts);
+    }
+    else if (C(build.pend)) {
+        rate_clear_pending();
+    }
+
+    int interval = buildopts.bldint;
+    int maxbld = buildopts.blkmax;
+    if (buildopts.adaptive) {
+        // slow down on a lagging server
+        interval = build.interval;
+        if (gs.tick.tps > 0 && gs.tick.tps < 20)
+            interval = interval*20/gs.tick.tps;
+
+        // limit the number of placements awaiting confirmation
+        maxbld = MIN(maxbld, (int)build.window-C(build.pend));
+        if (maxbld <= 0) {
+            prefetch_ahead(sq, cq);
+            return;
+        }
+    }
+
+    if (ts < build.lastbuild+interval) {
+        // use the idle time to fetch upcoming materials
+        prefetch_ahead(sq, cq);
+        return;
+    }
 
-    int i, bc=0;
+    int i, bi, bc=0;
     int held=gs.inv.held;
 
-    for(i=0; i<build.nbq && bc<buildopts.blkmax; i++) {
+    for(i=0; bc<maxbld && (bi=bq_get(i))>=0; i++) {
         char buf[4096];
         char buf2[4096];
 
-        blk *b = P(build.task)+build.bq[i];
-        if (ts-b->last < buildopts.blkint) continue;
+        blk *b = P(build.task)+bi;
+        if (b->pending) continue;
+        if (ts-BRD(b)->last < buildopts.blkint) continue;
 
         // fetch block's material into quickbar slot
         int islot = prefetch_material(sq, cq, b->b.raw);
         if (islot==-1) continue; // we don't have this material
-        if (islot==-2) return; // inventory action is in progress, postpone building
+        if (islot==-2) return; // inventory pipeline is full, postpone building
         //TODO: notify user about missing materials
         //printf("Changing Held\n");
         // silently switch to this slot
@@ -1388,8 +2460,7 @@ void build_progress(MCPacketQueue *sq, MCPacketQueue *cq) {
                    b->x,b->y,b->z, db_get_item_name(hslot->item));
         }
         else {
-            const int nit = db_get_item_id_from_blk_id(b->nblocks[face].raw );
-            if ( ( db_item_is_container(nit) || db_item_is_adj(nit) ) && !gs.own.crouched )
+            if ( (db_blk_flags(BRD(b)->nblocks[face].raw) & (BF_CONT|BF_ADJ)) && !gs.own.crouched )
                 needcrouch=1;
 
 #if 0
@@ -1399,7 +2470,7 @@ void build_progress(MCPacketQueue *sq, MCPacketQueue *cq) {
                    "Rot=%.2f,%.2f  Dir=%d (%s) %s\n",
                    b->x,b->y,b->z, db_get_item_name(hslot->item),
                    b->x+NOFF[face][0],b->z+NOFF[face][1],b->y+NOFF[face][2],
-                   b->nblocks[face].raw, db_get_blk_name(b->nblocks[face].raw),
+                   BRD(b)->nblocks[face].raw, db_get_blk_name(BRD(b)->nblocks[face].raw),
                    face, cx, cy, cz,
                    gs.own.x, (double)gs.own.y+EYEHEIGHT, gs.own.z,
                    tx,ty,tz,
@@ -1508,21 +2579,238 @@ void build_progress(MCPacketQueue *sq, MCPacketQueue *cq) {
         tpl2->onground = gs.own.onground;
         queue_packet(pl2,sq);
 
-        b->last = ts;
+        BRD(b)->last = ts;
+        if (!b->needadj && buildopts.adaptive) {
+            b->pending = 1;
+            bpend *pe = lh_arr_new(GAR(build.pend));
+            pe->idx = bi;
+            pe->ts = ts;
+        }
+        // the material is only predicted until the swap is confirmed
+        if (gmi_slot_unconfirmed(islot+36))
+            *lh_arr_new(GAR(build.unconf)) = bi;
         build.lastbuild = ts;
-        mat_last[islot] = ts;
         bc++;
     }
 
     // switch back to whatever the client was holding
     if (held != gs.inv.held)
         gmi_change_held(sq, cq, held, 0);
+
+    prefetch_ahead(sq, cq);
 }
 
 void build_pause() {
     build.active = 0;
 }
 
+// the inventory swaps in flight are all confirmed or have failed - in the latter
+// case the placements made with their material may have used a wrong block,
+// which the buildtask can't fix by itself, so list them for the user
+void build_swaps_settled(MCPacketQueue *cq, int failed) {
+    if (failed && C(build.unconf)) {
+        char reply[256];
+        sprintf(reply, "%zd placements used unconfirmed material, check for wrong blocks:",
+                C(build.unconf));
+        chat_message(reply, cq, "green", 0);
+
+        int i;
+        for(i=0; i<C(build.unconf) && i<8; i++) {
+            int bi = P(build.unconf)[i];
+            if (bi >= C(build.task)) continue;
+            blk *b = P(build.task)+bi;
+            sprintf(reply, "  %d,%d,%d (%s)", b->x, b->y, b->z, db_get_blk_name(b->b.raw));
+            chat_message(reply, cq, "green", 0);
+        }
+    }
+    C(build.unconf) = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Route planning
+
+static void route_free() {
+    lh_arr_free(GAR(build.route));
+    lh_free(build.wpidx);
+    build.wpnext = 0;
+}
+
+static inline double wp_dist(bwaypt *a, bwaypt *b) {
+    return sqrt(SQ(a->x-b->x)+SQ(a->y-b->y)+SQ(a->z-b->z));
+}
+
+static inline int32_t route_cell(int32_t v, int32_t size) {
+    return (v>=0) ? v/size : -((size-1-v)/size);
+}
+
+static void route_reverse(bwaypt *w, int lo, int hi) {
+    for(; lo<hi; lo++, hi--) {
+        bwaypt t = w[lo]; w[lo] = w[hi]; w[hi] = t;
+    }
+}
+
+// order the waypoints of a layer in serpentine rows along the z axis,
+// starting at the corner nearest to s - the waypoints are sorted by x,z
+static void route_serpentine(bwaypt *w, int n, bwaypt *s) {
+    if (abs(w[n-1].x-s->x) < abs(w[0].x-s->x))
+        route_reverse(w, 0, n-1);
+
+    bwaypt *prev = s;
+    int i,j;
+    for(i=0; i<n; i=j) {
+        int32_t row = route_cell(w[i].x, ROUTE_XZ_SIZE);
+        for(j=i; j<n && route_cell(w[j].x, ROUTE_XZ_SIZE)==row; j++);
+        if (abs(w[j-1].z-prev->z) < abs(w[i].z-prev->z))
+            route_reverse(w, i, j-1);
+        prev = w+j-1;
+    }
+}
+
+// order the waypoints for a short path starting at s - nearest neighbor
+// (serpentine rows for large layers) first, then improved with 2-opt moves
+// limited to short sections and to the time budget ending at deadline
+static void route_order(bwaypt *w, int n, bwaypt *s, uint64_t deadline) {
+    int i,j;
+    if (n<2) return;
+
+    if (n > ROUTE_MAXNN) {
+        route_serpentine(w, n, s);
+    }
+    else {
+        bwaypt *prev = s;
+        for(i=0; i<n; i++) {
+            int best = i;
+            double bd = wp_dist(prev, w+i);
+            for(j=i+1; j<n; j++) {
+                double d = wp_dist(prev, w+j);
+                if (d < bd) { bd = d; best = j; }
+            }
+            bwaypt t = w[i]; w[i] = w[best]; w[best] = t;
+            prev = w+i;
+        }
+    }
+
+    // reverse a section if it makes the path shorter - the end of the path is open
+    int pass, improved=1;
+    for(pass=0; pass<ROUTE_2OPT && improved; pass++) {
+        improved = 0;
+        for(i=0; i<n-1; i++) {
+            if (!(i&255) && gettimestamp() > deadline) return;
+            bwaypt *a = i ? w+i-1 : s;
+            int jmax = MIN(n, i+ROUTE_2OPT_WIN);
+            for(j=i+1; j<jmax; j++) {
+                double d0 = wp_dist(a, w+i);
+                double d1 = wp_dist(a, w+j);
+                if (j<n-1) {
+                    d0 += wp_dist(w+j, w+j+1);
+                    d1 += wp_dist(w+i, w+j+1);
+                }
+                if (d1 >= d0-1e-9) continue;
+                route_reverse(w, i, j);
+                improved = 1;
+            }
+        }
+    }
+}
+
+// predicate function to group the blocks by route layer and column
+static int route_compar(const void *a, const void *b) {
+    const cellblk *ca = a, *cb = b;
+    if (ca->y != cb->y) return (ca->y<cb->y) ? -1 : 1;
+    if (ca->x != cb->x) return (ca->x<cb->x) ? -1 : 1;
+    if (ca->z != cb->z) return (ca->z<cb->z) ? -1 : 1;
+    return ca->idx - cb->idx;
+}
+
+// plan the standing positions to place the remaining blocks of the buildtask -
+// layers are built bottom-up, the waypoints of each layer are ordered for a short path
+static int build_route() {
+    route_free();
+    if (!C(build.task)) return 0;
+    build_update_placed();
+
+    int i, n=0;
+    cellblk *cb = malloc(C(build.task)*sizeof(*cb));
+    for(i=0; i<C(build.task); i++) {
+        blk *b = P(build.task)+i;
+        if (b->placed) continue;
+        cb[n].x = route_cell(b->x, ROUTE_XZ_SIZE);
+        cb[n].y = route_cell(b->y, ROUTE_Y_SIZE);
+        cb[n].z = route_cell(b->z, ROUTE_XZ_SIZE);
+        cb[n].idx = i;
+        n++;
+    }
+    qsort(cb, n, sizeof(*cb), route_compar);
+
+    // one waypoint per column of a layer, above the centroid of its blocks
+    build.wpidx = malloc(MAX(n,1)*sizeof(*build.wpidx));
+    for(i=0; i<n; ) {
+        bwaypt *w = lh_arr_new_c(GAR(build.route));
+        cellblk *c = cb+i;
+        int64_t sx=0, sz=0;
+        int32_t top = P(build.task)[c->idx].y;
+        w->first = i;
+        for(; i<n && cb[i].x==c->x && cb[i].y==c->y && cb[i].z==c->z; i++) {
+            blk *b = P(build.task)+cb[i].idx;
+            build.wpidx[i] = cb[i].idx;
+            sx += b->x;
+            sz += b->z;
+            top = MAX(top, b->y);
+            w->count++;
+        }
+        w->x = floor((double)sx/w->count+0.5);
+        w->z = floor((double)sz/w->count+0.5);
+        w->y = top+1;
+    }
+
+    // order the waypoints of each layer, starting from the player position
+    bwaypt start = { floor(gs.own.x), floor(gs.own.y), floor(gs.own.z) };
+    bwaypt *st = &start;
+    uint64_t deadline = gettimestamp()+ROUTE_BUDGET;
+    int w0, w1;
+    for(w0=0; w0<C(build.route); w0=w1) {
+        int32_t layer = cb[P(build.route)[w0].first].y;
+        for(w1=w0; w1<C(build.route) && cb[P(build.route)[w1].first].y==layer; w1++);
+        route_order(P(build.route)+w0, w1-w0, st, deadline);
+        st = P(build.route)+w1-1;
+    }
+
+    free(cb);
+    return C(build.route);
+}
+
+// announce the next waypoint in chat
+static void route_announce(MCPacketQueue *cq) {
+    char reply[256];
+    if (build.wpnext >= C(build.route)) {
+        sprintf(reply, "Route finished");
+    }
+    else {
+        bwaypt *w = P(build.route)+build.wpnext;
+        sprintf(reply, "Waypoint %d/%zd: %d,%d,%d (%d blocks)", build.wpnext+1, C(build.route),
+                w->x, w->y, w->z, w->count);
+    }
+    chat_message(reply, cq, "gold", 0);
+    hud_invalidate(HUDINV_BUILD);
+}
+
+// advance to the next waypoint once all blocks of the current one are placed
+static void route_progress(MCPacketQueue *cq) {
+    if (build.wpnext >= C(build.route)) return;
+
+    int advanced = 0;
+    while (build.wpnext < C(build.route)) {
+        bwaypt *w = P(build.route)+build.wpnext;
+        int i;
+        for(i=w->first; i<w->first+w->count; i++)
+            if (!P(build.task)[build.wpidx[i]].placed) break;
+        if (i < w->first+w->count) break;
+        build.wpnext++;
+        advanced = 1;
+    }
+
+    if (advanced) route_announce(cq);
+}
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1530,6 +2818,308 @@ void build_pause() {
 
 #define DEFAULT_TASK_FILENAME "autosave"
 
+////////////////////////////////////////////////////////////////////////////////
+// Task journal - the buildtask is written once as a header, followed by the
+// records of confirmed placements, appended in batches and compacted periodically
+
+#define JNL_MAGIC       0x4d43424a  // "MCBJ"
+#define JNL_INTERVAL    1000000     // minimum interval between journal writes (us)
+#define JNL_COMPACT     65536       // minimum number of records before compaction
+#define JNL_BATCH       16384       // entries written per call during compaction
+
+#define JNL_PLACED      1
+#define JNL_REMOVED     2
+
+struct {
+    char    fname[256];         // journal file, empty if journaling is off
+    uint8_t *placed;            // journaled placed state, a bit per task block - it is
+                                // authoritative for the blocks in chunks we don't have
+    int     n;                  // number of task blocks in the bitmap
+    lh_arr_declare(int32_t,rec);// changes not written yet - task index, ~index if removed
+    int     nrec;               // records in the file
+    int     compact;            // the journal must be rewritten completely
+    int64_t last;               // timestamp of the last write
+
+    FILE    *cfd;               // temporary file of the compaction in progress
+    int     cpos;               // next entry the compaction writes - blocks, then records
+    int     cnrec;              // records written by the compaction so far
+} journal;
+
+#define JNL_GET(i) ((journal.placed[(i)>>3]>>((i)&7))&1)
+
+static void journal_alloc(int n) {
+    lh_free(journal.placed);
+    lh_alloc_num(journal.placed, (n+7)/8);
+    journal.n = n;
+}
+
+static void journal_abort_compact();
+
+// start journaling the current buildtask - the header is written on the next flushes
+static void journal_start(const char *name) {
+    journal_abort_compact();
+    build_update_placed();
+    journal_alloc(C(build.task));
+    int i;
+    for(i=0; i<C(build.task); i++)
+        if (P(build.task)[i].placed)
+            journal.placed[i>>3] |= 1<<(i&7);
+
+    sprintf(journal.fname, "tasks/%s.bjnl", name);
+    C(journal.rec) = 0;
+    journal.nrec = 0;
+    journal.compact = 1;
+}
+
+static void journal_abort_compact() {
+    if (!journal.cfd) return;
+    fclose(journal.cfd);
+    journal.cfd = NULL;
+
+    char tname[260];
+    sprintf(tname, "%s.tmp", journal.fname);
+    unlink(tname);
+}
+
+static void journal_stop() {
+    journal_abort_compact();
+    journal.fname[0] = 0;
+    lh_free(journal.placed);
+    journal.n = 0;
+    lh_arr_free(GAR(journal.rec));
+}
+
+// get the journaled state of a block whose chunk we don't have -
+// returns 0 if the world state should be used instead
+static int journal_get(blk *b, int *placed) {
+    if (!journal.placed) return 0;
+    int idx = b-P(build.task);
+    if (idx >= journal.n) return 0;
+    if (find_chunk(gs.world, b->x>>4, b->z>>4, 0)) return 0;
+    *placed = JNL_GET(idx);
+    return 1;
+}
+
+static void journal_record(int idx, int placed) {
+    if (!journal.placed || idx >= journal.n) return;
+    if (JNL_GET(idx) == !!placed) return;
+    journal.placed[idx>>3] ^= 1<<(idx&7);
+    *lh_arr_new(GAR(journal.rec)) = placed ? idx : ~idx;
+}
+
+// the world state of the blocks in a loaded chunk replaces the journaled one
+static void journal_sync_section(bsection *s) {
+    int i;
+    for(i=s->first; i<s->first+s->count; i++) {
+        blk *b = P(build.task)+build.sidx[i];
+        update_world_state(b);
+        b->empty = b->inreach && b->avail;
+        journal_record(build.sidx[i], b->placed);
+    }
+}
+
+// a chunk has arrived - bring the journal in line with it
+static void journal_sync_chunk(int32_t X, int32_t Z) {
+    if (!journal.placed) return;
+
+    int i;
+    for(i=0; i<C(build.sect); i++) {
+        bsection *s = P(build.sect)+i;
+        if (s->X==X && s->Z==Z)
+            journal_sync_section(s);
+    }
+}
+
+// write the next batch of the compaction - the journal is rewritten from the
+// bitmap into a temporary file, which replaces it once complete.
+// Returns 1 when the compaction is finished, 0 if it is still in progress, -1 on error
+static int journal_compact_step() {
+    char tname[260];
+    sprintf(tname, "%s.tmp", journal.fname);
+    int n = journal.n;
+
+    if (!journal.cfd) {
+        journal.cfd = fopen(tname, "wb");
+        if (!journal.cfd) return -1;
+
+        uint8_t hdr[8], *w = hdr;
+        lh_write_int_be(w, JNL_MAGIC);
+        lh_write_int_be(w, n);
+        if (fwrite(hdr, 1, sizeof(hdr), journal.cfd) != sizeof(hdr)) {
+            journal_abort_compact();
+            return -1;
+        }
+
+        // the changes so far are in the bitmap - those made from now
+        // on are appended once the new journal is in place
+        C(journal.rec) = 0;
+        journal.cpos = 0;
+        journal.cnrec = 0;
+    }
+
+    // the task blocks first, then a record for each placed block
+    lh_create_buf(buf, 14*JNL_BATCH);
+    uint8_t *w = buf;
+    int end = MIN(journal.cpos+JNL_BATCH, 2*n);
+    for(; journal.cpos<end; journal.cpos++) {
+        int i = journal.cpos;
+        if (i < n) {
+            blk *b = P(build.task)+i;
+            lh_write_int_be(w, b->x);
+            lh_write_int_be(w, b->y);
+            lh_write_int_be(w, b->z);
+            lh_write_short_be(w, b->b.raw);
+        }
+        else if (JNL_GET(i-n)) {
+            lh_write_char(w, JNL_PLACED);
+            lh_write_int_be(w, i-n);
+            journal.cnrec++;
+        }
+    }
+
+    size_t len = w-buf;
+    size_t wb = fwrite(buf, 1, len, journal.cfd);
+    lh_free(buf);
+    if (wb != len) {
+        journal_abort_compact();
+        return -1;
+    }
+    if (journal.cpos < 2*n) return 0;
+
+    int err = fclose(journal.cfd);
+    journal.cfd = NULL;
+    if (err || rename(tname, journal.fname)) {
+        unlink(tname);
+        return -1;
+    }
+
+    journal.nrec = journal.cnrec;
+    journal.compact = 0;
+    return 1;
+}
+
+// append the pending records to the journal
+static int journal_append() {
+    FILE *fd = fopen(journal.fname, "ab");
+    if (!fd) return 0;
+
+    lh_create_buf(buf, 5*C(journal.rec));
+    uint8_t *w = buf;
+    int i;
+    for(i=0; i<C(journal.rec); i++) {
+        int32_t r = P(journal.rec)[i];
+        lh_write_char(w, (r>=0) ? JNL_PLACED : JNL_REMOVED);
+        lh_write_int_be(w, (r>=0) ? r : ~r);
+    }
+
+    size_t len = w-buf;
+    size_t wb = fwrite(buf, 1, len, fd);
+    fclose(fd);
+    lh_free(buf);
+    if (wb != len) return 0;
+
+    journal.nrec += C(journal.rec);
+    C(journal.rec) = 0;
+    return 1;
+}
+
+// write out the journal changes - called periodically, or with force=1
+// when the buildtask is about to be dropped
+void build_journal_flush(int force) {
+    if (!journal.placed) return;
+
+    // a compaction in progress continues on every call
+    if (!journal.cfd) {
+        int64_t ts = gettimestamp();
+        if (!force && ts-journal.last < JNL_INTERVAL) return;
+        journal.last = ts;
+
+        // there can be at most one live record per block - compact once the
+        // journal has grown past that
+        if (journal.nrec+C(journal.rec) > MAX(journal.n, JNL_COMPACT))
+            journal.compact = 1;
+    }
+
+    // the compaction is written in batches, so a large task doesn't stall the proxy
+    if (journal.compact) {
+        int r;
+        do {
+            r = journal_compact_step();
+        } while (force && r==0);
+
+        if (r<0) printf("Failed to write the task journal %s\n", journal.fname);
+        if (r<=0) return;
+    }
+
+    if (C(journal.rec) && !journal_append())
+        printf("Failed to append to the task journal %s\n", journal.fname);
+}
+
+// load the buildtask from the journal, restoring the placed state of the blocks
+static int journal_load(const char *name) {
+    char fname[256];
+    sprintf(fname, "tasks/%s.bjnl", name);
+
+    uint8_t *buf;
+    ssize_t sz = lh_load_alloc(fname, &buf);
+    if (sz <= 0) return 0;
+
+    uint8_t *p = buf;
+    if (sz < 8 || lh_read_int_be(p) != JNL_MAGIC) {
+        lh_free(buf);
+        return 0;
+    }
+
+    int32_t i, n = lh_read_int_be(p);
+    if (n < 0 || 8+14*(ssize_t)n > sz) {
+        lh_free(buf);
+        return 0;
+    }
+
+    for(i=0; i<n; i++) {
+        blk *b = lh_arr_new_c(BTASK);
+        b->x = lh_read_int_be(p);
+        b->y = lh_read_int_be(p);
+        b->z = lh_read_int_be(p);
+        b->b.raw = lh_read_short_be(p);
+    }
+
+    // replay the records - a truncated last record is ignored
+    journal_alloc(n);
+    int nrec = 0;
+    while (p+5 <= buf+sz) {
+        int type = lh_read_char(p);
+        int32_t idx = lh_read_int_be(p);
+        if (idx < 0 || idx >= n) continue;
+        if (type == JNL_PLACED)
+            journal.placed[idx>>3] |= 1<<(idx&7);
+        else
+            journal.placed[idx>>3] &= ~(1<<(idx&7));
+        nrec++;
+    }
+    for(i=0; i<n; i++)
+        P(build.task)[i].placed = JNL_GET(i);
+
+    lh_free(buf);
+
+    // continue journaling into the same file
+    strcpy(journal.fname, fname);
+    C(journal.rec) = 0;
+    journal.nrec = nrec;
+    journal.compact = 0;
+
+    update_boundary();
+
+    // the chunks we have already are not sent again
+    for(i=0; i<C(build.sect); i++) {
+        bsection *s = P(build.sect)+i;
+        if (find_chunk(gs.world, s->X, s->Z, 0))
+            journal_sync_section(s);
+    }
+
+    return 1;
+}
+
 int build_tsave(const char *name) {
     char fname[256];
     sprintf(fname, "tasks/%s.bplan", name);
@@ -1554,7 +3144,11 @@ int build_tsave(const char *name) {
     return (sz>0) ? 1 : 0;
 }
 
+// returns 2 if the buildtask was resumed from the journal, 1 if loaded from the plan
 int build_tload(const char *name) {
+    // resume from the journal if there is one - no need to rescan the world
+    if (journal_load(name)) return 2;
+
     char fname[256];
     sprintf(fname, "tasks/%s.bplan", name);
 
@@ -1620,7 +3214,7 @@ void place_pivot(pivot_t pv, MCPacketQueue *sq, MCPacketQueue *cq) {
         build.pv = pv;
         update_boundary();
         build_update();
-        build_tsave(DEFAULT_TASK_FILENAME);
+        journal_start(DEFAULT_TASK_FILENAME);
     }
 
     if (trimmed > 0) {
@@ -1896,9 +3490,10 @@ void build_dump_task() {
     char buf[256];
     for(i=0; i<C(build.task); i++) {
         blk *b = &P(build.task)[i];
+        brdata *rd = (b->rslot>=0) ? BRD(b) : NULL;
         printf("%3d %+5d,%+5d,%3d   %.2f   %c%c%c %c%c%c%c%c%c %-3d   %5d %4d (%s) \n",
                i, b->x, b->z, b->y,
-               b->dist,
+               rd ? rd->dist : 0,
                b->inreach?'R':'.',
                b->empty  ?'E':'.',
                b->placed ?'P':'.',
@@ -1909,7 +3504,7 @@ void build_dump_task() {
                b->n_zn ? '*':'.',
                b->n_xp ? '*':'.',
                b->n_xn ? '*':'.',
-               b->ndots,
+               rd ? rd->ndots : 0,
 
                b->b.raw, db_get_item_id_from_blk_id(b->b.raw), db_get_blk_name(b->b.raw));
     }
@@ -1917,13 +3512,13 @@ void build_dump_task() {
 
 // dump our buildqueue to console
 void build_dump_queue() {
-    int i;
+    int i, bi;
     char buf[256];
-    for(i=0; i<build.nbq; i++) {
-        blk *b = P(build.task)+build.bq[i];
+    for(i=0; (bi=bq_get(i))>=0; i++) {
+        blk *b = P(build.task)+bi;
         printf("%3d %+5d,%+5d,%3d   %.2f   %c%c%c %c%c%c%c%c%c %-3d   %4d (%s)\n",
-               build.bq[i], b->x, b->z, b->y,
-               b->dist,
+               bi, b->x, b->z, b->y,
+               BRD(b)->dist,
                b->inreach?'R':'.',
                b->empty  ?'E':'.',
                b->placed ?'P':'.',
@@ -1934,7 +3529,7 @@ void build_dump_queue() {
                b->n_zn ? '*':'.',
                b->n_xp ? '*':'.',
                b->n_xn ? '*':'.',
-               b->ndots,
+               BRD(b)->ndots,
 
                b->b.raw, db_get_blk_name(b->b.raw));
     }
@@ -1952,78 +3547,62 @@ void build_dump_queue() {
 #define PREVIEW_TRUE    2
 #define PREVIEW_REMOVE_NOQUEUE  3
 
+// bring the preview of a section up to date - only the blocks that differ from
+// what the client shows are sent, and nothing if the whole section matches
+static void preview_section(bsection *s, int mode, MCPacketQueue *q) {
+    s->dirty = 0;
+
+    // skip sections in unloaded chunks - they are refreshed when the chunk arrives
+    if (!find_chunk(gs.world, s->X, s->Z, 0)) return;
+
+    int i, n=0;
+    blkrec *recs = NULL;
+    for(i=s->first; i<s->first+s->count; i++) {
+        blk *b = P(build.task)+build.sidx[i];
+        b->current = get_block_at(b->x,b->z,b->y);
+
+        // depending on the preview mode, select which block will be shown -
+        // the blocks the builder considers done are left alone
+        bid_t want = { .raw = 0 };
+        if (mode!=PREVIEW_REMOVE && !block_placed(b, b->current) &&
+            !(build.limit && b->y>build.limit))
+            want = (mode==PREVIEW_TRUE) ? b->b : PREVIEW_BLOCK;
+
+        if (want.raw == b->shown.raw) continue;
+        b->shown = want;
+
+        if (!recs) lh_alloc_num(recs, s->count);
+        recs[n].x = b->x&15;
+        recs[n].z = b->z&15;
+        recs[n].y = b->y&15;
+        recs[n].bid = want.raw ? want : b->current;
+        n++;
+    }
+    if (!n) return;
+
+    NEWPACKET(SP_MultiBlockChange, mbc);
+    tmbc->X = s->X;
+    tmbc->Z = s->Z;
+    tmbc->Y = s->Y;   //1.16.2 now does chunk sections
+    tmbc->count = n;
+    tmbc->blocks = recs;
+    queue_packet(mbc, q);
+}
+
 void build_show_preview(MCPacketQueue *sq, MCPacketQueue *cq, int mode) {
     if (C(build.task)<=0) return;
-    build_update_placed();
-
-    int npackets=0;
-    MCPacket *packets[1000];
-    lh_clear_obj(packets);
-
-    int i,j;
-    for(i=0; i<C(build.task); i++) {
-        blk *b = &P(build.task)[i];
-        if (build.limit && b->y>build.limit) continue;
-        if (b->placed) continue;
-
-        int32_t X=b->x>>4;
-        int32_t Z=b->z>>4;
-        int32_t Y=b->y>>4;   //1.16.2 now does chunk sections
-
-        // skip blocks located in unloaded chunks
-        gschunk *gc = find_chunk(gs.world, X, Z, 0);
-        if (!gc) continue;
-
-        // see if we already have a packet for this chunk prepared
-        SP_MultiBlockChange_pkt *tpkt=NULL;
-        for(j=0; j<npackets; j++) {
-            if (packets[j]->_SP_MultiBlockChange.X==X &&
-                packets[j]->_SP_MultiBlockChange.Y==Y &&   //1.16.2 now does chunk sections
-                packets[j]->_SP_MultiBlockChange.Z==Z) {
-                tpkt = &packets[j]->_SP_MultiBlockChange;
-                break;
-            }
-        }
-
-        // no such packet - make new
-        if (!tpkt) {
-            if (npackets >= 1000) continue; // too many packets already - skip it
-            NEWPACKET(SP_MultiBlockChange, mbc);
-            packets[npackets++] = mbc;
-            tpkt = tmbc;
-            tmbc->X = X;
-            tmbc->Z = Z;
-            tmbc->Y = Y;
-        }
-
-        // depending on the preview mode, select which block will be shown
-        bid_t bid;
-        switch (mode) {
-            case PREVIEW_REMOVE:
-            case PREVIEW_REMOVE_NOQUEUE:
-                bid = b->current;
-                break;
-            case PREVIEW_MISSING:
-                bid = PREVIEW_BLOCK;
-                break;
-            case PREVIEW_TRUE:
-                bid = b->b;
-                break;
-        }
 
-        // add new block to the packet
-        lh_resize(tpkt->blocks, tpkt->count+1);
-        tpkt->blocks[tpkt->count].x = b->x&15;
-        tpkt->blocks[tpkt->count].z = b->z&15;
-        tpkt->blocks[tpkt->count].y = b->y&15;
-        tpkt->blocks[tpkt->count].bid = bid;
-        tpkt->count++;
+    MCPacketQueue *q = &build.preview_queue;
+    if (mode==PREVIEW_REMOVE_NOQUEUE) {
+        mode = PREVIEW_REMOVE;
+        q = cq;
     }
+    build.pmode = mode;
 
-    for(i=0; i<npackets; i++)
-        queue_packet(packets[i], (mode==PREVIEW_REMOVE_NOQUEUE) ? cq : &build.preview_queue);
-
-    //printf("Created %d packets\n",npackets);
+    int i;
+    for(i=0; i<C(build.sect); i++)
+        preview_section(P(build.sect)+i, mode, q);
+    build.pdirty = 0;
 }
 
 // rate-limited sending of preview packets to the client
@@ -2033,6 +3612,15 @@ void build_show_preview(MCPacketQueue *sq, MCPacketQueue *cq, int mode) {
 TBDEF(tb_preview, PREVIEW_INTERVAL, PREVIEW_MAXPACKETS);
 
 void build_preview_transmit(MCPacketQueue *cq) {
+    // refresh the sections changed by the world or task updates
+    if (build.pdirty && build.pmode!=PREVIEW_REMOVE) {
+        int i;
+        for(i=0; i<C(build.sect); i++)
+            if (P(build.sect)[i].dirty)
+                preview_section(P(build.sect)+i, build.pmode, &build.preview_queue);
+        build.pdirty = 0;
+    }
+
     packet_queue_transmit(cq, &build.preview_queue, &tb_preview);
 }
 
@@ -2053,10 +3641,18 @@ void build_clear(MCPacketQueue *sq, MCPacketQueue *cq) {
 void build_cancel(MCPacketQueue *sq, MCPacketQueue *cq) {
     if (!buildopts.preview_retain && sq && cq)
         build_show_preview(sq, cq, PREVIEW_REMOVE_NOQUEUE);
+    build.pmode = PREVIEW_REMOVE;
     build.active = 0;
+    build_journal_flush(1);
+    journal_stop();
     lh_arr_free(BTASK);
-    build.bq[0] = -1;
+    build_index();
+    gs_pin_extent(NULL);
     build.nbrp = 0; // clear the pending queue
+    lh_arr_free(GAR(build.pend));
+    lh_arr_free(GAR(build.unconf));
+    build.window = 0;
+    route_free();
     buildopts.sealmode = 0; // always cancel seal mode
 }
 
@@ -2484,10 +4080,12 @@ void build_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
     CMD(tload) {
         char *name = words[0] ? words[0] : DEFAULT_TASK_FILENAME;
         build_clear(sq, cq);
-        if (!build_tload(name))
+        int res = build_tload(name);
+        if (!res)
             sprintf(reply, "Failed to load %s.bplan\n",name);
         else
-            sprintf(reply, "Loaded %zd blocks from %s.bplan\n", C(build.task),name);
+            sprintf(reply, "Loaded %zd blocks from %s.%s\n", C(build.task),name,
+                    (res==2) ? "bjnl" : "bplan");
         build.active =1;
 
         goto Error;
@@ -2768,6 +4366,26 @@ void build_cmd(char **words, MCPacketQueue *sq, MCPacketQueue *cq) {
         goto Error;
     }
 
+    CMD2(route,ro) {
+        NEEDBT;
+        if (words[0] && (!strcmp(words[0],"clear") || !strcmp(words[0],"-"))) {
+            route_free();
+            hud_invalidate(HUDINV_BUILD);
+            goto Error;
+        }
+
+        int nwp = build_route();
+        double len = 0;
+        int i;
+        for(i=1; i<nwp; i++)
+            len += wp_dist(P(build.route)+i-1, P(build.route)+i);
+        sprintf(reply, "Route: %d waypoints, %.0f blocks long", nwp, len);
+        chat_message(reply, cq, "green", 0);
+        reply[0] = 0;
+        route_announce(cq);
+        goto Error;
+    }
+
     sprintf(reply, "Unrecognized command");
     goto Error;
 
@@ -2819,3 +4437,183 @@ int build_packet(MCPacket *pkt, MCPacketQueue *sq, MCPacketQueue *cq) {
 
     return 1;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Dot selection benchmark - built as a standalone program with -DTEST=1
+
+#if TEST
+
+// the proxy is not linked in
+void drop_connection() {}
+
+#define BENCH_SIDE   10     // the buildqueue is a cube of BENCH_SIDE^3 blocks around the player
+#define BENCH_ROUNDS 100
+
+// all blocks are placeable, have all neighbors and all dots usable
+static void bench_setup() {
+    gs.own.x = 0.5;
+    gs.own.y = 64;
+    gs.own.z = 0.5;
+
+    int x,y,z;
+    for(y=0; y<BENCH_SIDE; y++) {
+        for(z=0; z<BENCH_SIDE; z++) {
+            for(x=0; x<BENCH_SIDE; x++) {
+                int idx = C(build.task);
+                blk *b = lh_arr_new_c(BTASK);
+                b->x = x-BENCH_SIDE/2;
+                b->y = y-BENCH_SIDE/2+64;
+                b->z = z-BENCH_SIDE/2;
+                b->neigh = 0x3f;
+                b->empty = 1;
+                b->inreach = 1;
+                b->rslot = idx;
+                *lh_arr_new(GAR(build.reach)) = idx;
+
+                // every other block requires a look direction
+                brdata *rd = lh_arr_new_c(GAR(build.rdata));
+                rd->rdir = (idx&1) ? DIR_SOUTH+(idx>>1)%4 : DIR_ANY;
+                rd->dslot = C(build.dots);
+                lh_arr_new_c(GAR(build.dots));
+            }
+        }
+    }
+
+    dotmask.gen = 1;
+    dotmask.x = gs.own.x;
+    dotmask.y = gs.own.y;
+    dotmask.z = gs.own.z;
+    dotmask.bx = floor(gs.own.x);
+    dotmask.by = floor(gs.own.y);
+    dotmask.bz = floor(gs.own.z);
+    dotmask.ey = floor(gs.own.y+EYEHEIGHT);
+}
+
+// start a new mask generation, as if the player had moved - the world
+// around is air, so the occupancy cache is filled without world lookups
+static void bench_newgen() {
+    dotmask.gen++;
+    if (!dotmask.occ)
+        dotmask.occ = malloc(OCC_N*OCC_N*OCC_N);
+    memset(dotmask.occ, 0, OCC_N*OCC_N*OCC_N);
+    dotmask.occvalid = 1;
+}
+
+// the dot filter without the masks - each dot is checked for every block
+static void bench_remove_dots_perdot(blk *b) {
+    brdata *rd = BRD(b);
+    rd->dist = 0;
+
+    double px = gs.own.x;
+    double pz = gs.own.z;
+    double py = gs.own.y+EYEHEIGHT;
+
+    int f,dr,dc;
+    for(f=0; f<6; f++) {
+        if (!((b->neigh>>f)&1) && !b->needadj) continue;
+        uint16_t *dots = BDOTS(b)[f];
+
+        int32_t nx = b->x+NOFF[f][0];
+        int32_t nz = b->z+NOFF[f][1];
+        int32_t ny = b->y+NOFF[f][2];
+
+        for(dr=0; dr<15; dr++) {
+            for(dc=0; dc<15; dc++) {
+                uint16_t mask = 1<<dc;
+                if (!(dots[dr]&mask)) continue;
+
+                double x,y,z;
+                dot_coords(f, nx,ny,nz, dr,dc, &x,&y,&z);
+                double dist = sqrt(SQ(x-px)+SQ(z-pz)+SQ(y-py));
+                if (dist > MAXREACH || ray_blocked(px,py,pz, x,y,z, b->x,b->y,b->z)) {
+                    dots[dr] &= ~mask;
+                    continue;
+                }
+
+                if (rd->rdir != DIR_ANY) {
+                    double yaw,pitch;
+                    if (calculate_yaw_pitch(x, z, y, &yaw, &pitch) != rd->rdir) {
+                        dots[dr] &= ~mask;
+                        continue;
+                    }
+                }
+
+                if (rd->dist < dist) rd->dist = dist;
+            }
+        }
+    }
+
+    b->inreach = (rd->dist > 0);
+}
+
+// one pass over the buildqueue, the same way build_update and build_progress do it
+static int bench_pass(int perdot) {
+    int i, n=0;
+    for(i=0; i<C(build.task); i++) {
+        blk *b = P(build.task)+i;
+        int f;
+        for(f=0; f<6; f++)
+            memcpy(BDOTS(b)[f], DOTS_ALL, sizeof(DOTS_ALL));
+        if (perdot)
+            bench_remove_dots_perdot(b);
+        else
+            remove_distant_dots(b);
+        BRD(b)->ndots = count_dots(b);
+
+        int8_t face, cx, cy, cz;
+        if (BRD(b)->ndots>0 && choose_dot(b, &face, &cx, &cy, &cz))
+            n++;
+    }
+    return n;
+}
+
+// compare the dots and distances left by both filters
+static int bench_verify() {
+    int i, bad=0;
+    for(i=0; i<C(build.task); i++) {
+        blk *b = P(build.task)+i;
+        int f;
+        uint16_t dots[6][15];
+        for(f=0; f<6; f++)
+            memcpy(BDOTS(b)[f], DOTS_ALL, sizeof(DOTS_ALL));
+        bench_remove_dots_perdot(b);
+        double dist = BRD(b)->dist;
+        memcpy(dots, BDOTS(b), sizeof(dots));
+
+        for(f=0; f<6; f++)
+            memcpy(BDOTS(b)[f], DOTS_ALL, sizeof(DOTS_ALL));
+        remove_distant_dots(b);
+        if (memcmp(dots, BDOTS(b), sizeof(dots)) || fabs(dist-BRD(b)->dist) > 1e-9)
+            bad++;
+    }
+    return bad;
+}
+
+int main(int ac, char **av) {
+    bench_setup();
+
+    int r, n=0;
+    bench_newgen();
+    uint64_t t0 = gettimestamp();
+    for(r=0; r<BENCH_ROUNDS; r++)
+        n = bench_pass(1);
+    uint64_t t1 = gettimestamp();
+    for(r=0; r<BENCH_ROUNDS; r++) {
+        bench_newgen();
+        n = bench_pass(0);
+    }
+    uint64_t t2 = gettimestamp();
+    for(r=0; r<BENCH_ROUNDS; r++)
+        n = bench_pass(0);
+    uint64_t t3 = gettimestamp();
+
+    printf("%zd blocks, %d placeable, %d differ from the per-dot filter\n",
+           C(build.task), n, bench_verify());
+    printf("per-dot checks : %8.1f us/pass\n", (double)(t1-t0)/BENCH_ROUNDS);
+    printf("masks computed : %8.1f us/pass\n", (double)(t2-t1)/BENCH_ROUNDS);
+    printf("masks cached   : %8.1f us/pass\n", (double)(t3-t2)/BENCH_ROUNDS);
+
+    return 0;
+}
+
+#endif
@@ -24,6 +24,14 @@ typedef struct {
     int     placed;
     int     available;
     int     limit;      // current build limit, 0 if not active
+    int     adaptive;   // adaptive placement rate is active
+    float   rate;       // confirmed placements per second
+    int     window;     // allowed number of unconfirmed placements
+    int     latency;    // smoothed confirmation latency (ms)
+    float   tps;        // estimated server TPS, 0 if not known
+    int     wpnum;      // index of the next route waypoint
+    int     wpcount;    // number of route waypoints, 0 if no route is planned
+    int32_t wpx,wpy,wpz;// coordinates of the next waypoint
     lh_arr_declare(build_info_material,mat);
 } build_info;
 
@@ -32,9 +40,12 @@ void build_clear(MCPacketQueue *sq, MCPacketQueue *cq);
 void build_cancel(MCPacketQueue *sq, MCPacketQueue *cq);
 void build_pause();
 void build_update();
+void build_invalidate(MCPacket *pkt);
 void build_progress(MCPacketQueue *sq, MCPacketQueue *cq);
 int  build_packet(MCPacket *pkt, MCPacketQueue *sq, MCPacketQueue *cq);
 void build_preview_transmit(MCPacketQueue *cq);
+void build_journal_flush(int force);
+void build_swaps_settled(MCPacketQueue *cq, int failed);
 
 void build_sload(const char *name, char *reply);
 void build_dump_plan();
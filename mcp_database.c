@@ -15,11 +15,14 @@
 #include <stdio.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "lh_buffers.h"
 #include "lh_files.h"
 #include "lh_dir.h"
 
-#define TESTEXAMPLES //show test examples after loading db
+//#define TESTEXAMPLES //show test examples after loading db
 
 char *databasefilepath = "./database";
 
@@ -31,11 +34,27 @@ database_t *activedb;  //pointer to the db for the current connection's protocol
 int try_to_get_missing_json_files(int protocol_id);
 int save_db_to_file(database_t *db);
 int load_db_from_file(database_t *db, FILE* fp);
+int save_db_to_bin(database_t *db, const char *binpath, struct stat *src);
+int load_db_from_bin(database_t *db, const char *binpath, struct stat *src);
 int test_examples();
+void build_db_index(database_t *db);
+void build_db_flags(database_t *db);
+void build_db_families(database_t *db);
+void build_db_transforms(database_t *db);
+
+// incremented whenever the active database changes
+static uint32_t db_gen;
+
+// Gets the generation of the active database - handles cached by the
+// callers must be looked up again when it changes
+uint32_t db_generation() {
+    return db_gen;
+}
 
 // Loads a db for this protocol into memory
 int db_load(int protocol_id) {
     activedb = NULL;
+    db_gen++;
 
     //check if the db for this protocol is already loaded
     for (int i=0; i<C(dbs); i++) {
@@ -55,11 +74,25 @@ int db_load(int protocol_id) {
     //TODO: Protocol Specific
     assert(protocol_id == 751);
 
-    char blockjsonfilespec[PATH_MAX], itemjsonfilespec[PATH_MAX], dbfilespec[PATH_MAX];
+    char blockjsonfilespec[PATH_MAX], itemjsonfilespec[PATH_MAX], dbfilespec[PATH_MAX], binfilespec[PATH_MAX];
     sprintf(blockjsonfilespec, "%s/blocks_%d.json",databasefilepath,protocol_id);  //example "./database/blocks_404.json"
     sprintf(itemjsonfilespec, "%s/items_%d.json",databasefilepath,protocol_id);  //example: "./database/items_404.json"
     sprintf(dbfilespec, "%s/mcb_db_%d.txt",databasefilepath,protocol_id);  //example: "./database/mcb_db_404.txt"
 
+    sprintf(binfilespec, "%s/mcb_db_%d.bin",databasefilepath,protocol_id);  //example: "./database/mcb_db_404.bin"
+
+    //Fast Method: map the compiled db, if it's up to date with the db file
+    struct stat srcst;
+    int havesrc = !stat(dbfilespec, &srcst);
+    if (!load_db_from_bin(newdb, binfilespec, havesrc ? &srcst : NULL)) {
+        printf("Database successfully mapped from %s\n",binfilespec);
+        activedb = newdb;
+        #ifdef TESTEXAMPLES
+            test_examples();
+        #endif
+        return 0; //success
+    }
+
     //First Method: if the db file already exists, load it.
     FILE *dbfile = fopen(dbfilespec, "r");
     if (dbfile) {
@@ -67,6 +100,8 @@ int db_load(int protocol_id) {
         fclose(dbfile);
         if (!rc) {
             printf("Database successfully loaded from %s\n",dbfilespec);
+            build_db_index(newdb);
+            if (havesrc) save_db_to_bin(newdb, binfilespec, &srcst);
             activedb = newdb;
             #ifdef TESTEXAMPLES
                 test_examples();
@@ -229,6 +264,8 @@ int db_load(int protocol_id) {
         json_object_iter_next(&it);
     }
     save_db_to_file(newdb);
+    build_db_index(newdb);
+    if (!stat(dbfilespec, &srcst)) save_db_to_bin(newdb, binfilespec, &srcst);
     activedb = newdb;
     #ifdef TESTEXAMPLES
         test_examples();
@@ -237,119 +274,223 @@ int db_load(int protocol_id) {
     return 0; //success
 }
 
+// blocks whose item has a different name
+//TODO: if this is a blockname with a different itemname for the base material
+static const struct {
+    const char *block;
+    const char *item;
+} item_aliases[] = {
+    { "water",                       "water_bucket" },
+    { "lava",                        "lava_bucket" },
+    { "tall_seagrass",               "air" },
+    { "piston_head",                 "air" },
+    { "moving_piston",               "air" },
+    { "wall_torch",                  "torch" },
+    { "fire",                        "air" },
+    { "soul_fire",                   "air" },
+    { "redstone_wire",               "redstone" },
+    { "oak_wall_sign",               "air" },
+    { "spruce_wall_sign",            "air" },
+    { "birch_wall_sign",             "air" },
+    { "acacia_wall_sign",            "air" },
+    { "jungle_wall_sign",            "air" },
+    { "dark_oak_wall_sign",          "air" },
+    { "redstone_wall_torch",         "redstone_torch" },
+    { "soul_wall_torch",             "soul_torch" },
+    { "nether_portal",               "air" },
+    { "attached_pumpkin_stem",       "air" },
+    { "attached_melon_stem",         "air" },
+    { "pumpkin_stem",                "air" },
+    { "melon_stem",                  "air" },
+    { "end_portal",                  "air" },
+    { "cocoa",                       "air" },
+    { "tripwire",                    "air" },
+    { "potted_oak_sapling",          "air" },
+    { "potted_spruce_sapling",       "air" },
+    { "potted_birch_sapling",        "air" },
+    { "potted_jungle_sapling",       "air" },
+    { "potted_acacia_sapling",       "air" },
+    { "potted_dark_oak_sapling",     "air" },
+    { "potted_fern",                 "air" },
+    { "potted_dandelion",            "air" },
+    { "potted_poppy",                "air" },
+    { "potted_blue_orchid",          "air" },
+    { "potted_allium",               "air" },
+    { "potted_azure_bluet",          "air" },
+    { "potted_red_tulip",            "air" },
+    { "potted_orange_tulip",         "air" },
+    { "potted_white_tulip",          "air" },
+    { "potted_pink_tulip",           "air" },
+    { "potted_oxeye_daisy",          "air" },
+    { "potted_cornflower",           "air" },
+    { "potted_lily_of_the_valley",   "air" },
+    { "potted_wither_rose",          "air" },
+    { "potted_red_mushroom",         "air" },
+    { "potted_brown_mushroom",       "air" },
+    { "potted_dead_bush",            "air" },
+    { "potted_cactus",               "air" },
+    { "carrots",                     "air" },
+    { "potatoes",                    "air" },
+    { "skeleton_wall_skull",         "skeleton_skull" },
+    { "wither_skeleton_wall_skull",  "wither_skull" },
+    { "zombie_wall_head",            "zombie_head" },
+    { "player_wall_head",            "player_head" },
+    { "creeper_wall_head",           "creeper_head" },
+    { "dragon_wall_head",            "dragon_head" },
+    { "white_wall_banner",           "white_banner" },
+    { "orange_wall_banner",          "orange_banner" },
+    { "magenta_wall_banner",         "magenta_banner" },
+    { "light_blue_wall_banner",      "light_banner" },
+    { "yellow_wall_banner",          "yellow_banner" },
+    { "lime_wall_banner",            "lime_banner" },
+    { "pink_wall_banner",            "pink_banner" },
+    { "gray_wall_banner",            "gray_banner" },
+    { "light_gray_wall_banner",      "light_banner" },
+    { "cyan_wall_banner",            "cyan_banner" },
+    { "purple_wall_banner",          "purple_banner" },
+    { "blue_wall_banner",            "blue_banner" },
+    { "brown_wall_banner",           "brown_banner" },
+    { "green_wall_banner",           "green_banner" },
+    { "red_wall_banner",             "red_banner" },
+    { "black_wall_banner",           "black_banner" },
+    { "beetroots",                   "air" },
+    { "end_gateway",                 "air" },
+    { "frosted_ice",                 "ice" },
+    { "kelp_plant",                  "air" },
+    { "dead_tube_coral_wall_fan",    "air" },
+    { "dead_brain_coral_wall_fan",   "air" },
+    { "dead_bubble_coral_wall_fan",  "air" },
+    { "dead_fire_coral_wall_fan",    "air" },
+    { "dead_horn_coral_wall_fan",    "air" },
+    { "tube_coral_wall_fan",         "air" },
+    { "brain_coral_wall_fan",        "air" },
+    { "bubble_coral_wall_fan",       "air" },
+    { "fire_coral_wall_fan",         "air" },
+    { "horn_coral_wall_fan",         "air" },
+    { "bamboo_sapling",              "air" },
+    { "potted_bamboo",               "air" },
+    { "void_air",                    "air" },
+    { "cave_air",                    "air" },
+    { "bubble_column",               "air" },
+    { "sweet_berry_bush",            "sweet_berries" },
+    { "weeping_vines_plant",         "air" },
+    { "twisting_vines_plant",        "air" },
+    { "crimson_wall_sign",           "air" },
+    { "warped_wall_sign",            "air" },
+    { "potted_crimson_fungus",       "air" },
+    { "potted_warped_fungus",        "air" },
+    { "potted_crimson_roots",        "air" },
+    { "potted_warped_roots",         "air" },
+};
+
+// Private: hash function for the name lookup tables
+static uint32_t name_hash(const char *name) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for(; *name; name++)
+        h = (h^(uint8_t)*name)*16777619u;
+    return h;
+}
+
+// Private: find a name in a hash table, returns the ID or -1 if not found
+static int hash_find(dbhash_t *ht, int hsize, const char *name) {
+    if (!ht) return -1;
+    uint32_t i = name_hash(name)&(hsize-1);
+    for(; ht[i].name; i=(i+1)&(hsize-1))
+        if (!strcmp(ht[i].name, name))
+            return ht[i].id;
+    return -1;
+}
+
+// Private: add a name to a hash table, the first entry for a name wins
+static void hash_insert(dbhash_t *ht, int hsize, const char *name, int id) {
+    uint32_t i = name_hash(name)&(hsize-1);
+    for(; ht[i].name; i=(i+1)&(hsize-1))
+        if (!strcmp(ht[i].name, name))
+            return;
+    ht[i].name = name;
+    ht[i].id = id;
+}
+
+// Private: hash table size for n entries, power of 2 and at most half full
+static int hash_size(int n) {
+    int hsize = 64;
+    while (hsize < n*2) hsize <<= 1;
+    return hsize;
+}
+
+// Private: add a string to the pool of interned strings, returns its handle
+static dbstr_t str_intern(database_t *db, const char *str) {
+    int h = hash_find(db->strhash, db->strhsize, str);
+    if (h >= 0) return h;
+    assert(C(db->str) < DBSTR_NONE);
+
+    // keep the table at most half full
+    if ((C(db->str)+1)*2 > db->strhsize) {
+        free(db->strhash);
+        db->strhsize = hash_size(C(db->str)+1);
+        db->strhash = calloc(db->strhsize, sizeof(dbhash_t));
+        for (int i=0; i < C(db->str); i++)
+            hash_insert(db->strhash, db->strhsize, P(db->str)[i], i);
+    }
+
+    h = C(db->str);
+    *lh_arr_new(GAR(db->str)) = str;
+    hash_insert(db->strhash, db->strhsize, str, h);
+    return h;
+}
+
+// Private: handle of a string, DBSTR_NONE if it is not in the pool
+static inline dbstr_t str_find(database_t *db, const char *str) {
+    int h = hash_find(db->strhash, db->strhsize, str);
+    return (h < 0) ? DBSTR_NONE : h;
+}
+
+// Private: Interns the property names and values - the block states share a
+// handful of distinct strings, so the duplicates are freed and the lookups
+// can compare handles instead of strings
+static void build_db_strings(database_t *db) {
+    for (int i=0; i < C(db->block); i++) {
+        block_t *blk = &P(db->block)[i];
+        for (int j=0; j < blk->C(prop); j++) {
+            prop_t *prp = blk->P(prop)+j;
+            prp->pn = str_intern(db, prp->pname);
+            prp->pv = str_intern(db, prp->pvalue);
+
+            // strings of a compiled database are in the mapped file
+            if (db->map) continue;
+            if (P(db->str)[prp->pn] != prp->pname) {
+                free((char*)prp->pname);
+                prp->pname = P(db->str)[prp->pn];
+            }
+            if (P(db->str)[prp->pv] != prp->pvalue) {
+                free((char*)prp->pvalue);
+                prp->pvalue = P(db->str)[prp->pv];
+            }
+        }
+    }
+}
+
+// Gets the handle of an interned property name or value
+dbstr_t db_str(const char *str) {
+    assert(activedb);
+    return str_find(activedb, str);
+}
+
+// Gets the string of an interned handle
+const char *db_str_name(dbstr_t h) {
+    assert(activedb);
+    if (h >= C(activedb->str)) return NULL;
+    return P(activedb->str)[h];
+}
+
 // Gets the item id given the item name
 int db_get_item_id(const char *name) {
     assert(activedb);
-    for (int i =0; i < C(activedb->item); i++) {
-        if (!strcmp(activedb->P(item)[i].name, name)) {
-            return activedb->P(item)[i].id;
-        }
-    }
-    //TODO: if this is a blockname with a different itemname for the base material
-    if (!strcmp(name, "water")) return db_get_item_id("water_bucket");
-    if (!strcmp(name, "lava")) return db_get_item_id("lava_bucket");
-    if (!strcmp(name, "tall_seagrass")) return db_get_item_id("air");
-    if (!strcmp(name, "piston_head")) return db_get_item_id("air");
-    if (!strcmp(name, "moving_piston")) return db_get_item_id("air");
-    if (!strcmp(name, "wall_torch")) return db_get_item_id("torch");
-    if (!strcmp(name, "fire")) return db_get_item_id("air");
-    if (!strcmp(name, "soul_fire")) return db_get_item_id("air");
-    if (!strcmp(name, "redstone_wire")) return db_get_item_id("redstone");
-    if (!strcmp(name, "oak_wall_sign")) return db_get_item_id("air");
-    if (!strcmp(name, "spruce_wall_sign")) return db_get_item_id("air");
-    if (!strcmp(name, "birch_wall_sign")) return db_get_item_id("air");
-    if (!strcmp(name, "acacia_wall_sign")) return db_get_item_id("air");
-    if (!strcmp(name, "jungle_wall_sign")) return db_get_item_id("air");
-    if (!strcmp(name, "dark_oak_wall_sign")) return db_get_item_id("air");
-    if (!strcmp(name, "redstone_wall_torch")) return db_get_item_id("redstone_torch");
-    if (!strcmp(name, "soul_wall_torch")) return db_get_item_id("soul_torch");
-    if (!strcmp(name, "nether_portal")) return db_get_item_id("air");
-    if (!strcmp(name, "attached_pumpkin_stem")) return db_get_item_id("air");
-    if (!strcmp(name, "attached_melon_stem")) return db_get_item_id("air");
-    if (!strcmp(name, "pumpkin_stem")) return db_get_item_id("air");
-    if (!strcmp(name, "melon_stem")) return db_get_item_id("air");
-    if (!strcmp(name, "end_portal")) return db_get_item_id("air");
-    if (!strcmp(name, "cocoa")) return db_get_item_id("air");
-    if (!strcmp(name, "tripwire")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_oak_sapling")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_spruce_sapling")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_birch_sapling")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_jungle_sapling")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_acacia_sapling")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_dark_oak_sapling")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_fern")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_dandelion")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_poppy")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_blue_orchid")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_allium")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_azure_bluet")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_red_tulip")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_orange_tulip")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_white_tulip")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_pink_tulip")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_oxeye_daisy")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_cornflower")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_lily_of_the_valley")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_wither_rose")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_red_mushroom")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_brown_mushroom")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_dead_bush")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_cactus")) return db_get_item_id("air");
-    if (!strcmp(name, "carrots")) return db_get_item_id("air");
-    if (!strcmp(name, "potatoes")) return db_get_item_id("air");
-    if (!strcmp(name, "skeleton_wall_skull")) return db_get_item_id("skeleton_skull");
-    if (!strcmp(name, "wither_skeleton_wall_skull")) return db_get_item_id("wither_skull");
-    if (!strcmp(name, "zombie_wall_head")) return db_get_item_id("zombie_head");
-    if (!strcmp(name, "player_wall_head")) return db_get_item_id("player_head");
-    if (!strcmp(name, "creeper_wall_head")) return db_get_item_id("creeper_head");
-    if (!strcmp(name, "dragon_wall_head")) return db_get_item_id("dragon_head");
-    if (!strcmp(name, "white_wall_banner")) return db_get_item_id("white_banner");
-    if (!strcmp(name, "orange_wall_banner")) return db_get_item_id("orange_banner");
-    if (!strcmp(name, "magenta_wall_banner")) return db_get_item_id("magenta_banner");
-    if (!strcmp(name, "light_blue_wall_banner")) return db_get_item_id("light_banner");
-    if (!strcmp(name, "yellow_wall_banner")) return db_get_item_id("yellow_banner");
-    if (!strcmp(name, "lime_wall_banner")) return db_get_item_id("lime_banner");
-    if (!strcmp(name, "pink_wall_banner")) return db_get_item_id("pink_banner");
-    if (!strcmp(name, "gray_wall_banner")) return db_get_item_id("gray_banner");
-    if (!strcmp(name, "light_gray_wall_banner")) return db_get_item_id("light_banner");
-    if (!strcmp(name, "cyan_wall_banner")) return db_get_item_id("cyan_banner");
-    if (!strcmp(name, "purple_wall_banner")) return db_get_item_id("purple_banner");
-    if (!strcmp(name, "blue_wall_banner")) return db_get_item_id("blue_banner");
-    if (!strcmp(name, "brown_wall_banner")) return db_get_item_id("brown_banner");
-    if (!strcmp(name, "green_wall_banner")) return db_get_item_id("green_banner");
-    if (!strcmp(name, "red_wall_banner")) return db_get_item_id("red_banner");
-    if (!strcmp(name, "black_wall_banner")) return db_get_item_id("black_banner");
-    if (!strcmp(name, "beetroots")) return db_get_item_id("air");
-    if (!strcmp(name, "end_gateway")) return db_get_item_id("air");
-    if (!strcmp(name, "frosted_ice")) return db_get_item_id("ice");
-    if (!strcmp(name, "kelp_plant")) return db_get_item_id("air");
-    if (!strcmp(name, "dead_tube_coral_wall_fan")) return db_get_item_id("air");
-    if (!strcmp(name, "dead_brain_coral_wall_fan")) return db_get_item_id("air");
-    if (!strcmp(name, "dead_bubble_coral_wall_fan")) return db_get_item_id("air");
-    if (!strcmp(name, "dead_fire_coral_wall_fan")) return db_get_item_id("air");
-    if (!strcmp(name, "dead_horn_coral_wall_fan")) return db_get_item_id("air");
-    if (!strcmp(name, "tube_coral_wall_fan")) return db_get_item_id("air");
-    if (!strcmp(name, "brain_coral_wall_fan")) return db_get_item_id("air");
-    if (!strcmp(name, "bubble_coral_wall_fan")) return db_get_item_id("air");
-    if (!strcmp(name, "fire_coral_wall_fan")) return db_get_item_id("air");
-    if (!strcmp(name, "horn_coral_wall_fan")) return db_get_item_id("air");
-    if (!strcmp(name, "bamboo_sapling")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_bamboo")) return db_get_item_id("air");
-    if (!strcmp(name, "void_air")) return db_get_item_id("air");
-    if (!strcmp(name, "cave_air")) return db_get_item_id("air");
-    if (!strcmp(name, "bubble_column")) return db_get_item_id("air");
-    if (!strcmp(name, "sweet_berry_bush")) return db_get_item_id("sweet_berries");
-    if (!strcmp(name, "weeping_vines_plant")) return db_get_item_id("air");
-    if (!strcmp(name, "twisting_vines_plant")) return db_get_item_id("air");
-    if (!strcmp(name, "crimson_wall_sign")) return db_get_item_id("air");
-    if (!strcmp(name, "warped_wall_sign")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_crimson_fungus")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_warped_fungus")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_crimson_roots")) return db_get_item_id("air");
-    if (!strcmp(name, "potted_warped_roots")) return db_get_item_id("air");
+    int id = hash_find(activedb->itemhash, activedb->itemhsize, name);
+    if (id >= 0) return id;
 
     printf("##### WARNING ##### Cannot convert block to item: %s\n",name);
-    return db_get_item_id("air");
+    return hash_find(activedb->itemhash, activedb->itemhsize, "air");
     //return -1;
 };
 
@@ -359,31 +500,103 @@ const char *db_get_item_name(int item_id) {
     if (item_id == -1) {
         return "Empty";
     }
-    for (int i=0; i < C(activedb->item); i++) {
-        if (item_id == activedb->P(item)[i].id) {
-            return activedb->P(item)[i].name;
-        }
-    }
+    if (item_id >= 0 && item_id < activedb->nitemnames && activedb->itemname[item_id])
+        return activedb->itemname[item_id];
     return "ID not found";
 };
 
 // Gets the corresponding item ID from a block ID
 const int db_get_item_id_from_blk_id(blid_t id) {
-    //TODO:handle blocks whose item name is different
-    int item_id = db_get_item_id(db_get_blk_name(id));
-    return item_id;
+    if (id > activedb->maxblid || !activedb->blkrec[id])
+        return db_get_item_id(db_get_blk_name(id));
+    return activedb->blkitem[id];
 }
 
+// Private: Builds the lookup tables - name hashes and tables indexed by block state ID
+void build_db_index(database_t *db) {
+    int i;
+
+    build_db_strings(db);
+
+    // item name -> item ID, including the aliases for the block names
+    int nalias = sizeof(item_aliases)/sizeof(item_aliases[0]);
+    db->itemhsize = hash_size(C(db->item)+nalias);
+    db->itemhash = calloc(db->itemhsize, sizeof(dbhash_t));
+    db->nitemnames = 0;
+    for (i=0; i < C(db->item); i++) {
+        hash_insert(db->itemhash, db->itemhsize, P(db->item)[i].name, P(db->item)[i].id);
+        if (P(db->item)[i].id >= db->nitemnames)
+            db->nitemnames = P(db->item)[i].id+1;
+    }
+    for (i=0; i < nalias; i++) {
+        int id = hash_find(db->itemhash, db->itemhsize, item_aliases[i].item);
+        if (id >= 0)
+            hash_insert(db->itemhash, db->itemhsize, item_aliases[i].block, id);
+    }
+
+    // item ID -> item name
+    db->itemname = calloc(db->nitemnames, sizeof(*db->itemname));
+    for (i=0; i < C(db->item); i++)
+        if (P(db->item)[i].id >= 0)
+            db->itemname[P(db->item)[i].id] = P(db->item)[i].name;
+
+    // block name -> default ID
+    db->blkhsize = hash_size(C(db->block));
+    db->blkhash = calloc(db->blkhsize, sizeof(dbhash_t));
+    for (i=0; i < C(db->block); i++)
+        hash_insert(db->blkhash, db->blkhsize, P(db->block)[i].name, P(db->block)[i].defaultid);
+
+    db->maxblid = -1;
+    for (i=0; i < C(db->block); i++)
+        if (P(db->block)[i].id > db->maxblid)
+            db->maxblid = P(db->block)[i].id;
+
+    int n = db->maxblid+1;
+    db->blkrec    = calloc(n, sizeof(*db->blkrec));
+    for (i=0; i < C(db->block); i++)
+        db->blkrec[P(db->block)[i].id] = &P(db->block)[i];
+
+    // the ID tables of a compiled database are mapped from the file
+    if (db->map) {
+        build_db_families(db);
+        return;
+    }
+
+    db->blkfirst  = calloc(n, sizeof(*db->blkfirst));
+    db->blkstates = calloc(n, sizeof(*db->blkstates));
+    db->blkitem   = calloc(n, sizeof(*db->blkitem));
+
+    // states of a block are stored consecutively and share a default ID
+    int air = hash_find(db->itemhash, db->itemhsize, "air");
+    for (i=0; i < C(db->block); i++) {
+        block_t *blk = &P(db->block)[i];
+        int j=i;
+        blid_t first = blk->id;
+        while (j < C(db->block) && P(db->block)[j].defaultid == blk->defaultid) {
+            if (P(db->block)[j].id < first) first = P(db->block)[j].id;
+            j++;
+        }
+
+        // blocks without an item are mapped to air
+        int item = hash_find(db->itemhash, db->itemhsize, blk->name);
+        if (item < 0) item = air;
+
+        for (int k=i; k<j; k++) {
+            db->blkfirst[P(db->block)[k].id]  = first;
+            db->blkstates[P(db->block)[k].id] = j-i;
+            db->blkitem[P(db->block)[k].id]   = item;
+        }
+        i = j-1;
+    }
 
+    build_db_flags(db);
+    build_db_families(db);
+}
 
 // Private:  Gets the database record for a block given its block_id
 block_t *db_blk_record_from_id(blid_t block_id) {
-    for (int i=0; i < C(activedb->block); i++) {
-        if (block_id == P(activedb->block)[i].id) {
-            return &P(activedb->block)[i];
-        }
-    }
-    return NULL;
+    if (block_id > activedb->maxblid) return NULL;
+    return activedb->blkrec[block_id];
 }
 
 // Gets the block name given the block id
@@ -414,12 +627,8 @@ const char *db_get_blk_name_from_old_id(blid_t oldid) {
 //  db_get_blk_id("nether_brick_stairs") => 4540 // north,bottom,straight,false marked as default
 blid_t db_get_blk_id(const char *name) {
     assert (activedb);
-    for (int i =0; i < C(activedb->block); i++) {
-        if (!strcmp(activedb->P(block)[i].name, name)) {
-            return activedb->P(block)[i].defaultid;
-        }
-    }
-    return UINT16_MAX;
+    int id = hash_find(activedb->blkhash, activedb->blkhsize, name);
+    return (id >= 0) ? id : UINT16_MAX;
 }
 
 // input is another block id, returning that block id's default id
@@ -435,15 +644,8 @@ blid_t db_get_blk_default_id(blid_t id) {
 //  db_get_num_states(8) => 2 // grass_block
 int db_get_num_states(blid_t block_id) {
     assert (activedb);
-    int count = 0;
-    //we could use defaultid or blockname since they are 1-1 correspondence
-    int defid = db_get_blk_default_id(block_id);
-    for (int i=0; i < C(activedb->block); i++) {
-        if (P(activedb->block)[i].defaultid == defid) {
-            count++;
-        }
-    }
-    return count;
+    if (block_id > activedb->maxblid || !activedb->blkrec[block_id]) return 0;
+    return activedb->blkstates[block_id];
 }
 
 // Dumps blocks array to stdout
@@ -609,9 +811,228 @@ int load_db_from_file(database_t *db, FILE* fp) {
     return 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Compiled database
+//
+// Binary image of a loaded database - interned strings, records and the
+// ID tables - mapped read-only on the next start. It is recompiled when
+// the text database it was made from changes or the format/item tables
+// of the program differ.
+
+#define DBBIN_MAGIC     0x4244434d  // "MCDB"
+#define DBBIN_VERSION   2
+
+static uint64_t db_tables_hash();
+
+typedef struct {
+    uint32_t magic, version;
+    int32_t  protocol;
+    int32_t  numitems;          // db_num_items of the program that wrote it
+    int64_t  srcsize, srcmtime; // text database it was compiled from
+    uint64_t tabhash;           // db_tables_hash of the program that wrote it
+    uint32_t nitems, nblocks, nprops, maxblid;
+    uint32_t off_items, off_blocks, off_props, off_strings;
+    uint32_t off_first, off_states, off_item, off_flags, off_fam, off_xform;
+    uint32_t size;
+} dbbin_hdr;
+
+typedef struct { uint32_t name; int32_t id; } dbbin_item;
+typedef struct { uint32_t name, prop; uint16_t id, oldid, defaultid, nprops; } dbbin_block;
+typedef struct { uint32_t pname, pvalue; } dbbin_prop;
+
+// Private: string pool for the compiled database
+typedef struct {
+    char *data;
+    uint32_t len, alloc;
+    dbhash_t *ht;
+    int hsize;
+} dbbin_pool;
+
+// Private: add a string to the pool, returns its offset
+static uint32_t pool_add(dbbin_pool *sp, const char *str) {
+    int off = hash_find(sp->ht, sp->hsize, str);
+    if (off >= 0) return off;
+
+    uint32_t len = strlen(str)+1;
+    if (sp->len+len > sp->alloc) {
+        sp->alloc = (sp->len+len)*2;
+        sp->data = realloc(sp->data, sp->alloc);
+    }
+    memmove(sp->data+sp->len, str, len);
+    off = sp->len;
+    sp->len += len;
+
+    // the hash keeps pointers to the original strings, they outlive the pool
+    hash_insert(sp->ht, sp->hsize, str, off);
+    return off;
+}
+
+#define DBBIN_ALIGN(x) (((x)+7)&~7)
+
+// Private: Saves the compiled database
+int save_db_to_bin(database_t *db, const char *binpath, struct stat *src) {
+    int i,j;
+    uint32_t nprops = 0;
+    for (i=0; i < C(db->block); i++)
+        nprops += P(db->block)[i].C(prop);
+    uint32_t n = db->maxblid+1;
+
+    dbbin_pool sp;
+    memset(&sp, 0, sizeof(sp));
+    sp.hsize = hash_size(C(db->item)+C(db->block)+nprops*2);
+    sp.ht = calloc(sp.hsize, sizeof(dbhash_t));
+
+    dbbin_item *items = calloc(C(db->item), sizeof(dbbin_item));
+    for (i=0; i < C(db->item); i++) {
+        items[i].name = pool_add(&sp, P(db->item)[i].name);
+        items[i].id   = P(db->item)[i].id;
+    }
+
+    dbbin_block *blocks = calloc(C(db->block), sizeof(dbbin_block));
+    dbbin_prop *props = calloc(nprops ? nprops : 1, sizeof(dbbin_prop));
+    uint32_t pi = 0;
+    for (i=0; i < C(db->block); i++) {
+        block_t *blk = &P(db->block)[i];
+        blocks[i].name      = pool_add(&sp, blk->name);
+        blocks[i].prop      = pi;
+        blocks[i].id        = blk->id;
+        blocks[i].oldid     = blk->oldid;
+        blocks[i].defaultid = blk->defaultid;
+        blocks[i].nprops    = blk->C(prop);
+        for (j=0; j < blk->C(prop); j++, pi++) {
+            props[pi].pname  = pool_add(&sp, blk->P(prop)[j].pname);
+            props[pi].pvalue = pool_add(&sp, blk->P(prop)[j].pvalue);
+        }
+    }
+
+    // layout of the file
+    dbbin_hdr h;
+    memset(&h, 0, sizeof(h));
+    h.magic    = DBBIN_MAGIC;
+    h.version  = DBBIN_VERSION;
+    h.protocol = db->protocol;
+    h.numitems = db_num_items;
+    h.tabhash  = db_tables_hash();
+    h.srcsize  = src->st_size;
+    h.srcmtime = src->st_mtime;
+    h.nitems   = C(db->item);
+    h.nblocks  = C(db->block);
+    h.nprops   = nprops;
+    h.maxblid  = db->maxblid;
+
+    uint32_t off = DBBIN_ALIGN(sizeof(h));
+    h.off_items   = off; off = DBBIN_ALIGN(off + h.nitems*sizeof(dbbin_item));
+    h.off_blocks  = off; off = DBBIN_ALIGN(off + h.nblocks*sizeof(dbbin_block));
+    h.off_props   = off; off = DBBIN_ALIGN(off + nprops*sizeof(dbbin_prop));
+    h.off_first   = off; off = DBBIN_ALIGN(off + n*sizeof(*db->blkfirst));
+    h.off_states  = off; off = DBBIN_ALIGN(off + n*sizeof(*db->blkstates));
+    h.off_item    = off; off = DBBIN_ALIGN(off + n*sizeof(*db->blkitem));
+    h.off_flags   = off; off = DBBIN_ALIGN(off + n*sizeof(*db->blkflags));
+    h.off_fam     = off; off = DBBIN_ALIGN(off + n*sizeof(*db->blkfam));
+    h.off_xform   = off; off = DBBIN_ALIGN(off + n*sizeof(*db->blkxform));
+    h.off_strings = off; off = off + sp.len;
+    h.size = off;
+
+    uint8_t *buf = calloc(1, h.size);
+    memmove(buf, &h, sizeof(h));
+    memmove(buf+h.off_items,   items,         h.nitems*sizeof(dbbin_item));
+    memmove(buf+h.off_blocks,  blocks,        h.nblocks*sizeof(dbbin_block));
+    memmove(buf+h.off_props,   props,         nprops*sizeof(dbbin_prop));
+    memmove(buf+h.off_first,   db->blkfirst,  n*sizeof(*db->blkfirst));
+    memmove(buf+h.off_states,  db->blkstates, n*sizeof(*db->blkstates));
+    memmove(buf+h.off_item,    db->blkitem,   n*sizeof(*db->blkitem));
+    memmove(buf+h.off_flags,   db->blkflags,  n*sizeof(*db->blkflags));
+    memmove(buf+h.off_fam,     db->blkfam,    n*sizeof(*db->blkfam));
+    memmove(buf+h.off_xform,   db->blkxform,  n*sizeof(*db->blkxform));
+    memmove(buf+h.off_strings, sp.data,       sp.len);
+
+    free(items);
+    free(blocks);
+    free(props);
+    free(sp.data);
+    free(sp.ht);
+
+    // write to a temporary file first, so a concurrent start never maps a partial file
+    char tmppath[PATH_MAX];
+    sprintf(tmppath, "%s.tmp", binpath);
+    ssize_t wlen = lh_save(tmppath, buf, h.size);
+    free(buf);
+    if (wlen != h.size || rename(tmppath, binpath)) {
+        unlink(tmppath);
+        printf("Failed to write the compiled database %s\n", binpath);
+        return -1;
+    }
+    return 0;
+}
+
+// Private: Maps a compiled database, fails if it's missing or out of date
+// src is the text database it should be compiled from, NULL if there is none
+int load_db_from_bin(database_t *db, const char *binpath, struct stat *src) {
+    int fd = open(binpath, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < sizeof(dbbin_hdr)) {
+        close(fd);
+        return -1;
+    }
+
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    dbbin_hdr *h = (dbbin_hdr *)map;
+    if (h->magic != DBBIN_MAGIC || h->version != DBBIN_VERSION ||
+        h->numitems != db_num_items || h->tabhash != db_tables_hash() ||
+        h->size != st.st_size ||
+        (src && (h->srcsize != src->st_size || h->srcmtime != src->st_mtime))) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    const char *strings = (const char *)map+h->off_strings;
+    dbbin_item  *items  = (dbbin_item  *)(map+h->off_items);
+    dbbin_block *blocks = (dbbin_block *)(map+h->off_blocks);
+    dbbin_prop  *props  = (dbbin_prop  *)(map+h->off_props);
+
+    db->protocol = h->protocol;
+    db->map = map;
+    db->mapsize = st.st_size;
+
+    for (int i=0; i < h->nitems; i++) {
+        item_t *itm = lh_arr_new_c(GAR(db->item));
+        itm->name = strings+items[i].name;
+        itm->id   = items[i].id;
+    }
+
+    for (int i=0; i < h->nblocks; i++) {
+        block_t *blk = lh_arr_new_c(GAR(db->block));
+        blk->name      = strings+blocks[i].name;
+        blk->id        = blocks[i].id;
+        blk->oldid     = blocks[i].oldid;
+        blk->defaultid = blocks[i].defaultid;
+        for (int j=0; j < blocks[i].nprops; j++) {
+            prop_t *prp = lh_arr_new_c(GAR(blk->prop));
+            prp->pname  = strings+props[blocks[i].prop+j].pname;
+            prp->pvalue = strings+props[blocks[i].prop+j].pvalue;
+        }
+    }
+
+    db->blkfirst  = (blid_t *)  (map+h->off_first);
+    db->blkstates = (uint16_t *)(map+h->off_states);
+    db->blkitem   = (int *)     (map+h->off_item);
+    db->blkflags  = (uint32_t *)(map+h->off_flags);
+    db->blkfam    = (uint16_t *)(map+h->off_fam);
+    db->blkxform  = (void *)    (map+h->off_xform);
+
+    build_db_index(db);
+    return 0;
+}
+
 // Unloads all databases from memory
 void db_unload() {
     activedb = NULL;
+    db_gen++;
     int dbcount = C(dbs);
     printf("Database array contains %d array(s).\n",dbcount);
     //process each database
@@ -620,8 +1041,10 @@ void db_unload() {
         database_t db = P(dbs)[i];
         int itemcount = db.C(item);
         int blockcount = db.C(block);
+        //strings of a compiled database are in the mapped file
+        int mapped = (db.map != NULL);
         //loop through each item freeing its name
-        for (int j=0; j< itemcount; j++) {
+        for (int j=0; j< itemcount && !mapped; j++) {
             free((char*)db.P(item)[j].name);
         }
         //loop through each block
@@ -629,19 +1052,40 @@ void db_unload() {
             assert (k < blockcount);
             //give this block a convenient name
             block_t blk = db.P(block)[k];
-            //loop its properties to free propname/val
-            for (int l=0; l<blk.C(prop); l++) {
-                free((char*)blk.P(prop)[l].pname);
-                free((char*)blk.P(prop)[l].pvalue);
-            }
-            //free this blocks prop array
+            //free this blocks prop array, its strings are in the pool
             lh_arr_free(GAR(blk.prop));
             //free this blocks name string
-            free((char*)blk.name);
+            if (!mapped) free((char*)blk.name);
         }
         //now all blocks and items are cleared, so free the arrays
         lh_arr_free(GAR(db.item));
         lh_arr_free(GAR(db.block));
+        free(db.blkrec);
+        free(db.itemhash);
+        free(db.itemname);
+        free(db.blkhash);
+        //free the interned property names and values
+        for (int j=0; j < db.C(str) && !mapped; j++)
+            free((char*)db.P(str)[j]);
+        lh_arr_free(GAR(db.str));
+        free(db.strhash);
+        for (int f=0; f < db.C(fam); f++) {
+            for (int j=0; j < db.P(fam)[f].nprops; j++)
+                free(db.P(fam)[f].props[j].vals);
+            free(db.P(fam)[f].props);
+        }
+        lh_arr_free(GAR(db.fam));
+        if (mapped) {
+            munmap(db.map, db.mapsize);
+        }
+        else {
+            free(db.blkfirst);
+            free(db.blkstates);
+            free(db.blkitem);
+            free(db.blkflags);
+            free(db.blkfam);
+            free(db.blkxform);
+        }
     }
     lh_arr_free(GAR(dbs));
     return;
@@ -652,212 +1096,458 @@ void db_unload() {
 //  db_get_blk_propval(db,1650,"facing") => "north"
 //  db_get_blk_propval(db,1686,"half") => "bottom"
 const char *db_get_blk_propval(blid_t block_id, const char *propname) {
+    assert (activedb);
+    dbstr_t pv = db_get_blk_propval_h(block_id, str_find(activedb, propname));
+    return (pv == DBSTR_NONE) ? NULL : P(activedb->str)[pv];
+}
+
+// Handle variant of db_get_blk_propval, returns DBSTR_NONE if there is no such property
+dbstr_t db_get_blk_propval_h(blid_t block_id, dbstr_t pname) {
     assert (activedb);
     block_t *blk = db_blk_record_from_id(block_id);
-    if (blk) {
+    if (blk && pname != DBSTR_NONE) {
         for (int j=0; j < blk->C(prop); j++) {
-            if (!strcmp(blk->P(prop)[j].pname, propname)) {
-                return blk->P(prop)[j].pvalue;
+            if (blk->P(prop)[j].pn == pname) {
+                return blk->P(prop)[j].pv;
             }
         }
     }
-    return NULL;
+    return DBSTR_NONE;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-// block types we should exclude from scanning
-int db_blk_is_noscan(blid_t blk_id) {
-    const char *blk_name = db_get_blk_name(blk_id);
-    if (!strcmp(blk_name, "air")) return 1;
-    if (!strcmp(blk_name, "water")) return 1;
-    if (!strcmp(blk_name, "lava")) return 1;
-    if (!strcmp(blk_name, "grass")) return 1;
-    if (!strcmp(blk_name, "seagrass")) return 1;
-    if (!strcmp(blk_name, "tall_seagrass")) return 1;
-    if (!strcmp(blk_name, "fire")) return 1;
-    if (!strcmp(blk_name, "snow")) return 1;
-    if (!strcmp(blk_name, "nether_portal")) return 1;
-    if (!strcmp(blk_name, "end_portal")) return 1;
-    if (!strcmp(blk_name, "carrots")) return 1;
-    if (!strcmp(blk_name, "potatoes")) return 1;
-    if (!strcmp(blk_name, "beetroots")) return 1;
-    if (!strcmp(blk_name, "soul_fire")) return 1;
-    if (!strcmp(blk_name, "void_air")) return 1;
-    if (!strcmp(blk_name, "cave_air")) return 1;
-    if (!strcmp(blk_name, "bubble_column")) return 1;
-    if (!strcmp(blk_name, "piston_head")) return 1;
-    if (!strcmp(blk_name, "tripwire")) return 1;
-    if (!strcmp(blk_name, "end_gateway")) return 1;
-    if (!strcmp(blk_name, "tall_grass")) return 1;
+// Private: true if the name is in a NULL-terminated list
+static int name_in_list(const char *blk_name, const char **list) {
+    for (; *list; list++)
+        if (!strcmp(blk_name, *list)) return 1;
     return 0;
 }
 
+// block types we should exclude from scanning
+static const char *noscan_names[] = {
+    "air",
+    "water",
+    "lava",
+    "grass",
+    "seagrass",
+    "tall_seagrass",
+    "fire",
+    "snow",
+    "nether_portal",
+    "end_portal",
+    "carrots",
+    "potatoes",
+    "beetroots",
+    "soul_fire",
+    "void_air",
+    "cave_air",
+    "bubble_column",
+    "piston_head",
+    "tripwire",
+    "end_gateway",
+    "tall_grass",
+    NULL
+};
+
+static int name_is_noscan(const char *blk_name) {
+    return name_in_list(blk_name, noscan_names);
+}
+
 // block types that are considered 'empty' for the block placement
-int db_blk_is_empty(blid_t blk_id) {
-    const char *blk_name = db_get_blk_name(blk_id);
-    if (!strcmp(blk_name, "air")) return 1;
-    if (!strcmp(blk_name, "water")) return 1;
-    if (!strcmp(blk_name, "lava")) return 1;
-    if (!strcmp(blk_name, "grass")) return 1;
-    if (!strcmp(blk_name, "seagrass")) return 1;
-    if (!strcmp(blk_name, "tall_seagrass")) return 1;
-    if (!strcmp(blk_name, "fire")) return 1;
-    if (!strcmp(blk_name, "snow")) return 1;
-    if (!strcmp(blk_name, "soul_fire")) return 1;
-    if (!strcmp(blk_name, "void_air")) return 1;
-    if (!strcmp(blk_name, "cave_air")) return 1;
-    if (!strcmp(blk_name, "bubble_column")) return 1;
-    if (!strcmp(blk_name, "tall_grass")) return 1;
-    return 0;
+static const char *empty_names[] = {
+    "air",
+    "water",
+    "lava",
+    "grass",
+    "seagrass",
+    "tall_seagrass",
+    "fire",
+    "snow",
+    "soul_fire",
+    "void_air",
+    "cave_air",
+    "bubble_column",
+    "tall_grass",
+    NULL
+};
+
+static int name_is_empty(const char *blk_name) {
+    return name_in_list(blk_name, empty_names);
 }
 
 // blocks that are onwall -- cannot use item flags -- the block & item names dont match
-int db_blk_is_onwall(blid_t blk_id) {
-    const char *blk_name = db_get_blk_name(blk_id);
-    if (!strcmp(blk_name, "wall_torch")) return 1;
-    if (!strcmp(blk_name, "wall_sign")) return 1;
-    if (!strcmp(blk_name, "redstone_wall_torch")) return 1;
-    if (!strcmp(blk_name, "skeleton_wall_skull")) return 1;
-    if (!strcmp(blk_name, "wither_skeleton_wall_skull")) return 1;
-    if (!strcmp(blk_name, "zombie_wall_head")) return 1;
-    if (!strcmp(blk_name, "player_wall_head")) return 1;
-    if (!strcmp(blk_name, "creeper_wall_head")) return 1;
-    if (!strcmp(blk_name, "dragon_wall_head")) return 1;
-    if (!strcmp(blk_name, "white_wall_banner")) return 1;
-    if (!strcmp(blk_name, "orange_wall_banner")) return 1;
-    if (!strcmp(blk_name, "magenta_wall_banner")) return 1;
-    if (!strcmp(blk_name, "light_blue_wall_banner")) return 1;
-    if (!strcmp(blk_name, "yellow_wall_banner")) return 1;
-    if (!strcmp(blk_name, "lime_wall_banner")) return 1;
-    if (!strcmp(blk_name, "pink_wall_banner")) return 1;
-    if (!strcmp(blk_name, "gray_wall_banner")) return 1;
-    if (!strcmp(blk_name, "light_gray_wall_banner")) return 1;
-    if (!strcmp(blk_name, "cyan_wall_banner")) return 1;
-    if (!strcmp(blk_name, "purple_wall_banner")) return 1;
-    if (!strcmp(blk_name, "blue_wall_banner")) return 1;
-    if (!strcmp(blk_name, "brown_wall_banner")) return 1;
-    if (!strcmp(blk_name, "green_wall_banner")) return 1;
-    if (!strcmp(blk_name, "red_wall_banner")) return 1;
-    if (!strcmp(blk_name, "black_wall_banner")) return 1;
-    if (!strcmp(blk_name, "dead_tube_coral_wall_fan")) return 1;
-    if (!strcmp(blk_name, "dead_brain_coral_wall_fan")) return 1;
-    if (!strcmp(blk_name, "dead_bubble_coral_wall_fan")) return 1;
-    if (!strcmp(blk_name, "dead_fire_coral_wall_fan")) return 1;
-    if (!strcmp(blk_name, "dead_horn_coral_wall_fan")) return 1;
-    if (!strcmp(blk_name, "tube_coral_wall_fan")) return 1;
-    if (!strcmp(blk_name, "brain_coral_wall_fan")) return 1;
-    if (!strcmp(blk_name, "bubble_coral_wall_fan")) return 1;
-    if (!strcmp(blk_name, "fire_coral_wall_fan")) return 1;
-    if (!strcmp(blk_name, "horn_coral_wall_fan")) return 1;
-    return 0;
+static const char *onwall_names[] = {
+    "wall_torch",
+    "wall_sign",
+    "redstone_wall_torch",
+    "skeleton_wall_skull",
+    "wither_skeleton_wall_skull",
+    "zombie_wall_head",
+    "player_wall_head",
+    "creeper_wall_head",
+    "dragon_wall_head",
+    "white_wall_banner",
+    "orange_wall_banner",
+    "magenta_wall_banner",
+    "light_blue_wall_banner",
+    "yellow_wall_banner",
+    "lime_wall_banner",
+    "pink_wall_banner",
+    "gray_wall_banner",
+    "light_gray_wall_banner",
+    "cyan_wall_banner",
+    "purple_wall_banner",
+    "blue_wall_banner",
+    "brown_wall_banner",
+    "green_wall_banner",
+    "red_wall_banner",
+    "black_wall_banner",
+    "dead_tube_coral_wall_fan",
+    "dead_brain_coral_wall_fan",
+    "dead_bubble_coral_wall_fan",
+    "dead_fire_coral_wall_fan",
+    "dead_horn_coral_wall_fan",
+    "tube_coral_wall_fan",
+    "brain_coral_wall_fan",
+    "bubble_coral_wall_fan",
+    "fire_coral_wall_fan",
+    "horn_coral_wall_fan",
+    NULL
+};
+
+static int name_is_onwall(const char *blk_name) {
+    return name_in_list(blk_name, onwall_names);
 }
 
-// Gets the block_id that matches another block_id, except for changing one property to a different value
-blid_t db_blk_property_change(blid_t blk_id, const char* prop_name, const char* new_prop_value) {
-    block_t *originalblk = db_blk_record_from_id(blk_id);
-    int propertycount = originalblk->C(prop);
+// flags of a block state, 0 for unknown IDs
+uint32_t db_blk_flags(blid_t blk_id) {
+    assert(activedb);
+    if (blk_id > activedb->maxblid) return 0;
+    return activedb->blkflags[blk_id];
+}
+
+int db_blk_is_noscan(blid_t blk_id) { return (db_blk_flags(blk_id) & BF_NOSCAN) != 0; }
+int db_blk_is_empty(blid_t blk_id)  { return (db_blk_flags(blk_id) & BF_EMPTY)  != 0; }
+int db_blk_is_onwall(blid_t blk_id) { return (db_blk_flags(blk_id) & BF_ONWALL) != 0; }
+int db_blk_is_slab(blid_t blk_id)   { return (db_blk_flags(blk_id) & BF_SLAB)   != 0; }
+
+////////////////////////////////////////////////////////////////////////////////
+// Block families and state transitions
+
+// Private: index of a property in the family, -1 if not found
+static int fam_prop(dbfam_t *f, dbstr_t pname) {
+    for (int j=0; j < f->nprops; j++)
+        if (f->props[j].pname == pname)
+            return j;
+    return -1;
+}
 
-    // loop through every block in the database to find a match
-    for (int i=0; i < activedb->C(block); i++) {
-        block_t newblk = activedb->P(block)[i];
-        if (!strcmp( newblk.name, originalblk->name) ) {
-            //found a block with the same block name - loop all properties for a match
-            int matchcount = 0;
-            for (int j=0; j < propertycount; j++) {
-                // if this is the property that should change and its value matches new_prop_value
-                if (!strcmp(newblk.P(prop)[j].pname, prop_name)) {
-                    if (!strcmp(newblk.P(prop)[j].pvalue, new_prop_value)) matchcount++;
+// Private: index of a value in the property, -1 if not found
+static int prop_val(dbprop_t *p, dbstr_t pvalue) {
+    for (int v=0; v < p->nvals; v++)
+        if (p->vals[v] == pvalue)
+            return v;
+    return -1;
+}
+
+// Private: index of the property value in a block state
+static inline int state_val(dbfam_t *f, int j, blid_t id) {
+    return ((id - f->first) / f->props[j].stride) % f->props[j].nvals;
+}
+
+// Private: Groups the block states into families and determines the property strides
+// State IDs of a block are normally first + sum(value index * stride) with the
+// strides following from the property order - families where this does not
+// hold are marked as not strided and use the slower lookups
+void build_db_families(database_t *db) {
+    int n = db->maxblid+1;
+    if (!db->map)
+        db->blkfam = calloc(n, sizeof(*db->blkfam));
+
+    for (int id=0; id < n; id++) {
+        block_t *blk = db->blkrec[id];
+        if (!blk || db->blkfirst[id] != id) continue;
+
+        dbfam_t *f = lh_arr_new_c(GAR(db->fam));
+        f->first = id;
+        f->nstates = db->blkstates[id];
+        f->nprops = blk->C(prop);
+        f->props = calloc(f->nprops, sizeof(dbprop_t));
+
+        // collect the property values in the order of the state IDs
+        for (int j=0; j < f->nprops; j++) {
+            dbprop_t *p = f->props+j;
+            p->pname = blk->P(prop)[j].pn;
+            p->vals = calloc(f->nstates, sizeof(*p->vals));
+            for (int k=id; k < id+f->nstates; k++) {
+                block_t *sb = db->blkrec[k];
+                if (!sb || sb->C(prop) != f->nprops) continue;
+                if (prop_val(p, sb->P(prop)[j].pv) < 0)
+                    p->vals[p->nvals++] = sb->P(prop)[j].pv;
+            }
+        }
+
+        // the last property changes fastest
+        int stride = 1;
+        for (int j=f->nprops-1; j >= 0; j--) {
+            f->props[j].stride = stride;
+            stride *= f->props[j].nvals;
+        }
+
+        // verify the strides
+        f->strided = (stride == f->nstates);
+        for (int k=id; k < id+f->nstates && f->strided; k++) {
+            block_t *sb = db->blkrec[k];
+            if (!sb || sb->C(prop) != f->nprops) { f->strided = 0; break; }
+            for (int j=0; j < f->nprops; j++) {
+                if (sb->P(prop)[j].pn != f->props[j].pname ||
+                    sb->P(prop)[j].pv != f->props[j].vals[state_val(f, j, k)]) {
+                    f->strided = 0;
+                    break;
                 }
-                // this is one of the properties that should remain the same as the original block
-                else if (!strcmp(newblk.P(prop)[j].pvalue, originalblk->P(prop)[j].pvalue)) matchcount++;
             }
-            if ( matchcount == propertycount ) return newblk.id;
         }
+
+        if (db->map) continue;
+        for (int k=id; k < id+f->nstates; k++)
+            db->blkfam[k] = C(db->fam)-1;
     }
-    return UINT16_MAX; //not found
-}
 
-// takes a block_id and returns the id that matches it, except for the facing axis property rotated in degrees
-blid_t db_get_rotated_block(blid_t blk_id, int degrees) {
-    assert (activedb);
-    assert (degrees == 90 || degrees == 180 || degrees == 270);
+    if (!db->map)
+        build_db_transforms(db);
+}
 
-    const char *currentdirection = db_get_blk_propval(blk_id,"facing");
-    const char *currentaxis = db_get_blk_propval(blk_id,"axis");
-    block_t *blk = db_blk_record_from_id(blk_id);
-
-    if (currentdirection) {
-        char *desireddirection;
-        //TODO: something more elegant
-        if (!strcmp(currentdirection, "north")) {
-            if (degrees == 90) desireddirection = "east";
-            if (degrees == 180) desireddirection = "south";
-            if (degrees == 270) desireddirection = "west";
+// Private: transform a direction name, returns the input if it is not a direction
+static const char *dir_xform(const char *d, int xf) {
+    static const char *hdir[4] = { "north", "east", "south", "west" };
+    for (int i=0; i<4; i++) {
+        if (strcmp(d, hdir[i])) continue;
+        switch (xf) {
+            case DB_ROT90:  return hdir[(i+1)&3];
+            case DB_ROT180: return hdir[(i+2)&3];
+            case DB_ROT270: return hdir[(i+3)&3];
+            case DB_FLIPX:  return (i&1) ? hdir[i^2] : d;
+            case DB_FLIPZ:  return (i&1) ? d : hdir[i^2];
         }
-        else if (!strcmp(currentdirection, "east")) {
-            if (degrees == 90) desireddirection = "south";
-            if (degrees == 180) desireddirection = "west";
-            if (degrees == 270) desireddirection = "north";
+        return d;
+    }
+    if (xf == DB_FLIPY) {
+        if (!strcmp(d, "up")) return "down";
+        if (!strcmp(d, "down")) return "up";
+    }
+    return d;
+}
+
+// Private: swap the two strings if s matches either of them
+static const char *swap_str(const char *s, const char *a, const char *b) {
+    if (!strcmp(s, a)) return b;
+    if (!strcmp(s, b)) return a;
+    return s;
+}
+
+// Private: find the index of the transformed value of property j
+static int xform_val(database_t *db, dbfam_t *f, int j, const char *v, int xf) {
+    dbprop_t *p = f->props+j;
+    const char *pn = P(db->str)[p->pname];
+    char buf[64];
+    int mirror = (xf == DB_FLIPX || xf == DB_FLIPZ);
+
+    if (!strcmp(pn, "facing")) {
+        v = dir_xform(v, xf);
+    }
+    else if (!strcmp(pn, "axis")) {
+        if (xf == DB_ROT90 || xf == DB_ROT270)
+            v = swap_str(v, "x", "z");
+    }
+    else if (!strcmp(pn, "rotation")) {
+        // 16 directions, 0=south, 4=west, 8=north, 12=east
+        int r = atoi(v);
+        switch (xf) {
+            case DB_ROT90:  r += 4; break;
+            case DB_ROT180: r += 8; break;
+            case DB_ROT270: r += 12; break;
+            case DB_FLIPX:  r = 16-r; break;
+            case DB_FLIPZ:  r = 8-r; break;
         }
-        else if (!strcmp(currentdirection, "south")) {
-            if (degrees == 90) desireddirection = "west";
-            if (degrees == 180) desireddirection = "north";
-            if (degrees == 270) desireddirection = "east";
+        sprintf(buf, "%d", r&15);
+        v = buf;
+    }
+    else if (!strcmp(pn, "half") || !strcmp(pn, "type")) {
+        if (xf == DB_FLIPY) v = swap_str(v, "top", "bottom");
+        if (mirror) v = swap_str(v, "left", "right");
+    }
+    else if (!strcmp(pn, "hinge")) {
+        if (mirror) v = swap_str(v, "left", "right");
+    }
+    else if (!strcmp(pn, "face") || !strcmp(pn, "attachment")) {
+        if (xf == DB_FLIPY) v = swap_str(v, "floor", "ceiling");
+    }
+    else if (!strcmp(pn, "shape")) {
+        // stairs: inner_left, outer_right etc., rails: north_south, ascending_east etc.
+        char t1[32], t2[32];
+        if (sscanf(v, "%31[a-z]_%31[a-z]", t1, t2) == 2) {
+            const char *a = dir_xform(t1, xf), *b = dir_xform(t2, xf);
+            if (mirror) b = swap_str(b, "left", "right");
+            sprintf(buf, "%s_%s", a, b);
+            int r = prop_val(p, str_find(db, buf));
+            if (r >= 0) return r;
+            sprintf(buf, "%s_%s", b, a);
+            v = buf;
         }
-        else if (!strcmp(currentdirection, "west")) {
-            if (degrees == 90) desireddirection = "north";
-            if (degrees == 180) desireddirection = "east";
-            if (degrees == 270) desireddirection = "south";
+    }
+    return prop_val(p, str_find(db, v));
+}
+
+// Private: compute the transformed state of a block
+static blid_t xform_state(database_t *db, dbfam_t *f, blid_t id, int xf) {
+    int idx[f->nprops];
+    for (int j=0; j < f->nprops; j++)
+        idx[j] = state_val(f, j, id);
+
+    int nidx[f->nprops];
+    memcpy(nidx, idx, sizeof(idx));
+
+    for (int j=0; j < f->nprops; j++) {
+        dbprop_t *p = f->props+j;
+        const char *pn = P(db->str)[p->pname];
+
+        // directional properties (fences, walls, vines, redstone) move to another property
+        const char *dn = dir_xform(pn, xf);
+        if (dn != pn) {
+            int q = fam_prop(f, str_find(db, dn));
+            if (q >= 0) {
+                int nv = prop_val(f->props+q, p->vals[idx[j]]);
+                if (nv >= 0) nidx[q] = nv;
+            }
+            continue;
         }
-        else return blk_id;  //block is facing up or down
 
-        return db_blk_property_change(blk_id, "facing", desireddirection);
+        int nv = xform_val(db, f, j, P(db->str)[p->vals[idx[j]]], xf);
+        if (nv >= 0) nidx[j] = nv;
     }
-    else if (currentaxis) {
-        char *desiredaxis;
-        if (!strcmp(currentaxis, "x")) {
-            if (degrees == 90) desiredaxis = "z";
-            if (degrees == 180) return blk_id;
-            if (degrees == 270) desiredaxis = "z";
-        }
-        else if (!strcmp(currentaxis, "z")) {
-            if (degrees == 90) desiredaxis = "x";
-            if (degrees == 180) return blk_id;
-            if (degrees == 270) desiredaxis = "x";
-        }
-        else return blk_id; //block in y axis
 
-        return db_blk_property_change(blk_id, "axis", desiredaxis);
+    blid_t nid = f->first;
+    for (int j=0; j < f->nprops; j++)
+        nid += nidx[j]*f->props[j].stride;
+    return nid;
+}
+
+// Private: Computes the rotation and flip transitions of all block states
+void build_db_transforms(database_t *db) {
+    int n = db->maxblid+1;
+    db->blkxform = calloc(n, sizeof(*db->blkxform));
+
+    for (int id=0; id < n; id++) {
+        for (int xf=0; xf < DB_NXFORM; xf++)
+            db->blkxform[id][xf] = id;
+        if (!db->blkrec[id]) continue;
+
+        dbfam_t *f = P(db->fam) + db->blkfam[id];
+        if (!f->strided || !f->nprops) continue;
+        for (int xf=0; xf < DB_NXFORM; xf++)
+            db->blkxform[id][xf] = xform_state(db, f, id, xf);
+    }
+}
+
+// Gets the block id transformed by one of the DB_ROT* / DB_FLIP* transitions
+blid_t db_blk_transform(blid_t blk_id, int xform) {
+    assert (activedb);
+    assert (xform >= 0 && xform < DB_NXFORM);
+    if (blk_id > activedb->maxblid) return blk_id;
+    return activedb->blkxform[blk_id][xform];
+}
+
+// Gets the block_id that matches another block_id, except for changing one property to a different value
+blid_t db_blk_property_change(blid_t blk_id, const char* prop_name, const char* new_prop_value) {
+    block_t *originalblk = db_blk_record_from_id(blk_id);
+    if (!originalblk) return UINT16_MAX;
+
+    // names or values that are not in the pool can't match any state
+    dbstr_t pn = str_find(activedb, prop_name);
+    dbstr_t pv = str_find(activedb, new_prop_value);
+    if (pn == DBSTR_NONE || pv == DBSTR_NONE) return UINT16_MAX;
+
+    // with the property strides, the new ID can be computed directly
+    dbfam_t *f = P(activedb->fam) + activedb->blkfam[blk_id];
+    if (f->strided) {
+        int j = fam_prop(f, pn);
+        if (j < 0) return UINT16_MAX;
+        int v = prop_val(f->props+j, pv);
+        if (v < 0) return UINT16_MAX;
+        return blk_id + (v - state_val(f, j, blk_id)) * f->props[j].stride;
+    }
+
+    int propertycount = originalblk->C(prop);
+
+    // loop through all states of the same block to find a match
+    blid_t first = activedb->blkfirst[blk_id];
+    for (int i=first; i < first+activedb->blkstates[blk_id]; i++) {
+        block_t *newblk = activedb->blkrec[i];
+        if (!newblk) continue;
+        int matchcount = 0;
+        for (int j=0; j < propertycount; j++) {
+            // if this is the property that should change and its value matches new_prop_value
+            if (newblk->P(prop)[j].pn == pn) {
+                if (newblk->P(prop)[j].pv == pv) matchcount++;
+            }
+            // this is one of the properties that should remain the same as the original block
+            else if (newblk->P(prop)[j].pv == originalblk->P(prop)[j].pv) matchcount++;
+        }
+        if ( matchcount == propertycount ) return newblk->id;
     }
-    return blk_id;  //block doesnt rotate or have an axis (or slipped thru horrible logic above)
+    return UINT16_MAX; //not found
+}
+
+// takes a block_id and returns the id that matches it, except for the facing axis property rotated in degrees
+blid_t db_get_rotated_block(blid_t blk_id, int degrees) {
+    assert (activedb);
+    assert (degrees == 90 || degrees == 180 || degrees == 270);
+    return db_blk_transform(blk_id, degrees/90-1);
 }
 
 // Private: Get all block records matching a given blockname
 int get_all_records_matching_blockname(const char *blockname, block_t *blockarray[] ) {
     assert(activedb);
     int count = 0;
-    for (int i=0; i < activedb->C(block); i++) {
-        if (!strcmp(activedb->P(block)[i].name, blockname)) {
-            blockarray[count]= &activedb->P(block)[i];
+    blid_t id = db_get_blk_id(blockname);
+    if (id > activedb->maxblid) return 0;
+
+    blid_t first = activedb->blkfirst[id];
+    for (int i=first; i < first+activedb->blkstates[id]; i++) {
+        if (activedb->blkrec[i]) {
+            blockarray[count]= activedb->blkrec[i];
             count++;
         }
     }
     return count;
 }
 
-// Private: Get a property value given a block record and property name
-const char *get_prop_value_from_record(block_t *blk, const char *propname) {
+// Private: Get a property value handle given a block record and property name handle
+dbstr_t get_prop_value_from_record(block_t *blk, dbstr_t pname) {
     for (int j=0; j < blk->C(prop); j++) {
-        if (!strcmp(blk->P(prop)[j].pname, propname)) {
-            return blk->P(prop)[j].pvalue;
+        if (blk->P(prop)[j].pn == pname) {
+            return blk->P(prop)[j].pv;
         }
     }
-    return NULL;
+    return DBSTR_NONE;
 }
 
 // places all ids matching a set of propeties for the block name into array ids (can be assumed to be long enough) and returns the number of ids
 int db_get_matching_block_ids(const char *name, prop_t *match, int propcount, blid_t *ids) {
+    assert(activedb);
+    dbstr_t pnames[propcount], pvalues[propcount];
+    for (int j=0; j < propcount; j++) {
+        pnames[j]  = str_find(activedb, match[j].pname);
+        pvalues[j] = str_find(activedb, match[j].pvalue);
+        if (pnames[j] == DBSTR_NONE || pvalues[j] == DBSTR_NONE) return 0;
+    }
+    return db_get_matching_block_ids_h(name, pnames, pvalues, propcount, ids);
+}
+
+// Handle variant of db_get_matching_block_ids
+int db_get_matching_block_ids_h(const char *name, const dbstr_t *pnames, const dbstr_t *pvalues,
+                                int propcount, blid_t *ids) {
     block_t *blockarray[2000];
     int blkcount = get_all_records_matching_blockname(name, blockarray);
     int blkmatches = 0;
@@ -866,7 +1556,7 @@ int db_get_matching_block_ids(const char *name, prop_t *match, int propcount, bl
         int propmatches=0;
         // loop through properties to see if this block's prop values match those in the given array
         for (int j=0; j < propcount; j++) {
-            if (!strcmp(get_prop_value_from_record(blk, match[j].pname),match[j].pvalue)) propmatches++;
+            if (get_prop_value_from_record(blk, pnames[j]) == pvalues[j]) propmatches++;
         }
         if (propmatches == propcount) ids[blkmatches++] = blk->id;
     }
@@ -877,9 +1567,13 @@ int db_get_matching_block_ids(const char *name, prop_t *match, int propcount, bl
 int db_get_all_ids_matching_blockname(const char *blockname, blid_t *idarray ) {
     assert(activedb);
     int count = 0;
-    for (int i=0; i < activedb->C(block); i++) {
-        if (!strcmp(activedb->P(block)[i].name, blockname)) {
-            idarray[count]=activedb->P(block)[i].id;
+    blid_t id = db_get_blk_id(blockname);
+    if (id > activedb->maxblid) return 0;
+
+    blid_t first = activedb->blkfirst[id];
+    for (int i=first; i < first+activedb->blkstates[id]; i++) {
+        if (activedb->blkrec[i]) {
+            idarray[count]=i;
             count++;
         }
     }
@@ -2168,6 +2862,75 @@ const uint64_t item_flags[] = {
 
 const int db_num_items = sizeof(item_flags)/sizeof(uint64_t);
 
+// Private: FNV-1a over a byte range, continuing from h
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for(; len>0; len--, p++)
+        h = (h^*p)*1099511628211ull;
+    return h;
+}
+
+static uint64_t hash_names(uint64_t h, const char **list) {
+    for (; *list; list++)
+        h = hash_bytes(h, *list, strlen(*list)+1);
+    return hash_bytes(h, "", 1);
+}
+
+// Private: hash of the in-code tables the compiled block flags and items are
+// derived from - a compiled database made with different tables is stale
+static uint64_t db_tables_hash() {
+    uint64_t h = 14695981039346656037ull;
+    h = hash_bytes(h, item_flags, sizeof(item_flags));
+
+    int i;
+    for (i=0; i < sizeof(item_aliases)/sizeof(item_aliases[0]); i++) {
+        h = hash_bytes(h, item_aliases[i].block, strlen(item_aliases[i].block)+1);
+        h = hash_bytes(h, item_aliases[i].item,  strlen(item_aliases[i].item)+1);
+    }
+
+    h = hash_names(h, noscan_names);
+    h = hash_names(h, empty_names);
+    h = hash_names(h, onwall_names);
+    return h;
+}
+
+// Private: Computes the classification flags of all block states
+// done once per block, the flags are shared by all its states
+void build_db_flags(database_t *db) {
+    int i;
+    int n = db->maxblid+1;
+    db->blkflags = calloc(n, sizeof(*db->blkflags));
+    for (i=0; i < C(db->block); i++) {
+        block_t *blk = &P(db->block)[i];
+        blid_t first = db->blkfirst[blk->id];
+        if (blk->id != first) {
+            db->blkflags[blk->id] = db->blkflags[first];
+            continue;
+        }
+
+        uint32_t flags = 0;
+        if (name_is_empty(blk->name))  flags |= BF_EMPTY;
+        if (name_is_noscan(blk->name)) flags |= BF_NOSCAN;
+        if (name_is_onwall(blk->name)) flags |= BF_ONWALL;
+
+        // placement flags come from the corresponding item
+        int item = db->blkitem[blk->id];
+        if (item >= 0 && item < db_num_items) {
+            uint64_t f = item_flags[item];
+            if (f & I_CONT)    flags |= BF_CONT;
+            if (f & I_SLAB)    flags |= BF_SLAB;
+            if (f & I_STAIR)   flags |= BF_STAIR;
+            if (f & I_AXIS)    flags |= BF_AXIS;
+            if (f & I_DOOR)    flags |= BF_DOOR;
+            if (f & I_TDOOR)   flags |= BF_TDOOR;
+            if (f & I_CHEST)   flags |= BF_CHEST;
+            if (f & I_ADJ)     flags |= BF_ADJ;
+            if (f & I_GRAVITY) flags |= BF_GRAVITY;
+        }
+        db->blkflags[blk->id] = flags;
+    }
+}
+
 // Returns stacksize of an item
 int db_stacksize (int item_id) {
     assert ( item_id >= 0 && item_id < db_num_items );
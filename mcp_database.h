@@ -22,6 +22,10 @@ extern const int db_num_items;
 
 typedef uint16_t blid_t;
 
+// handle of an interned property name or value string
+typedef uint16_t dbstr_t;
+#define DBSTR_NONE 0xffff
+
 typedef struct {
   const char *name;
   int id;
@@ -30,6 +34,7 @@ typedef struct {
 typedef struct {
   const char *pname;
   const char *pvalue;
+  dbstr_t pn, pv;       // interned handles, set at load time
 }  prop_t;
 
 typedef struct {
@@ -40,12 +45,86 @@ typedef struct {
   lh_arr_declare(prop_t, prop);
 }  block_t;
 
+// property of a block family - all states of a block
+typedef struct {
+  dbstr_t pname;
+  int nvals;
+  dbstr_t *vals;        // values in the order of the state IDs
+  int stride;           // state ID difference between consecutive values
+}  dbprop_t;
+
+typedef struct {
+  blid_t first;         // first state ID
+  int nstates;
+  int strided;          // state IDs follow the property strides
+  int nprops;
+  dbprop_t *props;
+}  dbfam_t;
+
+// block state transitions
+#define DB_ROT90    0   // clockwise, seen from above
+#define DB_ROT180   1
+#define DB_ROT270   2
+#define DB_FLIPX    3   // mirror along the x axis (east<->west)
+#define DB_FLIPZ    4   // mirror along the z axis (north<->south)
+#define DB_FLIPY    5   // upside down
+#define DB_NXFORM   6
+
+// name lookup hash table entry
+typedef struct {
+  const char *name;     // NULL for unused entries
+  int id;
+}  dbhash_t;
+
 typedef struct {
   int protocol;
   lh_arr_declare(item_t, item);
   lh_arr_declare(block_t, block);
+
+  // name lookup, built at load time
+  int itemhsize;
+  dbhash_t *itemhash;   // item name -> item ID, including the block name aliases
+  int nitemnames;
+  const char **itemname;// item ID -> item name
+  int blkhsize;
+  dbhash_t *blkhash;    // block name -> default state ID
+
+  // interned property names and values, the pointers in prop_t point here
+  lh_arr_declare(const char *, str);
+  int strhsize;
+  dbhash_t *strhash;    // string -> handle
+
+  // dense tables indexed by the block state ID, built at load time
+  int maxblid;          // highest block state ID
+  block_t **blkrec;     // block record, NULL for unused IDs
+  blid_t *blkfirst;     // first state ID of the same block
+  uint16_t *blkstates;  // number of states of the same block
+  int *blkitem;         // corresponding item ID
+  uint32_t *blkflags;   // BF_* classification flags
+  uint16_t *blkfam;     // index of the block family
+  blid_t (*blkxform)[DB_NXFORM]; // transformed state IDs
+
+  lh_arr_declare(dbfam_t, fam);
+
+  // compiled database file mapping, NULL if loaded from text/json
+  void *map;
+  size_t mapsize;
 } database_t;
 
+// block state classification flags
+#define BF_EMPTY    (1<<0)  // can be placed into, e.g. air, water, grass
+#define BF_NOSCAN   (1<<1)  // excluded from scanning
+#define BF_ONWALL   (1<<2)  // wall-mounted variant, item name differs
+#define BF_CONT     (1<<3)  // container, opens a dialog
+#define BF_SLAB     (1<<4)
+#define BF_STAIR    (1<<5)
+#define BF_AXIS     (1<<6)
+#define BF_DOOR     (1<<7)
+#define BF_TDOOR    (1<<8)
+#define BF_CHEST    (1<<9)
+#define BF_ADJ      (1<<10) // adjustable, needs crouching to place against
+#define BF_GRAVITY  (1<<11) // falls without support
+
 // Loads a db for this protocol into memory
 int db_load(int protocol_id);
 
@@ -75,6 +154,9 @@ const int db_get_item_id_from_blk_id(blid_t id);
 // input is another block id, returning that block id's default id
 blid_t db_get_blk_default_id(blid_t id);
 
+// BF_* flags of a block state
+uint32_t db_blk_flags(blid_t blk_id);
+
 // true if this block should be excluded from scanning
 int db_blk_is_noscan(blid_t blk_id);
 
@@ -84,9 +166,15 @@ int db_blk_is_empty(blid_t blk_id);
 // blocks that are onwall -- cannot use item flags -- the block & item names dont match
 int db_blk_is_onwall(blid_t blk_id);
 
+// true if this block is a slab
+int db_blk_is_slab(blid_t blk_id);
+
 // Gets the block_id that matches another block_id, except for changing one property to a different value
 blid_t db_blk_property_change(blid_t blk_id, const char* prop_name, const char* new_prop_value);
 
+// Gets the block id transformed by one of the DB_ROT* / DB_FLIP* transitions
+blid_t db_blk_transform(blid_t blk_id, int xform);
+
 // takes a block_id and returns the id that matches it, except for the facing or axis property rotated in degrees
 blid_t db_get_rotated_block(blid_t blk_id, int degrees);
 
@@ -102,6 +190,24 @@ int db_get_all_ids_matching_blockname(const char *blockname, blid_t *idarray );
 //  db_get_blk_propval(1686,"half") => "bottom"
 const char *db_get_blk_propval(blid_t id, const char *propname);
 
+// Gets the handle of an interned property name or value, DBSTR_NONE if the
+// string does not occur in the database
+//  db_str("facing") => handle to use with the *_h functions
+dbstr_t db_str(const char *str);
+
+// Gets the string of an interned handle
+const char *db_str_name(dbstr_t h);
+
+// Gets the generation of the active database, changes on every db_load/db_unload
+uint32_t db_generation();
+
+// Handle variant of db_get_blk_propval, returns DBSTR_NONE if there is no such property
+dbstr_t db_get_blk_propval_h(blid_t id, dbstr_t pname);
+
+// Handle variant of db_get_matching_block_ids, matching pvalues[i] of the property pnames[i]
+int db_get_matching_block_ids_h(const char *name, const dbstr_t *pnames, const dbstr_t *pvalues,
+                                int propcount, blid_t *ids);
+
 // Gets the number of states a block has, given the block id
 //  db_get_num_states(5) => 1 // polished_diorite
 //  db_get_num_states(8) => 2 // grass_block
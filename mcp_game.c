@@ -109,10 +109,13 @@ static void autokill(MCPacketQueue *sq) {
 
     // calculate list of hostile entities in range
     uint32_t hent[MAX_ENTITIES];
+    int near[MAX_ENTITIES];
+    int nn = find_entities_in_range(gs.own.x, HEADPOSY(gs.own.y), gs.own.z,
+                                    REACH_RANGE, near, MAX_ENTITIES);
 
     int i,hi=0;
-    for(i=0; i<C(gs.entity) && hi<MAX_ENTITIES; i++) {
-        entity *e = P(gs.entity)+i;
+    for(i=0; i<nn; i++) {
+        entity *e = P(gs.entity)+near[i];
 
         // skip non-hostile entities
         if (!e->hostile) continue;
@@ -123,9 +126,7 @@ static void autokill(MCPacketQueue *sq) {
         // skip entities we hit only recently
         if ((tb_ak.last-e->lasthit) < MIN_ENTITY_DELAY) continue;
 
-        // only take entities that are within our reach
-        if (mydist(e->x, e->y, e->z)<=REACH_RANGE)
-            hent[hi++] = i;
+        hent[hi++] = near[i];
     }
     //TODO: sort entities by how dangerous and how close they are
     //TODO: check for obstruction
@@ -166,10 +167,13 @@ static void autoshear(MCPacketQueue *sq) {
 
     // calculate list of usable entities in range
     uint32_t hent[MAX_ENTITIES];
+    int near[MAX_ENTITIES];
+    int nn = find_entities_in_range(gs.own.x, HEADPOSY(gs.own.y), gs.own.z,
+                                    REACH_RANGE, near, MAX_ENTITIES);
 
     int i,hi=0;
-    for(i=0; i<C(gs.entity) && hi<MAX_ENTITIES; i++) {
-        entity *e = P(gs.entity)+i;
+    for(i=0; i<nn; i++) {
+        entity *e = P(gs.entity)+near[i];
 
         // check if the entity is a sheep
         if (e->mtype != Sheep) continue;
@@ -186,9 +190,7 @@ static void autoshear(MCPacketQueue *sq) {
         assert(e->mdata[midx_baby].type == META_BOOL);
         if (e->mdata[midx_baby].bool) continue;
 
-        // only take entities that are within our reach
-        if (mydist(e->x, e->y, e->z)<=REACH_RANGE)
-            hent[hi++] = i;
+        hent[hi++] = near[i];
     }
 
     for(i=0; i<hi && i<MAX_ATTACK; i++) {
@@ -226,6 +228,18 @@ static void hole_radar(MCPacketQueue *cq) {
     }
 
     for(i=0; i<HR_DIST; i++) {
+        // the three columns ahead have nothing at the floor level or above -
+        // no lava possible, just report the hole
+        int hmax = get_height_at(x+lx*i, z+lz*i);
+        hmax = MAX(hmax, get_height_at(x+lx*i+lz, z+lz*i+lx));
+        hmax = MAX(hmax, get_height_at(x+lx*i-lz, z+lz*i-lx));
+        if (hmax < y) {
+            char reply[32768];
+            sprintf(reply, "*** HOLE *** : %d,%d y=%d d=%d", x+lx*i,z+lz*i,y,i);
+            chat_message(reply, cq, "gold", 2);
+            break;
+        }
+
         bid_t bl[8] = {
             get_block_at(x+lx*i,    z+lz*i,    y+3),
             get_block_at(x+lx*i+lz, z+lz*i+lx, y+2),
@@ -263,29 +277,28 @@ static void hole_radar(MCPacketQueue *cq) {
 
 int aid=10000;
 
-#define IASTATE_NONE            0
-#define IASTATE_START           1
-#define IASTATE_PICK_SENT       2
-#define IASTATE_PICK_ACCEPTED   3
-#define IASTATE_SWAP_SENT       4
-#define IASTATE_SWAP_ACCEPTED   5
-#define IASTATE_PUT_SENT        6
-#define IASTATE_PUT_ACCEPTED    7
+// maximum number of slot swaps awaiting confirmation from the server
+#define INVQ_MAXSWAP 8
 
-struct {
-    int     state;          // current state of the invaction queue
-    int     base_aid;       // action id of the first transaction
+// a slot swap sent to the server as three consecutive clicks with
+// action IDs base_aid..base_aid+2
+typedef struct {
+    int     base_aid;       // action id of the first click
     int     sid_a;          // slot A ID
     int     sid_b;          // slot B ID
-    slot_t  drag;           // temp drag slot
-    int64_t start;          // timestamp when the action has started
+    int     acked;          // bitmask of the confirmed clicks
+    slot_t  a, b;           // slot contents before the swap, used for rollback
+    int64_t start;          // timestamp when the clicks were sent
+} invswap;
+
+struct {
+    invswap q[INVQ_MAXSWAP]; // swaps awaiting confirmation, oldest first
+    int     n;
 } invq;
 
-void gmi_click(MCPacketQueue *sq, int sid, int aid) {
+void gmi_click(MCPacketQueue *sq, int sid, int aid, slot_t *s) {
     assert(sid>=9 && sid<45);
 
-    slot_t *s = &gs.inv.slots[sid];
-
     NEWPACKET(CP_ClickWindow, click);
     tclick->wid = 0;
     tclick->sid = sid;
@@ -296,221 +309,129 @@ void gmi_click(MCPacketQueue *sq, int sid, int aid) {
     queue_packet(click, sq);
 
     if (DEBUG_INVENTORY)
-        printf("ClickWindow aid=%d, sid=%d, state=%d\n",
-               aid, sid, invq.state);
+        printf("ClickWindow aid=%d, sid=%d, inflight=%d\n",
+               aid, sid, invq.n);
 }
 
-#define INVQ_TIMEOUT 2000000
+// send the current state of a slot to the client
+static void gmi_update_client(MCPacketQueue *cq, int sid) {
+    NEWPACKET(SP_SetSlot, cl);
+    tcl->wid = 0;
+    tcl->sid = sid;
+    clone_slot(&gs.inv.slots[sid], &tcl->slot);
+    queue_packet(cl, cq);
+}
 
-void gmi_failed(MCPacketQueue *sq, MCPacketQueue *cq) {
-    // Close window
+static void gmi_close_window(MCPacketQueue *sq) {
     NEWPACKET(CP_CloseWindow, cwin);
     tcwin->wid=0;
     queue_packet(cwin, sq);
+}
+
+// check if a slot is involved in any swap not confirmed yet
+int gmi_slot_unconfirmed(int sid) {
+    int i;
+    for(i=0; i<invq.n; i++)
+        if (invq.q[i].sid_a == sid || invq.q[i].sid_b == sid)
+            return 1;
+    return 0;
+}
+
+static void invq_clear() {
+    int i;
+    for(i=0; i<invq.n; i++) {
+        clear_slot(&invq.q[i].a);
+        clear_slot(&invq.q[i].b);
+    }
+    lh_clear_obj(invq);
+}
 
-    slot_t *a = &gs.inv.slots[invq.sid_a];
-    slot_t *b = &gs.inv.slots[invq.sid_b];
+#define INVQ_TIMEOUT 2000000
 
-    // Update Client (Slot A)
-    NEWPACKET(SP_SetSlot, cla);
-    tcla->wid = 0;
-    tcla->sid = invq.sid_a;
-    clone_slot(a, &tcla->slot);
-    queue_packet(cla, cq);
+void gmi_failed(MCPacketQueue *sq, MCPacketQueue *cq) {
+    int i;
 
-    // Update Client (Slot B)
-    NEWPACKET(SP_SetSlot, clb);
-    tclb->wid = 0;
-    tclb->sid = invq.sid_b;
-    clone_slot(b, &tclb->slot);
-    queue_packet(clb, cq);
+    // Close window
+    gmi_close_window(sq);
+
+    // Roll back the predicted inventory state, newest swap first, and update
+    // the client - the server will resend the window contents anyway
+    for(i=invq.n-1; i>=0; i--) {
+        invswap *s = &invq.q[i];
+        clone_slot(&s->a, &gs.inv.slots[s->sid_a]);
+        clone_slot(&s->b, &gs.inv.slots[s->sid_b]);
+    }
+    for(i=0; i<invq.n; i++) {
+        gmi_update_client(cq, invq.q[i].sid_a);
+        gmi_update_client(cq, invq.q[i].sid_b);
+    }
 
     // Inventory action failed, inventory state might be corrupt
-    clear_slot(&invq.drag);
-    lh_clear_obj(invq);
-    aid+=3;
-    if (aid>60000) aid=10000;
+    invq_clear();
 
     // Abort the building process for safety and notify user
     build_pause();
     chat_message("INV ACTION FAILED!!! Buildtask paused!", cq, "green", 2);
     chat_message("An inventory action has failed or timed out, inventory state may be inconsistent", cq, "green", 0);
     chat_message("Access any dialog (container/crafting table/etc.) to refresh the inventory", cq, "green", 0);
+    build_swaps_settled(cq, 1);
 }
 
 void gmi_process_queue(MCPacketQueue *sq, MCPacketQueue *cq) {
     if (DEBUG_INVENTORY) printf("GMI Process Queue\n");
-    assert(invq.state);
+    assert(invq.n);
 
     // Watchdog for the timeouted tasks
-    if (invq.state != IASTATE_START && gettimestamp()-invq.start > INVQ_TIMEOUT) {
+    if (gettimestamp()-invq.q[0].start > INVQ_TIMEOUT)
         gmi_failed(sq, cq);
-        return;
-    }
-
-    slot_t *a = &gs.inv.slots[invq.sid_a];
-    slot_t *b = &gs.inv.slots[invq.sid_b];
-
-    switch (invq.state) {
-        case IASTATE_START: {
-            if (DEBUG_INVENTORY) printf("IASTATE_START\n");
-            invq.base_aid = aid;
-            gmi_click(sq, invq.sid_a, invq.base_aid);
-            invq.state = IASTATE_PICK_SENT;
-            invq.start = gettimestamp();
-            if (DEBUG_INVENTORY) {
-                printf("*GMI: START -> PICK_SENT\n");
-                dump_inventory();
-                printf("  A: "); dump_slot(&gs.inv.slots[invq.sid_a]);
-                printf("  B: "); dump_slot(&gs.inv.slots[invq.sid_b]);
-                printf("  D: "); dump_slot(&invq.drag); printf("\n");
-            }
-            break;
-        }
-        case IASTATE_PICK_ACCEPTED: {
-            if (DEBUG_INVENTORY) printf("IASTATE_PICK_ACCEPTED\n");
-            gmi_click(sq, invq.sid_b, invq.base_aid+1);
-            clone_slot(a, &invq.drag);
-            clear_slot(a);
-            invq.state = IASTATE_SWAP_SENT;
-            if (DEBUG_INVENTORY) {
-                printf("*GMI: PICK_ACCEPTED -> SWAP_SENT\n");
-                dump_inventory();
-                printf("  A: "); dump_slot(&gs.inv.slots[invq.sid_a]);
-                printf("  B: "); dump_slot(&gs.inv.slots[invq.sid_b]);
-                printf("  D: "); dump_slot(&invq.drag); printf("\n");
-            }
-            break;
-        }
-        case IASTATE_SWAP_ACCEPTED: {
-            if (DEBUG_INVENTORY) printf("IASTATE_SWAP_ACCEPTED\n");
-            gmi_click(sq, invq.sid_a, invq.base_aid+2);
-            slot_t temp;
-            clone_slot(b, &temp);
-            clear_slot(b);
-            clone_slot(&invq.drag, b);
-            clear_slot(&invq.drag);
-            clone_slot(&temp,&invq.drag);
-            clear_slot(&temp);
-            invq.state = IASTATE_PUT_SENT;
-            if (DEBUG_INVENTORY) {
-                printf("*GMI: SWAP_ACCEPTED -> PUT_SENT\n");
-                dump_inventory();
-                printf("  A: "); dump_slot(&gs.inv.slots[invq.sid_a]);
-                printf("  B: "); dump_slot(&gs.inv.slots[invq.sid_b]);
-                printf("  D: "); dump_slot(&invq.drag); printf("\n");
-            }
-            break;
-        }
-        case IASTATE_PUT_ACCEPTED: {
-            if (DEBUG_INVENTORY) printf("IASTATE_PUT_ACCEPTED\n");
-            // Swap action complete, update client
-
-            // Swap slots in our inventory state
-            clone_slot(&invq.drag, a);
-            clear_slot(&invq.drag);
-
-            // Close window
-            NEWPACKET(CP_CloseWindow, cwin);
-            tcwin->wid=0;
-            queue_packet(cwin, sq);
-
-            // Update Client (Slot A)
-            NEWPACKET(SP_SetSlot, cla);
-            tcla->wid = 0;
-            tcla->sid = invq.sid_a;
-            clone_slot(a, &tcla->slot);
-            queue_packet(cla, cq);
-
-            // Update Client (Slot B)
-            NEWPACKET(SP_SetSlot, clb);
-            tclb->wid = 0;
-            tclb->sid = invq.sid_b;
-            clone_slot(b, &tclb->slot);
-            queue_packet(clb, cq);
-
-            // Clear the state
-            aid+=3;
-            if (aid>60000) aid=10000;
-            lh_clear_obj(invq); // This also sets the state to IASTATE_NONE
-
-            if (DEBUG_INVENTORY) {
-                printf("*GMI: PUT_ACCEPTED -> IDLE\n");
-                dump_inventory();
-                printf("  A: "); dump_slot(&gs.inv.slots[invq.sid_a]);
-                printf("  B: "); dump_slot(&gs.inv.slots[invq.sid_b]);
-                printf("  D: "); dump_slot(&invq.drag); printf("\n");
-            }
-
-            break;
-        }
-    }
 }
 
 int gmi_confirm(SP_ConfirmTransaction_pkt *tpkt, MCPacketQueue *sq, MCPacketQueue *cq) {
-    if ( !invq.state || tpkt->wid != 0) return 1;
+    if ( !invq.n || tpkt->wid != 0) return 1;
+
+    // find the swap this click belongs to - confirmations may arrive in any order
+    int i, click=-1;
+    for(i=0; i<invq.n; i++) {
+        click = (int)tpkt->aid - invq.q[i].base_aid;
+        if (click>=0 && click<3) break;
+    }
+    if (i==invq.n) return 1;
+    invswap *s = &invq.q[i];
 
     if (!tpkt->accepted) {
         printf("Inventory action not accepted (wid=%d aid=%d base_aid=%d sid_a=%d sid_b=%d)\n",
-               tpkt->wid, tpkt->aid, invq.base_aid, invq.sid_a, invq.sid_b);
-        if (DEBUG_INVENTORY) {
-            printf("  A: "); dump_slot(&gs.inv.slots[invq.sid_a]);
-            printf("  B: "); dump_slot(&gs.inv.slots[invq.sid_b]);
-            printf("  D: "); dump_slot(&invq.drag); printf("\n");
-            dump_inventory();
-        }
+               tpkt->wid, tpkt->aid, s->base_aid, s->sid_a, s->sid_b);
+        if (DEBUG_INVENTORY) dump_inventory();
 
         gmi_failed(sq, cq);
+        return 0;
     }
-    else {
-        if (DEBUG_INVENTORY) {
-            printf("Inventory action is accepted (wid=%d aid=%d base_aid=%d sid_a=%d sid_b=%d)",
-            tpkt->wid, tpkt->aid, invq.base_aid, invq.sid_a, invq.sid_b);
-            printf(" invq.state = %i\n",invq.state);
-        }
-        switch (invq.state) {
-            case IASTATE_PICK_SENT:
-                if (DEBUG_INVENTORY) printf("IASTATE_PICK_SENT\n");
-                if(tpkt->aid != invq.base_aid) return 1;
-                invq.state = IASTATE_PICK_ACCEPTED;
-                if (DEBUG_INVENTORY) {
-                    printf("*GMI: PICK_SENT -> PICK_ACCEPTED, aid=%d base_aid=%d sid_a=%d sid_b=%d\n",
-                           tpkt->aid, invq.base_aid, invq.sid_a, invq.sid_b);
-                    dump_inventory();
-                    printf("  A: "); dump_slot(&gs.inv.slots[invq.sid_a]);
-                    printf("  B: "); dump_slot(&gs.inv.slots[invq.sid_b]);
-                    printf("  D: "); dump_slot(&invq.drag); printf("\n");
-                }
-                break;
-            case IASTATE_SWAP_SENT:
-                if (DEBUG_INVENTORY) printf("IASTATE_SWAP_SENT\n");
-                if(tpkt->aid != invq.base_aid+1) return 1;
-                invq.state = IASTATE_SWAP_ACCEPTED;
-                if (DEBUG_INVENTORY) {
-                    printf("*GMI: SWAP_SENT -> SWAP_ACCEPTED, aid=%d base_aid=%d sid_a=%d sid_b=%d\n",
-                           tpkt->aid, invq.base_aid, invq.sid_a, invq.sid_b);
-                    dump_inventory();
-                    printf("  A: "); dump_slot(&gs.inv.slots[invq.sid_a]);
-                    printf("  B: "); dump_slot(&gs.inv.slots[invq.sid_b]);
-                    printf("  D: "); dump_slot(&invq.drag); printf("\n");
-                }
-                break;
-            case IASTATE_PUT_SENT:
-                if (DEBUG_INVENTORY) printf("IASTATE_PUT_SENT\n");
-
-                if(tpkt->aid != invq.base_aid+2) return 1;
-                invq.state = IASTATE_PUT_ACCEPTED;
-                if (DEBUG_INVENTORY) {
-                    printf("*GMI: PUT_SENT -> PUT_ACCEPTED, aid=%d base_aid=%d sid_a=%d sid_b=%d\n",
-                           tpkt->aid, invq.base_aid, invq.sid_a, invq.sid_b);
-                    dump_inventory();
-                    printf("  A: "); dump_slot(&gs.inv.slots[invq.sid_a]);
-                    printf("  B: "); dump_slot(&gs.inv.slots[invq.sid_b]);
-                    printf("  D: "); dump_slot(&invq.drag); printf("\n");
-                }
-                break;
-        }
+
+    if (DEBUG_INVENTORY)
+        printf("Inventory action is accepted (wid=%d aid=%d base_aid=%d sid_a=%d sid_b=%d click=%d)\n",
+               tpkt->wid, tpkt->aid, s->base_aid, s->sid_a, s->sid_b, click);
+    s->acked |= 1<<click;
+
+    // retire the fully confirmed swaps in order, so the rollback data
+    // of the remaining ones stays valid
+    while (invq.n && invq.q[0].acked == 7) {
+        s = &invq.q[0];
+        gmi_update_client(cq, s->sid_a);
+        gmi_update_client(cq, s->sid_b);
+        clear_slot(&s->a);
+        clear_slot(&s->b);
+        invq.n--;
+        memmove(invq.q, invq.q+1, invq.n*sizeof(invq.q[0]));
+        lh_clear_obj(invq.q[invq.n]);
+    }
+
+    // all clicks accounted for - the cursor is empty, close the window
+    if (!invq.n) {
+        gmi_close_window(sq);
+        build_swaps_settled(cq, 0);
+        if (DEBUG_INVENTORY) dump_inventory();
     }
+
     return 0;
 }
 
@@ -535,21 +456,43 @@ void gmi_change_held(MCPacketQueue *sq, MCPacketQueue *cq, int sid, int notify_c
     }
 }
 
-void gmi_swap_slots(MCPacketQueue *sq, MCPacketQueue *cq, int sa, int sb) {
-    assert(invq.state == IASTATE_NONE);
+// swap two inventory slots - the clicks are sent at once with predicted slot
+// contents and our inventory state is updated immediately, confirmations are
+// tracked by gmi_confirm. Returns 0 if too many swaps are in flight already
+int gmi_swap_slots(MCPacketQueue *sq, MCPacketQueue *cq, int sa, int sb) {
     assert(sa>=9 && sa<45);
     assert(sb>=9 && sb<45);
 
+    if (invq.n >= INVQ_MAXSWAP) return 0;
+
     slot_t *a = &gs.inv.slots[sa];
     slot_t *b = &gs.inv.slots[sb];
 
     assert(!sameitem(a,b)); // ensure the items are not same (or not stackable),
                             // so our clickery will actually swap them
 
-    invq.state = IASTATE_START;
-    invq.sid_a = sa;
-    invq.sid_b = sb;
-    clear_slot(&invq.drag);
+    invswap *s = &invq.q[invq.n++];
+    lh_clear_obj(*s);
+    s->base_aid = aid;
+    s->sid_a = sa;
+    s->sid_b = sb;
+    s->start = gettimestamp();
+    clone_slot(a, &s->a);
+    clone_slot(b, &s->b);
+
+    aid+=3;
+    if (aid>60000) aid=10000;
+
+    slot_t empty;
+    lh_clear_obj(empty);
+    empty.item = -1;
+
+    gmi_click(sq, sa, s->base_aid,   a);      // pick up A
+    gmi_click(sq, sb, s->base_aid+1, b);      // put A into B, pick up B
+    gmi_click(sq, sa, s->base_aid+2, &empty); // put B into the emptied A
+    swap_slots(a, b);
+
+    return 1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -694,7 +637,7 @@ void autoeat(MCPacketQueue *sq, MCPacketQueue *cq) {
         int eslot = i;
         if (i<36) {
             eslot = find_evictable_slot()+36;
-            gmi_swap_slots(sq, cq, i, eslot);
+            if (!gmi_swap_slots(sq, cq, i, eslot)) return;
         }
 
         // switch to the food item, but remember what was selected before
@@ -819,12 +762,12 @@ void xray_renew(MCPacketQueue *cq) {
             if (!region) continue;
 
             for(ci=0; ci<32*32; ci++) {
-                gschunk * gc = region->chunk[ci];
-                if (!gc) continue;
-
                 int32_t X = CC_X(si,ri,ci);
                 int32_t Z = CC_Z(si,ri,ci);
 
+                gschunk * gc = region_chunk(w, region, X, Z);
+                if (!gc) continue;
+
                 NEWPACKET(SP_ChunkData, cd);
                 tcd->cont = 1;
                 tcd->skylight = (gs.world == &gs.overworld);
@@ -832,7 +775,7 @@ void xray_renew(MCPacketQueue *cq) {
                 tcd->chunk.Z = Z;
                 tcd->chunk.mask = 0;
                 memmove(tcd->chunk.biome, gc->biome, sizeof(tcd->chunk.biome));
-                tcd->te = (gc->tent) ? nbt_clone(gc->tent) : nbt_new(NBT_LIST, "TileEntities", 0);
+                tcd->te = chunk_tile_entities(gc);
 
                 int i,Y;
                 for(Y=0; Y<16; Y++) {
@@ -1111,6 +1054,20 @@ void handle_command(char *str, MCPacketQueue *tq, MCPacketQueue *bq) {
             free_cuboid(c);
         }
     }
+    else if (!strcmp(words[0],"stored")) {
+        int item = words[1] ? db_get_item_id(words[1]) : -1;
+        if (item <= 0) {
+            sprintf(reply,"Usage: stored <item>");
+        }
+        else {
+            pos_t pos[16];
+            int count[16];
+            int i, n = find_stored_item(item, pos, count, 16);
+            int len = sprintf(reply,"%s stored in %d containers:",words[1],n);
+            for(i=0; i<n; i++)
+                len += sprintf(reply+len," %d,%d,%d(%d)",pos[i].x,pos[i].y,pos[i].z,count[i]);
+        }
+    }
 
     // send an immediate reply if any was given
     if (reply[0]) chat_message(reply, bq, "gold", rpos);
@@ -1122,6 +1079,9 @@ void gm_packet(MCPacket *pkt, MCPacketQueue *tq, MCPacketQueue *bq) {
     MCPacketQueue *sq = pkt->cl ? tq : bq;
     MCPacketQueue *cq = pkt->cl ? bq : tq;
 
+    // world changes invalidate the cached buildtask state
+    if (!pkt->cl) build_invalidate(pkt);
+
     switch (pkt->pid) {
 
         ////////////////////////////////////////////////////////////////
@@ -1508,8 +1468,7 @@ void read_uuids() {
 
 void gm_reset() {
     lh_clear_obj(opt);
-    clear_slot(&invq.drag);
-    lh_clear_obj(invq);
+    invq_clear();
 
     build_clear(NULL,NULL);
     readbases();
@@ -1517,11 +1476,8 @@ void gm_reset() {
 }
 
 void gm_async(MCPacketQueue *sq, MCPacketQueue *cq) {
-    if (invq.state) {
-        // do not attempt to do other things while inventory is handled
-        gmi_process_queue(sq, cq);
-        return;
-    }
+    // the swaps are pipelined, so we only need to watch for the timeouts here
+    if (invq.n) gmi_process_queue(sq, cq);
 
     if (opt.autokill)  autokill(sq);
     if (opt.autoshear) autoshear(sq);
@@ -1530,5 +1486,6 @@ void gm_async(MCPacketQueue *sq, MCPacketQueue *cq) {
 
     build_preview_transmit(cq);
     build_progress(sq, cq);
+    build_journal_flush(0);
     hud_update(cq);
 }
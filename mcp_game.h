@@ -18,5 +18,6 @@ void gm_reset();
 void gm_async(MCPacketQueue *sq, MCPacketQueue *cq);
 
 void gmi_change_held(MCPacketQueue *sq, MCPacketQueue *cq, int sid, int notify_client);
-void gmi_swap_slots(MCPacketQueue *sq, MCPacketQueue *cq, int sa, int sb);
+int gmi_swap_slots(MCPacketQueue *sq, MCPacketQueue *cq, int sa, int sb);
+int gmi_slot_unconfirmed(int sid);
 void handle_command(char *str, MCPacketQueue *tq, MCPacketQueue *bq);
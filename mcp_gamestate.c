@@ -23,6 +23,7 @@
 #include <lh_compress.h>
 
 #include "mcp_gamestate.h"
+#include "helpers.h"
 #include "hud.h"
 
 gamestate gs;
@@ -31,12 +32,145 @@ static int gs_used = 0;
 ////////////////////////////////////////////////////////////////////////////////
 // entity tracking
 
-static inline int find_entity(int eid) {
+#define EHASH(eid) ((uint32_t)(eid)*2654435761u)
+
+// position in the hash table where the EID is stored or would be inserted
+static inline uint32_t ehash_slot(int32_t eid) {
+    uint32_t mask = gs.ehsize-1;
+    uint32_t h = EHASH(eid)&mask;
+    while (gs.ehash[h] && P(gs.entity)[gs.ehash[h]-1].id != eid)
+        h = (h+1)&mask;
+    return h;
+}
+
+// remove the hash table entry, shifting back the following entries of the cluster
+static void ehash_remove(uint32_t h) {
+    uint32_t mask = gs.ehsize-1;
+    uint32_t j = h;
+    gs.ehash[h] = 0;
+    while (1) {
+        j = (j+1)&mask;
+        if (!gs.ehash[j]) break;
+
+        // home position of the entry - leave it if it is still reachable
+        uint32_t k = EHASH(P(gs.entity)[gs.ehash[j]-1].id)&mask;
+        if ((h<=j) ? (h<k && k<=j) : (h<k || k<=j)) continue;
+
+        gs.ehash[h] = gs.ehash[j];
+        gs.ehash[j] = 0;
+        h = j;
+    }
+}
+
+// rebuild the hash table with a new size
+static void ehash_rebuild(int size) {
+    lh_free(gs.ehash);
+    lh_alloc_num(gs.ehash, size);
+    gs.ehsize = size;
+
     int i;
     for(i=0; i<C(gs.entity); i++)
-        if (P(gs.entity)[i].id == eid)
-            return i;
-    return -1;
+        gs.ehash[ehash_slot(P(gs.entity)[i].id)] = i+1;
+}
+
+static inline int find_entity(int eid) {
+    if (!gs.ehsize) return -1;
+    int32_t i = gs.ehash[ehash_slot(eid)];
+    return i-1;
+}
+
+static void egrid_link(int idx) {
+    entity *e = P(gs.entity)+idx;
+    e->gcell = EGRID_IDX(e->x, e->z);
+    e->gprev = 0;
+    e->gnext = gs.egrid[e->gcell];
+    if (e->gnext) P(gs.entity)[e->gnext-1].gprev = idx+1;
+    gs.egrid[e->gcell] = idx+1;
+}
+
+static void egrid_unlink(int idx) {
+    entity *e = P(gs.entity)+idx;
+    if (e->gprev)
+        P(gs.entity)[e->gprev-1].gnext = e->gnext;
+    else
+        gs.egrid[e->gcell] = e->gnext;
+    if (e->gnext)
+        P(gs.entity)[e->gnext-1].gprev = e->gprev;
+}
+
+// update the grid bucket after the entity has moved
+static void entity_moved(int idx) {
+    entity *e = P(gs.entity)+idx;
+    if (EGRID_IDX(e->x, e->z) == e->gcell) return;
+    egrid_unlink(idx);
+    egrid_link(idx);
+}
+
+static void remove_entity(int idx) {
+    entity *e = P(gs.entity)+idx;
+    free_metadata(e->mdata);
+    egrid_unlink(idx);
+    ehash_remove(ehash_slot(e->id));
+
+    // move the last entity into the freed slot
+    int last = C(gs.entity)-1;
+    if (idx != last) {
+        *e = P(gs.entity)[last];
+        gs.ehash[ehash_slot(e->id)] = idx+1;
+        if (e->gprev)
+            P(gs.entity)[e->gprev-1].gnext = idx+1;
+        else
+            gs.egrid[e->gcell] = idx+1;
+        if (e->gnext)
+            P(gs.entity)[e->gnext-1].gprev = idx+1;
+    }
+    lh_arr_delete(GAR(gs.entity),last);
+}
+
+// add a new tracked entity, replacing one with the same EID
+static entity * new_entity(int32_t eid, double x, double y, double z) {
+    int idx = find_entity(eid);
+    if (idx>=0) remove_entity(idx);
+
+    if ((C(gs.entity)+1)*2 > gs.ehsize)
+        ehash_rebuild(gs.ehsize ? gs.ehsize*2 : 256);
+
+    idx = C(gs.entity);
+    entity *e = lh_arr_new_c(GAR(gs.entity));
+    e->id = eid;
+    e->x  = x;
+    e->y  = y;
+    e->z  = z;
+    gs.ehash[ehash_slot(eid)] = idx+1;
+    egrid_link(idx);
+
+    return e;
+}
+
+// find entities within distance r of a point
+// returns the number of entity indices stored in idx
+int find_entities_in_range(double x, double y, double z, double r, int *idx, int max) {
+    int32_t cxl = ((int32_t)floor(x-r))>>EGRID_CELL, cxh = ((int32_t)floor(x+r))>>EGRID_CELL;
+    int32_t czl = ((int32_t)floor(z-r))>>EGRID_CELL, czh = ((int32_t)floor(z+r))>>EGRID_CELL;
+
+    // the grid wraps around - don't visit any bucket twice
+    if (cxh-cxl > EGRID_MASK) cxh = cxl+EGRID_MASK;
+    if (czh-czl > EGRID_MASK) czh = czl+EGRID_MASK;
+
+    int n=0;
+    int32_t cx,cz;
+    for(cx=cxl; cx<=cxh; cx++) {
+        for(cz=czl; cz<=czh; cz++) {
+            int i = gs.egrid[(cx&EGRID_MASK)|((cz&EGRID_MASK)<<EGRID_BITS)];
+            for(; i; i=P(gs.entity)[i-1].gnext) {
+                entity *e = P(gs.entity)+i-1;
+                if (SQ(e->x-x)+SQ(e->y-y)+SQ(e->z-z) > SQ(r)) continue;
+                if (n>=max) return n;
+                idx[n++] = i-1;
+            }
+        }
+    }
+    return n;
 }
 
 void dump_entities() {
@@ -55,6 +189,239 @@ void dump_entities() {
 ////////////////////////////////////////////////////////////////////////////////
 // chunk storage
 
+// free a tile entity along with the stored container contents
+static void free_tent(gstent *t) {
+    int j;
+    nbt_free(t->nbt);
+    for(j=0; j<C(t->slot); j++)
+        nbt_free(P(t->slot)[j].tag);
+    lh_free(P(t->slot));
+}
+
+static void free_tents(gstent *te, ssize_t n) {
+    int i;
+    for(i=0; i<n; i++)
+        free_tent(te+i);
+    lh_free(te);
+}
+
+static inline void sect_release(gssect *sect) {
+    if (sect && __sync_sub_and_fetch(&sect->refs, 1) == 0)
+        lh_free(sect);
+}
+
+// drop the frozen copy of a section - called whenever the section is modified
+static inline void thaw_section(gschunk *gc, int Y) {
+    sect_release(gc->frozen[Y]);
+    gc->frozen[Y] = NULL;
+}
+
+static void thaw_chunk(gschunk *gc) {
+    int Y;
+    for(Y=0; Y<16; Y++)
+        thaw_section(gc, Y);
+}
+
+// chunks within this distance (in chunks) from the player are never evicted
+#define GS_PIN_RADIUS 8
+
+static inline void lru_unlink(gsworld *w, gschunk *gc) {
+    if (gc->lprev) gc->lprev->lnext = gc->lnext; else w->lru_head = gc->lnext;
+    if (gc->lnext) gc->lnext->lprev = gc->lprev; else w->lru_tail = gc->lprev;
+    gc->lprev = gc->lnext = NULL;
+}
+
+static inline void lru_push(gsworld *w, gschunk *gc) {
+    gc->lprev = NULL;
+    gc->lnext = w->lru_head;
+    if (w->lru_head) w->lru_head->lprev = gc; else w->lru_tail = gc;
+    w->lru_head = gc;
+}
+
+// return the space of a spilled chunk to the free list, merging it
+// with the adjacent free extents
+static void spill_release(gsworld *w, gsspill *sp) {
+    off_t off = sp->off;
+    off_t len = sp->len;
+
+    int i;
+    for(i=C(w->sfree)-1; i>=0; i--) {
+        gsextent *e = P(w->sfree)+i;
+        if (e->off+e->len == off) {
+            off = e->off;
+            len += e->len;
+        }
+        else if (off+len == e->off) {
+            len += e->len;
+        }
+        else
+            continue;
+        lh_arr_delete(GAR(w->sfree), i);
+    }
+
+    gsextent *e = lh_arr_new(GAR(w->sfree));
+    e->off = off;
+    e->len = len;
+
+    lh_clear_obj(*sp);
+
+    // the spill file is discarded once nothing is left in it
+    if (--w->nspilled == 0) {
+        fclose(w->spill);
+        w->spill = NULL;
+        lh_arr_free(GAR(w->sfree));
+    }
+}
+
+// find space for a chunk in the spill file - the smallest free extent
+// it fits into, or the end of the file
+static off_t spill_alloc(gsworld *w, uint32_t len) {
+    int i, best=-1;
+    for(i=0; i<C(w->sfree); i++) {
+        gsextent *e = P(w->sfree)+i;
+        if (e->len >= len && (best<0 || e->len < P(w->sfree)[best].len))
+            best = i;
+    }
+
+    if (best >= 0) {
+        gsextent *e = P(w->sfree)+best;
+        off_t off = e->off;
+        e->off += len;
+        e->len -= len;
+        if (!e->len) lh_arr_delete(GAR(w->sfree), best);
+        return off;
+    }
+
+    if (fseeko(w->spill, 0, SEEK_END)) return -1;
+    return ftello(w->spill);
+}
+
+// buffer for the compressed chunk data
+static uint8_t spillbuf[GSCHUNK_DATASIZE+65536];
+
+// load a chunk evicted to the spill file back into memory
+static gschunk * restore_chunk(gsworld *w, gsregion *region, int32_t ci, int32_t X, int32_t Z) {
+    gsspill *sp = &region->spill[ci];
+
+    gschunk *gc = NULL;
+    if (fseeko(w->spill, sp->off, SEEK_SET)==0 &&
+        fread(spillbuf, 1, sp->len, w->spill) == sp->len) {
+        lh_alloc_obj(gc);
+        ssize_t len = lh_zlib_decode_to(spillbuf, sp->len, (uint8_t *)gc, GSCHUNK_DATASIZE);
+        if (len != GSCHUNK_DATASIZE) lh_free(gc);
+    }
+
+    if (!gc) {
+        printf("Failed to restore spilled chunk %d,%d\n", X, Z);
+        free_tents(P(sp->te), C(sp->te));
+    }
+    else {
+        C(gc->te) = C(sp->te);
+        P(gc->te) = P(sp->te);
+        gc->X = X;
+        gc->Z = Z;
+        region->chunk[ci] = gc;
+        lru_push(w, gc);
+        w->nchunks++;
+    }
+    spill_release(w, sp);
+
+    return gc;
+}
+
+// write a chunk out to the spill file and release its memory
+static int spill_chunk(gsworld *w, gschunk *gc) {
+    if (!w->spill) {
+        w->spill = tmpfile();
+        if (!w->spill) LH_ERROR(0, "Failed to create the chunk spill file\n");
+    }
+
+    ssize_t clen = lh_zlib_encode_to((uint8_t *)gc, GSCHUNK_DATASIZE, spillbuf, sizeof(spillbuf));
+    if (clen <= 0)
+        LH_ERROR(0, "Failed to compress chunk %d,%d\n", gc->X, gc->Z);
+
+    off_t off = spill_alloc(w, (uint32_t)clen);
+    if (off < 0 || fseeko(w->spill, off, SEEK_SET))
+        LH_ERROR(0, "Failed to seek in the chunk spill file\n");
+    if (fwrite(spillbuf, 1, clen, w->spill) != clen)
+        LH_ERROR(0, "Failed to write chunk %d,%d to the spill file\n", gc->X, gc->Z);
+
+    gsregion * region = w->sreg[CC_2(gc->X,gc->Z)]->region[CC_1(gc->X,gc->Z)];
+    int32_t ci = CC_0(gc->X,gc->Z);
+    gsspill *sp = &region->spill[ci];
+    sp->off = off;
+    sp->len = (uint32_t)clen;
+    C(sp->te) = C(gc->te);
+    P(sp->te) = P(gc->te);
+    region->chunk[ci] = NULL;
+
+    lru_unlink(w, gc);
+    w->nchunks--;
+    w->nspilled++;
+    thaw_chunk(gc);
+    lh_free(gc);
+
+    return 1;
+}
+
+// chunks near the player or within the pinned area should stay in memory
+static int chunk_pinned(gsworld *w, gschunk *gc) {
+    if (w != gs.world) return 0;
+
+    int32_t PX = ((int32_t)floor(gs.own.x))>>4;
+    int32_t PZ = ((int32_t)floor(gs.own.z))>>4;
+    if (abs(gc->X-PX) <= GS_PIN_RADIUS && abs(gc->Z-PZ) <= GS_PIN_RADIUS)
+        return 1;
+
+    if (gs.pin.active &&
+        gc->X >= gs.pin.Xmin && gc->X <= gs.pin.Xmax &&
+        gc->Z >= gs.pin.Zmin && gc->Z <= gs.pin.Zmax)
+        return 1;
+
+    return 0;
+}
+
+// spill the least recently used chunks until the storage fits into the budget
+static void evict_chunks(gschunk *keep) {
+    if (!gs.opt.chunk_budget) return;
+
+    int64_t limit = (int64_t)gs.opt.chunk_budget*1048576/sizeof(gschunk);
+    int64_t total = gs.overworld.nchunks+gs.nether.nchunks+gs.end.nchunks;
+    if (total <= limit) return;
+
+    // chunks of the other dimensions go first
+    gsworld *worlds[4] = { &gs.overworld, &gs.nether, &gs.end, gs.world };
+    int i;
+    for(i=0; i<4 && total>limit; i++) {
+        gsworld *w = worlds[i];
+        if (!w || (i<3 && w==gs.world)) continue;
+
+        gschunk *gc = w->lru_tail;
+        while (gc && total>limit) {
+            gschunk *prev = gc->lprev;
+            if (gc != keep && !chunk_pinned(w, gc)) {
+                if (!spill_chunk(w, gc)) return;
+                total--;
+            }
+            gc = prev;
+        }
+    }
+}
+
+// set the area (in block coords) that must stay resident, NULL to clear
+void gs_pin_extent(extent_t *ex) {
+    if (!ex) {
+        gs.pin.active = 0;
+        return;
+    }
+
+    gs.pin.active = 1;
+    gs.pin.Xmin = ex->min.x>>4;
+    gs.pin.Zmin = ex->min.z>>4;
+    gs.pin.Xmax = ex->max.x>>4;
+    gs.pin.Zmax = ex->max.z>>4;
+}
+
 // return pointer to a gschunk with chunk coords X,Z
 // NULL, if chunk, or its region/superregion are not allocated
 gschunk * find_chunk(gsworld *w, int32_t X, int32_t Z, int allocate) {
@@ -77,15 +444,113 @@ gschunk * find_chunk(gsworld *w, int32_t X, int32_t Z, int allocate) {
     gsregion * region = sreg->region[ri];
 
     int32_t ci = CC_0(X,Z);
-    if (!region->chunk[ci]) {
+    gschunk * chunk = region->chunk[ci];
+    if (!chunk && region->spill[ci].len) {
+        chunk = restore_chunk(w, region, ci, X, Z);
+        // the restored chunk counts against the budget like any other
+        if (chunk) evict_chunks(chunk);
+    }
+
+    if (!chunk) {
         if (!allocate) return NULL;
         lh_alloc_obj(region->chunk[ci]);
+        chunk = region->chunk[ci];
+        chunk->X = X;
+        chunk->Z = Z;
+        memset(chunk->height, 0xff, sizeof(chunk->height));
+        lru_push(w, chunk);
+        w->nchunks++;
+    }
+    else if (w->lru_head != chunk) {
+        // mark as most recently used
+        lru_unlink(w, chunk);
+        lru_push(w, chunk);
     }
-    gschunk * chunk = region->chunk[ci];
 
     return chunk;
 }
 
+// return the chunk with chunk coords X,Z stored in a region, restoring it from
+// the spill file if necessary - used instead of region->chunk[] when walking
+// over all chunks of a world, so the spilled chunks are not skipped
+gschunk * region_chunk(gsworld *w, gsregion *region, int32_t X, int32_t Z) {
+    int32_t ci = CC_0(X,Z);
+    if (!region->chunk[ci] && !region->spill[ci].len) return NULL;
+    return find_chunk(w, X, Z, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// surface index
+
+// find the topmost non-air block in a column, starting from y downwards
+static void scan_column(gschunk *gc, int col, int y) {
+    for(; y>=0; y--)
+        if (gc->blocks[y*256+col].raw) break;
+    gc->height[col] = y;
+    gc->surface[col] = (y>=0) ? gc->blocks[y*256+col] : BLOCKTYPE(0,0);
+}
+
+// rebuild the surface index of a chunk after receiving new chunk data
+static void update_surface(gschunk *gc, chunk_t *c, int cont) {
+    // highest section that was sent with this update
+    int top;
+    for(top=15; top>=0 && !c->cubes[top]; top--);
+    if (top<0 && !cont) return;
+
+    // the server heightmap has the highest motion-blocking block of each
+    // column, packed as 9-bit values, 7 per long - nothing below it
+    // needs to be scanned
+    int64_t *hm = NULL;
+    if (c->heightmap) {
+        nbt_t *mb = nbt_hget(c->heightmap, "MOTION_BLOCKING");
+        if (mb && mb->type == NBT_LONG_ARRAY && mb->count >= 37)
+            hm = mb->la;
+    }
+
+    int col;
+    for(col=0; col<256; col++) {
+        // sections not sent in a non-continuous update keep their data
+        int y = top*16+15;
+        if (!cont && gc->height[col] > y) y = gc->height[col];
+
+        int floor = hm ? (int)((hm[col/7]>>((col%7)*9))&0x1ff)-1 : -1;
+        for(; y>floor; y--)
+            if (gc->blocks[y*256+col].raw) break;
+
+        if (y>=0 && !gc->blocks[y*256+col].raw) {
+            // heightmap does not match the block data
+            scan_column(gc, col, y);
+            continue;
+        }
+
+        gc->height[col] = y;
+        gc->surface[col] = (y>=0) ? gc->blocks[y*256+col] : BLOCKTYPE(0,0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// block presence bitmaps
+
+// rebuild the block type presence bitmap of a chunk section
+static void update_presence(gschunk *gc, int Y) {
+    lh_clear_num(gc->bpres[Y], 64);
+
+    bid_t *blocks = gc->blocks+Y*4096;
+    int i;
+    for(i=0; i<4096; i++)
+        GSC_BPRES_SET(gc, Y, blocks[i].bid);
+}
+
+// return a bitmask of sections in the chunk that may contain the block type
+uint16_t chunk_sections_with(gschunk *gc, int bid) {
+    uint16_t mask = 0;
+    int Y;
+    for(Y=0; Y<16; Y++)
+        if (GSC_BPRES_HAS(gc, Y, bid))
+            mask |= (1<<Y);
+    return mask;
+}
+
 // add/replace chunk data, allocating storage if necessary
 // return pointer to the chunk
 static gschunk * insert_chunk(chunk_t *c, int cont) {
@@ -104,16 +569,23 @@ static gschunk * insert_chunk(chunk_t *c, int cont) {
             memset(gc->light+i*2048,    0, 2048*sizeof(light_t));
             memset(gc->skylight+i*2048, 0, 2048*sizeof(light_t));
         }
+        else {
+            continue;
+        }
+        thaw_section(gc, i);
+        update_presence(gc, i);
     }
 
     if (cont)
         memmove(gc->biome, c->biome, 1024);
+
+    update_surface(gc, c, cont);
+
+    evict_chunks(gc);
     return gc;
 }
 
-static void remove_chunk(int32_t X, int32_t Z) {
-    gsworld *w = gs.world;
-
+static void remove_chunk(gsworld *w, int32_t X, int32_t Z) {
     int32_t si = CC_2(X,Z);
     if (!w->sreg[si]) return;
     gssreg * sreg = w->sreg[si];
@@ -123,10 +595,20 @@ static void remove_chunk(int32_t X, int32_t Z) {
     gsregion * region = sreg->region[ri];
 
     int32_t ci = CC_0(X,Z);
-    if (region->chunk[ci])
-        nbt_free(region->chunk[ci]->tent);
+    if (region->chunk[ci]) {
+        free_tents(P(region->chunk[ci]->te), C(region->chunk[ci]->te));
+        thaw_chunk(region->chunk[ci]);
+        lru_unlink(w, region->chunk[ci]);
+        w->nchunks--;
+    }
     lh_free(region->chunk[ci]);
 
+    // drop the spilled copy
+    if (region->spill[ci].len) {
+        free_tents(P(region->spill[ci].te), C(region->spill[ci].te));
+        spill_release(w, &region->spill[ci]);
+    }
+
     //TODO: deallocate regions/superregions that become empty
 }
 
@@ -143,9 +625,12 @@ static void free_chunks(gsworld *w) {
                     gsregion * region = sreg->region[ri];
 
                     for(ci=0; ci<32*32; ci++) {
-                        if (region->chunk[ci])
-                            nbt_free(region->chunk[ci]->tent);
+                        if (region->chunk[ci]) {
+                            free_tents(P(region->chunk[ci]->te), C(region->chunk[ci]->te));
+                            thaw_chunk(region->chunk[ci]);
+                        }
                         lh_free(region->chunk[ci]);
+                        free_tents(P(region->spill[ci].te), C(region->spill[ci].te));
                     }
                     lh_free(region);
                 }
@@ -154,22 +639,49 @@ static void free_chunks(gsworld *w) {
         }
     }
     lh_clear_num(w->sreg, 512*512);
+
+    if (w->spill) fclose(w->spill);
+    w->spill = NULL;
+    lh_arr_free(GAR(w->sfree));
+    w->lru_head = w->lru_tail = NULL;
+    w->nchunks = w->nspilled = 0;
+}
+
+// reduce the chunks of a dimension we are leaving to its cache size,
+// discarding the least recently used ones
+static void trim_world(gsworld *w) {
+    int64_t limit = (int64_t)w->cache*1048576/sizeof(gschunk);
+    if (limit <= 0) {
+        free_chunks(w);
+        return;
+    }
+
+    while (w->nchunks > limit && w->lru_tail)
+        remove_chunk(w, w->lru_tail->X, w->lru_tail->Z);
 }
 
 static void change_dimension(int dimension) {
     //printf("Switching to dimension %d\n",dimension);
 
-    // prune all chunks of the current dimension
-    if (gs.opt.prune_chunks)
-        free_chunks(gs.world);
-
+    gsworld *w = gs.world;
     switch(dimension) {
         case 0:  gs.world = &gs.overworld; break;
         case -1: gs.world = &gs.nether; break;
         case 1:  gs.world = &gs.end; break;
     }
+
+    // keep a limited cache of the dimension we left - respawning in
+    // the same dimension resends all chunks, so it is pruned as before
+    if (gs.opt.prune_chunks && w) {
+        if (w == gs.world)
+            free_chunks(w);
+        else
+            trim_world(w);
+    }
 }
 
+static void remove_tent(gschunk *gc, uint16_t off);
+
 static void modify_blocks(int32_t X, int32_t Z, blkrec *blocks, int32_t count) {
     gschunk * gc = find_chunk(gs.world, X, Z, 1);
     if (!gc) return;
@@ -178,7 +690,28 @@ static void modify_blocks(int32_t X, int32_t Z, blkrec *blocks, int32_t count) {
     for(i=0; i<count; i++) {
         blkrec *b = blocks+i;
         int32_t boff = ((int32_t)b->y<<8)+(b->z<<4)+b->x;
+        bid_t old = gc->blocks[boff];
         gc->blocks[boff] = b->bid;
+        GSC_BPRES_SET(gc, b->y>>4, b->bid.bid);
+        thaw_section(gc, b->y>>4);
+
+        // keep the surface index up to date
+        int col = (b->z<<4)+b->x;
+        if (b->bid.raw) {
+            if (b->y >= gc->height[col]) {
+                gc->height[col] = b->y;
+                gc->surface[col] = b->bid;
+            }
+        }
+        else if (b->y == gc->height[col]) {
+            scan_column(gc, col, b->y-1);
+        }
+
+        // replaced blocks take their tile entities with them - only
+        // a state change of the same block (e.g. facing) keeps them
+        if (C(gc->te) && old.raw != b->bid.raw &&
+            (!b->bid.raw || db_get_blk_default_id(old.raw) != db_get_blk_default_id(b->bid.raw)))
+            remove_tent(gc, (uint16_t)boff);
     }
 }
 
@@ -194,8 +727,7 @@ int get_stored_area(gsworld *w, int32_t *Xmin, int32_t *Xmax, int32_t *Zmin, int
             if (!region) continue;
 
             for(ci=0; ci<32*32; ci++) {
-                gschunk * gc = region->chunk[ci];
-                if (!gc) continue;
+                if (!region->chunk[ci] && !region->spill[ci].len) continue;
 
                 int32_t X = CC_X(si,ri,ci);
                 int32_t Z = CC_Z(si,ri,ci);
@@ -218,234 +750,332 @@ int get_stored_area(gsworld *w, int32_t *Xmin, int32_t *Xmax, int32_t *Zmin, int
     return set;
 }
 
-#if 0
-//DISABLED: transition to dev_3.0, dropping support for the legacy ITEMS table
-
-// Add a tile entity to the chunk data
-int store_tile_entity(int32_t X, int32_t Z, nbt_t *ent) {
-    // remove name from the tile entity - in the ChunkData they are sent with
-    // an empty name (string of zero lenght), but the on-disk anvil format
-    // uses no name (i.e. NULL) and the chunk fails to load otherwise
-    if (ent->name) lh_free(ent->name);
-
-    gschunk * gc = find_chunk(gs.world, X, Z, 0);
-    if (!gc) return 0;
-
-    // allocate TE list if not done yet
-    if (!gc->tent)
-        gc->tent = nbt_new(NBT_LIST, "TileEntities", 0);
+////////////////////////////////////////////////////////////////////////////////
+// tile entities
+
+// find the tile entity at the offset, create if requested
+static gstent * get_tent(gschunk *gc, uint16_t off, int create) {
+    // binary search in the sorted array
+    int l=0, h=C(gc->te);
+    while (l<h) {
+        int m = (l+h)/2;
+        if (P(gc->te)[m].off < off)
+            l = m+1;
+        else
+            h = m;
+    }
+    if (l<C(gc->te) && P(gc->te)[l].off == off)
+        return P(gc->te)+l;
+    if (!create) return NULL;
+
+    // insert a new element at position l
+    lh_arr_new_c(GAR(gc->te));
+    memmove(P(gc->te)+l+1, P(gc->te)+l, (C(gc->te)-l-1)*sizeof(gstent));
+    gstent *t = P(gc->te)+l;
+    lh_clear_ptr(t);
+    t->off = off;
+    return t;
+}
 
-    nbt_t *xc = nbt_hget(ent, "x");
-    nbt_t *yc = nbt_hget(ent, "y");
-    nbt_t *zc = nbt_hget(ent, "z");
-    nbt_t *id = nbt_hget(ent, "id");
-    assert(xc && yc && zc);
+static void remove_tent(gschunk *gc, uint16_t off) {
+    gstent *t = get_tent(gc, off, 0);
+    if (!t) return;
+    int idx = t-P(gc->te);
+    free_tent(t);
+    lh_arr_delete(GAR(gc->te), idx);
+}
 
-    if (!(id)) {
-        //printf("Ignoring incorrect tile entity for chunk %d,%d\n", X, Z);
-        //nbt_dump(ent);
-        nbt_free(ent);
-        return 0;
+// rebuild the bitmap of items stored in the chunk's containers
+static void update_citems(gschunk *gc) {
+    lh_clear_num(gc->citems, 16);
+    int i,j;
+    for(i=0; i<C(gc->te); i++) {
+        gstent *t = P(gc->te)+i;
+        for(j=0; j<C(t->slot); j++) {
+            int item = P(t->slot)[j].item;
+            if (item>=0 && item<1024)
+                gc->citems[item>>6] |= (1ULL<<(item&63));
+        }
     }
+}
 
-    // if an entity with these coordinates is present in the list, replace it
+// set or clear one container slot
+static void set_tent_slot(gstent *t, int sid, int item, int count, nbt_t *tag) {
     int i;
-    for(i=0; i<gc->tent->count; i++) {
-        nbt_t *e = nbt_aget(gc->tent, i);
-        nbt_t *xe = nbt_hget(e, "x");
-        nbt_t *ye = nbt_hget(e, "y");
-        nbt_t *ze = nbt_hget(e, "z");
-        nbt_t *ide = nbt_hget(e, "id");
-        assert(xe && ye && ze && ide);
-
-        if (xe->i==xc->i && ye->i==yc->i && ze->i==zc->i) {
-            if (!strcmp(id->st, ide->st)) {
-                if (!strcmp(id->st, "Chest") ||
-                    !strcmp(id->st, "Trap") ||
-                    !strcmp(id->st, "Hopper") ||
-                    !strcmp(id->st, "Dropper") ||
-                    !strcmp(id->st, "Furnace") ||
-                    !strcmp(id->st, "Cauldron")) {
-                    // skip tile entity updates for chests that would delete old items information
-                    nbt_t *ItemsNew = nbt_hget(ent, "Items");
-                    nbt_t *ItemsOld = nbt_hget(e, "Items");
-                    if ((!ItemsNew || ItemsNew->count == 0) && ItemsOld) {
-                        nbt_free(ent);
-                        return 0;
-                    }
-                }
-            }
-
-            nbt_free(e);
-            gc->tent->li[i] = ent;
-            return 1;
+    for(i=0; i<C(t->slot); i++) {
+        if (P(t->slot)[i].sid == sid) {
+            nbt_free(P(t->slot)[i].tag);
+            lh_arr_delete(GAR(t->slot), i);
+            break;
         }
     }
+    if (item <= 0 || count <= 0) return;
 
-    nbt_add(gc->tent, ent);
-    return 1;
+    gsslot *s = lh_arr_new_c(GAR(t->slot));
+    s->sid   = sid;
+    s->item  = item;
+    s->count = count;
+    s->tag   = nbt_clone(tag);
 }
 
-void update_container(pos_t p, slot_t *slots, int nslots, const char *cid) {
-    int i;
-
-    nbt_t *Items = nbt_new(NBT_LIST, "Items", 0);
+// item ID from a namespaced NBT item name
+static int nbt_item_id(nbt_t *id) {
+    if (!id || id->type != NBT_STRING) return -1;
+    const char *name = id->st;
+    if (!strncmp(name, "minecraft:", 10)) name+=10;
+    int item = db_get_item_id(name);
+    return (item>=0 && item<db_num_items) ? item : -1;
+}
 
-    for(i=0; i<nslots; i++) {
-        if (slots[i].item <= 0) continue; // skip empty slots
-        assert(slots[i].item < db_num_items);
+// add or replace a tile entity, takes the ownership of ent
+static void store_tile_entity(nbt_t *ent) {
+    nbt_t *xc = nbt_hget(ent, "x");
+    nbt_t *yc = nbt_hget(ent, "y");
+    nbt_t *zc = nbt_hget(ent, "z");
+    if (!xc || !yc || !zc) {
+        nbt_free(ent);
+        return;
+    }
 
-        const item_id * iid = ITEMS+slots[i].item;
-        assert(iid->name);
+    // remove name from the tile entity - in the ChunkData they are sent with
+    // an empty name (string of zero lenght), but the on-disk anvil format
+    // uses no name (i.e. NULL) and the chunk fails to load otherwise
+    if (ent->name) lh_free(ent->name);
 
-        char id[256];
-        sprintf(id, "minecraft:");
+    gschunk * gc = find_chunk(gs.world, xc->i>>4, zc->i>>4, 0);
+    if (!gc) {
+        nbt_free(ent);
+        return;
+    }
 
-        char *wpos = id+strlen(id);
-        int j;
-        for(j=0; iid->name[j]; j++)
-            wpos[j] = iid->name[j]==' '?'_':tolower(iid->name[j]);
-        wpos[j] = 0;
+    gstent *t = get_tent(gc, TEOFF(xc->i, yc->i, zc->i), 1);
+
+    // container items are decoded into the slot array - updates without
+    // items keep the previously seen contents
+    nbt_t *Items = nbt_hremove(ent, "Items");
+    if (Items && Items->type == NBT_LIST) {
+        int i;
+        for(i=0; i<C(t->slot); i++)
+            nbt_free(P(t->slot)[i].tag);
+        lh_arr_free(GAR(t->slot));
+
+        for(i=0; i<Items->count; i++) {
+            nbt_t *it = nbt_aget(Items, i);
+            nbt_t *Slot  = nbt_hget(it, "Slot");
+            nbt_t *Count = nbt_hget(it, "Count");
+            int item = nbt_item_id(nbt_hget(it, "id"));
+            if (!Slot || !Count || item<0) continue;
+            set_tent_slot(t, Slot->b, item, Count->b, nbt_hget(it, "tag"));
+        }
+        t->known = 1;
+        update_citems(gc);
+    }
+    nbt_free(Items);
 
-        nbt_t * Item = nbt_new(NBT_COMPOUND, NULL, 4,
-            nbt_new(NBT_BYTE, "Slot", i),
-            nbt_new(NBT_STRING, "id", id),
-            nbt_new(NBT_BYTE, "Count", slots[i].count),
-            nbt_new(NBT_SHORT, "Damage", slots[i].damage));
+    nbt_free(t->nbt);
+    t->nbt = ent;
+}
 
-        if (slots[i].nbt) {
-            nbt_t * tag = nbt_clone(slots[i].nbt);
-            if (tag->name) lh_free(tag->name);
-            tag->name = strdup("tag");
-            nbt_add(Item, tag);
+// build the TileEntities list of a chunk, with container items in NBT form
+nbt_t * chunk_tile_entities(gschunk *gc) {
+    nbt_t *tent = nbt_new(NBT_LIST, "TileEntities", 0);
+
+    int i,j;
+    for(i=0; i<C(gc->te); i++) {
+        gstent *t = P(gc->te)+i;
+        if (!t->nbt) continue;
+        nbt_t *ent = nbt_clone(t->nbt);
+
+        if (t->known) {
+            nbt_t *Items = nbt_new(NBT_LIST, "Items", 0);
+            for(j=0; j<C(t->slot); j++) {
+                gsslot *s = P(t->slot)+j;
+
+                char id[256];
+                sprintf(id, "minecraft:%s", db_get_item_name(s->item));
+                nbt_t * Item = nbt_new(NBT_COMPOUND, NULL, 3,
+                    nbt_new(NBT_BYTE, "Slot", s->sid),
+                    nbt_new(NBT_STRING, "id", id),
+                    nbt_new(NBT_BYTE, "Count", s->count));
+
+                if (s->tag) {
+                    nbt_t * tag = nbt_clone(s->tag);
+                    if (tag->name) lh_free(tag->name);
+                    tag->name = strdup("tag");
+                    nbt_add(Item, tag);
+                }
+                nbt_add(Items, Item);
+            }
+            nbt_add(ent, Items);
         }
 
-        nbt_add(Items, Item);
+        nbt_add(tent, ent);
     }
 
-    nbt_t *Container = nbt_new(NBT_COMPOUND, NULL, 4,
-        nbt_new(NBT_INT, "x", p.x),
-        nbt_new(NBT_INT, "y", p.y),
-        nbt_new(NBT_INT, "z", p.z),
-        nbt_new(NBT_STRING, "id", cid));
+    return tent;
+}
 
-    if (!strcmp(cid, "EnderChest")) {
-        nbt_free(Items);
-    }
-    else {
-        nbt_add(Container, Items);
-        nbt_add(Container, nbt_new(NBT_STRING, "Lock", ""));
-        if (!strcmp(cid, "Hopper")) {
-            nbt_add(Container, nbt_new(NBT_INT, "TransferCooldown", 0));
-        }
+// add the containers among the tile entities holding the item
+static int find_item_tents(gstent *te, ssize_t nte, int32_t X, int32_t Z,
+                           int item, pos_t *pos, int *count, int n, int max) {
+    int i,j;
+    for(i=0; i<nte && n<max; i++) {
+        gstent *t = te+i;
+        int sum = 0;
+        for(j=0; j<C(t->slot); j++)
+            if (P(t->slot)[j].item == item)
+                sum += P(t->slot)[j].count;
+        if (!sum) continue;
+
+        pos[n] = POS((X<<4)+(t->off&15), t->off>>8, (Z<<4)+((t->off>>4)&15));
+        count[n] = sum;
+        n++;
     }
-
-    store_tile_entity(p.x>>4, p.z>>4, Container);
+    return n;
 }
 
-void update_container_items(SP_WindowItems_pkt *wi) {
-    // cb is the block the player clicked at
-    bid_t cb = get_block_at(gs.inv.wpos.x, gs.inv.wpos.z, gs.inv.wpos.y);
-    switch (cb.bid) {
-        case 0x36:
-        case 0x92: { // Chest or Trapped Chest
-            // for chests we need to check if there's a second block next to it
-            pos_t p1 = gs.inv.wpos;
-            int secondary_present = 1;
-            pos_t p2 = gs.inv.wpos;
+// find containers in the stored chunks holding the item
+// returns the number of containers stored in pos, with the item amount in count
+int find_stored_item(int item, pos_t *pos, int *count, int max) {
+    if (item<0 || item>=1024) return 0;
 
-            bid_t nn = get_block_at(p1.x, p1.z-1, p1.y);
-            bid_t ns = get_block_at(p1.x, p1.z+1, p1.y);
-            bid_t ne = get_block_at(p1.x+1, p1.z, p1.y);
-            bid_t nw = get_block_at(p1.x-1, p1.z, p1.y);
+    int n=0;
+    gschunk *gc;
+    for(gc=gs.world->lru_head; gc && n<max; gc=gc->lnext) {
+        if (!(gc->citems[item>>6] & (1ULL<<(item&63)))) continue;
+        n = find_item_tents(P(gc->te), C(gc->te), gc->X, gc->Z, item, pos, count, n, max);
+    }
 
-            bid_t cn = BLOCKTYPE(0,0);
+    // evicted chunks keep their tile entities in memory
+    int si,ri,ci;
+    for(si=0; si<512*512 && n<max && gs.world->nspilled; si++) {
+        gssreg * sreg = gs.world->sreg[si];
+        if (!sreg) continue;
 
-            switch (cb.meta) {
-                case 2: // facing north/south
-                case 3:
-                    if (ne.bid == cb.bid) {
-                        p2.x++;
-                    }
-                    else if (nw.bid == cb.bid) {
-                        p1.x--;
-                    }
-                    else {
-                        secondary_present = 0;
-                    }
-                    break;
-                case 4: // facing west/east
-                case 5:
-                    if (ns.bid == cb.bid) {
-                        p2.z++;
-                    }
-                    else if (nn.bid == cb.bid) {
-                        p1.z--;
-                    }
-                    else {
-                        secondary_present = 0;
-                    }
-                    break;
-            }
+        for(ri=0; ri<256*256 && n<max; ri++) {
+            gsregion * region = sreg->region[ri];
+            if (!region) continue;
 
-            cb = get_block_at(p1.x, p1.z, p1.y);
-            cn = get_block_at(p2.x, p2.z, p2.y);
-            if (cb.meta != cn.meta) {
-                printf("Warning: Glitched chest at %d,%d/%d\n", p1.x, p1.z, p1.y);
-                return;
+            for(ci=0; ci<32*32 && n<max; ci++) {
+                gsspill *sp = &region->spill[ci];
+                if (!sp->len || !C(sp->te)) continue;
+                n = find_item_tents(P(sp->te), C(sp->te), CC_X(si,ri,ci), CC_Z(si,ri,ci),
+                                    item, pos, count, n, max);
             }
-
-            update_container(p1, &wi->slots[0], 27, "Chest");
-            if (secondary_present)
-                update_container(p2, &wi->slots[27], 27, "Chest");
-
-            break;
         }
-        case 0x17: // Dispenser
-            update_container(gs.inv.wpos, &wi->slots[0], 9, "Trap");
-            break;
+    }
 
-        case 0x3d:
-        case 0x3e:// Furnace
-            update_container(gs.inv.wpos, &wi->slots[0], 3, "Furnace");
-            break;
+    return n;
+}
 
-        case 0x75: // Brewing Stand
-            update_container(gs.inv.wpos, &wi->slots[0], 5, "Cauldron");
-            break;
+// window types whose contents stay stored in the block
+static int storage_window(uint32_t wtype) {
+    switch (wtype) {
+        case 0 ... 6:   // generic_9xN, generic_3x3
+        case 9:         // blast_furnace
+        case 10:        // brewing_stand
+        case 13:        // furnace
+        case 15:        // hopper
+        case 19:        // shulker_box
+        case 21:        // smoker
+            return 1;
+    }
+    return 0;
+}
 
-        case 0x9a: // Hopper
-            update_container(gs.inv.wpos, &wi->slots[0], 5, "Hopper");
-            break;
+// determine the container block(s) of the open window
+// returns the number of blocks (two for double chests), 0 if not a stored container
+static int container_target(int nslots, pos_t *pos) {
+    if (!storage_window(gs.inv.wtype)) return 0;
+
+    pos_t p = gs.inv.wpos;
+    bid_t cb = get_block_at(p.x, p.z, p.y);
+    if (!cb.raw) return 0;
+
+    // the block the player clicked last must be the container
+    const char *name = db_get_blk_name(cb.raw);
+    if (!strcmp(name, "ender_chest")) return 0; // contents are per player
+    int item = db_get_item_id_from_blk_id(cb.raw);
+    if (item<0 || item>=db_num_items || !db_item_is_container(item)) return 0;
+
+    pos[0] = p;
+    const char *type = db_get_blk_propval(cb.raw, "type");
+    if (nslots != 54 || !type || !strcmp(type, "single")) return 1;
+
+    // double chest - the other half is clockwise from the facing direction
+    // for a left chest, and the right half holds the first 27 slots
+    const char *facing = db_get_blk_propval(cb.raw, "facing");
+    if (!facing) return 0;
+    int dx=0, dz=0;
+    switch (facing[0]) {
+        case 'n': dx = 1;  break;
+        case 'e': dz = 1;  break;
+        case 's': dx = -1; break;
+        case 'w': dz = -1; break;
+    }
+    int right = !strcmp(type, "right");
+    if (right) { dx=-dx; dz=-dz; }
+    pos_t p2 = POS(p.x+dx, p.y, p.z+dz);
 
-        case 0x9e: // Dropper
-            update_container(gs.inv.wpos, &wi->slots[0], 9, "Dropper");
-            break;
+    pos[0] = right ? p  : p2;
+    pos[1] = right ? p2 : p;
+    return 2;
+}
 
-        default:
-            // TODO: support other types of containers
-            return;
+// drop the tile entities whose block no longer exists
+static void prune_tile_entities(gschunk *gc) {
+    if (!gc) return;
+    int i, mod=0;
+    for(i=C(gc->te)-1; i>=0; i--) {
+        uint16_t off = P(gc->te)[i].off;
+        if (gc->blocks[off].raw) continue;
+        free_tent(P(gc->te)+i);
+        lh_arr_delete(GAR(gc->te), i);
+        mod = 1;
     }
+    if (mod) update_citems(gc);
 }
 
-void update_chunk_containers(gschunk *gc, int X, int Z) {
-    int i;
-    for(i=0; i<65536; i++) {
-        pos_t pos = POS((X<<4)+(i&15),i>>8,(Z<<4)+((i>>4)&15));
-        switch(gc->blocks[i].bid) {
-            case  54:
-            case 146: update_container(pos, NULL, 0, "Chest"); break;
-            case  23: update_container(pos, NULL, 0, "Trap"); break;
-            case 154: update_container(pos, NULL, 0, "Hopper"); break;
-            case 158: update_container(pos, NULL, 0, "Dropper"); break;
-            case  61:
-            case  62: update_container(pos, NULL, 0, "Furnace"); break;
-            case 117: update_container(pos, NULL, 0, "Cauldron"); break;
-            case 130: update_container(pos, NULL, 0, "EnderChest"); break;
+static gstent * container_tent(pos_t p) {
+    gschunk *gc = find_chunk(gs.world, p.x>>4, p.z>>4, 0);
+    if (!gc) return NULL;
+    return get_tent(gc, TEOFF(p.x, p.y, p.z), 1);
+}
+
+// store the container contents from the window items
+static void update_container_items(SP_WindowItems_pkt *wi) {
+    pos_t pos[2];
+    int n = container_target(gs.inv.woffset, pos);
+    int nslots = (n==2) ? 27 : gs.inv.woffset;
+    if (nslots > wi->count) return;
+
+    int h,i;
+    for(h=0; h<n; h++) {
+        gstent *t = container_tent(pos[h]);
+        if (!t) continue;
+
+        for(i=0; i<nslots; i++) {
+            slot_t *s = &wi->slots[h*27+i];
+            set_tent_slot(t, i, s->item, s->count, s->nbt);
         }
+        t->known = 1;
+        update_citems(find_chunk(gs.world, pos[h].x>>4, pos[h].z>>4, 0));
     }
 }
-#endif
+
+// update a single container slot
+static void update_container_slot(int sid, slot_t *s) {
+    pos_t pos[2];
+    int n = container_target(gs.inv.woffset, pos);
+    if (!n || sid<0 || sid>=gs.inv.woffset) return;
+
+    int h = (n==2 && sid>=27) ? 1 : 0;
+    gstent *t = container_tent(pos[h]);
+    if (!t) return;
+
+    set_tent_slot(t, sid-h*27, s->item, s->count, s->nbt);
+    update_citems(find_chunk(gs.world, pos[h].x>>4, pos[h].z>>4, 0));
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -496,6 +1126,138 @@ cuboid_t export_cuboid_extent(extent_t ex) {
     return c;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// snapshots
+
+// get a shared copy of a chunk section, NULL if the section is empty
+static gssect * freeze_section(gschunk *gc, int Y) {
+    if (!gc->frozen[Y]) {
+        bid_t *blocks = gc->blocks+Y*4096;
+        int i;
+        for(i=0; i<4096 && !blocks[i].raw; i++);
+        if (i==4096) return NULL;
+
+        lh_alloc_obj(gc->frozen[Y]);
+        gc->frozen[Y]->refs = 1;
+        memmove(gc->frozen[Y]->blocks, blocks, sizeof(gc->frozen[Y]->blocks));
+    }
+
+    __sync_add_and_fetch(&gc->frozen[Y]->refs, 1);
+    return gc->frozen[Y];
+}
+
+static void snap_add_chunk(gssnap *sn, gschunk *gc) {
+    gssnapchunk *sc = lh_arr_new(GAR(sn->chunk));
+    sc->X = gc->X;
+    sc->Z = gc->Z;
+    int Y;
+    for(Y=0; Y<16; Y++)
+        sc->sect[Y] = freeze_section(gc, Y);
+}
+
+static int cmp_snapchunk(const void *a, const void *b) {
+    const gssnapchunk *ca = a, *cb = b;
+    if (ca->Z != cb->Z) return (ca->Z < cb->Z) ? -1 : 1;
+    if (ca->X != cb->X) return (ca->X < cb->X) ? -1 : 1;
+    return 0;
+}
+
+// create a snapshot of the chunks within the extent, or all resident
+// chunks if ex is NULL - only the sections modified since the last
+// snapshot are copied
+gssnap * gs_snapshot(extent_t *ex) {
+    lh_create_obj(gssnap, sn);
+    sn->x = gs.own.x;
+    sn->y = gs.own.y;
+    sn->z = gs.own.z;
+
+    if (ex) {
+        int32_t X,Z;
+        for(Z=ex->min.z>>4; Z<=ex->max.z>>4; Z++) {
+            for(X=ex->min.x>>4; X<=ex->max.x>>4; X++) {
+                gschunk *gc = find_chunk(gs.world, X, Z, 0);
+                if (gc) snap_add_chunk(sn, gc);
+            }
+        }
+    }
+    else {
+        gschunk *gc;
+        for(gc=gs.world->lru_head; gc; gc=gc->lnext)
+            snap_add_chunk(sn, gc);
+    }
+
+    qsort(P(sn->chunk), C(sn->chunk), sizeof(gssnapchunk), cmp_snapchunk);
+    return sn;
+}
+
+// release the snapshot - may be called from any thread
+void gs_snapshot_free(gssnap *sn) {
+    if (!sn) return;
+
+    int i,Y;
+    for(i=0; i<C(sn->chunk); i++)
+        for(Y=0; Y<16; Y++)
+            sect_release(P(sn->chunk)[i].sect[Y]);
+    lh_arr_free(GAR(sn->chunk));
+    lh_free(sn);
+}
+
+static gssnapchunk * snap_chunk(gssnap *sn, int32_t X, int32_t Z) {
+    gssnapchunk key = { .X=X, .Z=Z };
+    return bsearch(&key, P(sn->chunk), C(sn->chunk), sizeof(gssnapchunk), cmp_snapchunk);
+}
+
+bid_t snap_get_block(gssnap *sn, int32_t x, int32_t z, int32_t y) {
+    if (y<0 || y>255) return BLOCKTYPE(0,0);
+    gssnapchunk *sc = snap_chunk(sn, x>>4, z>>4);
+    if (!sc || !sc->sect[y>>4]) return BLOCKTYPE(0,0);
+
+    return sc->sect[y>>4]->blocks[(y&15)*256+(z&15)*16+(x&15)];
+}
+
+// same as export_cuboid_extent, but from a snapshot
+cuboid_t snap_export_cuboid(gssnap *sn, extent_t ex) {
+    int X,Z,y,k;
+
+    int32_t Xl=ex.min.x>>4, Xh=ex.max.x>>4, Xs=Xh-Xl+1;
+    int32_t Zl=ex.min.z>>4, Zh=ex.max.z>>4, Zs=Zh-Zl+1;
+    int32_t yl=ex.min.y,    yh=ex.max.y,    ys=yh-yl+1;
+
+    cuboid_t c;
+    lh_clear_obj(c);
+    c.sr = (size3_t) { ex.max.x-ex.min.x+1, ex.max.y-ex.min.y+1, ex.max.z-ex.min.z+1 };
+    c.sa = (size3_t) { Xs*16, ys, Zs*16 };
+    c.boff = (ex.min.x-Xl*16) + (ex.min.z-Zl*16)*(Xs*16);
+
+    for(y=0; y<ys; y++) {
+        lh_alloc_num(c.data[y],Xs*Zs*256);
+    }
+
+    for(X=Xl; X<=Xh; X++) {
+        for(Z=Zl; Z<=Zh; Z++) {
+            gssnapchunk *sc = snap_chunk(sn, X, Z);
+            if (!sc) continue;
+
+            int boff = (X-Xl)*16 + (Z-Zl)*16*c.sa.x;
+
+            for(y=0; y<ys; y++) {
+                gssect *sect = sc->sect[(y+yl)>>4];
+                if (!sect) continue; // empty section, data is already zeroed
+
+                int yoff = ((y+yl)&15)*256;
+                for(k=0; k<16; k++) {
+                    memcpy(c.data[y]+boff+k*c.sa.x, sect->blocks+yoff, 16*sizeof(bid_t));
+                    yoff += 16;
+                }
+            }
+        }
+    }
+
+    return c;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 // get just a single block value at given coordinates
 bid_t get_block_at(int32_t x, int32_t z, int32_t y) {
     gschunk *gc = find_chunk(gs.world, x>>4, z>>4, 0);
@@ -504,6 +1266,15 @@ bid_t get_block_at(int32_t x, int32_t z, int32_t y) {
     return gc->blocks[y*256+(z&15)*16+(x&15)];
 }
 
+// get the height of the topmost non-air block at given coordinates
+// -1 if the column is empty or the chunk is not loaded
+int get_height_at(int32_t x, int32_t z) {
+    gschunk *gc = find_chunk(gs.world, x>>4, z>>4, 0);
+    if (!gc) return -1;
+
+    return gc->height[(z&15)*16+(x&15)];
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Inventory tracking
 
@@ -1128,11 +1899,7 @@ void gs_packet(MCPacket *pkt) {
         // Entities tracking
 
         GSP(SP_SpawnPlayer) {
-            entity *e = lh_arr_new_c(GAR(gs.entity));
-            e->id = tpkt->eid;
-            e->x  = tpkt->x;
-            e->y  = tpkt->y;
-            e->z  = tpkt->z;
+            entity *e = new_entity(tpkt->eid, tpkt->x, tpkt->y, tpkt->z);
             e->type = ENTITY_PLAYER;
             e->mtype = Player;
             //TODO: name
@@ -1141,11 +1908,7 @@ void gs_packet(MCPacket *pkt) {
         } _GSP;
 
         GSP(SP_SpawnMob) {
-            entity *e = lh_arr_new_c(GAR(gs.entity));
-            e->id = tpkt->eid;
-            e->x  = tpkt->x;
-            e->y  = tpkt->y;
-            e->z  = tpkt->z;
+            entity *e = new_entity(tpkt->eid, tpkt->x, tpkt->y, tpkt->z);
             e->type = ENTITY_MOB;
 
             e->mtype = tpkt->mobtype;
@@ -1175,17 +1938,12 @@ void gs_packet(MCPacket *pkt) {
             for(i=0; i<tpkt->count; i++) {
                 int idx = find_entity(tpkt->eids[i]);
                 if (idx<0) continue;
-                free_metadata(P(gs.entity)[idx].mdata);
-                lh_arr_delete(GAR(gs.entity),idx);
+                remove_entity(idx);
             }
         } _GSP;
 
         GSP(SP_SpawnObject) {
-            entity *e = lh_arr_new_c(GAR(gs.entity));
-            e->id = tpkt->eid;
-            e->x  = tpkt->x;
-            e->y  = tpkt->y;
-            e->z  = tpkt->z;
+            entity *e = new_entity(tpkt->eid, tpkt->x, tpkt->y, tpkt->z);
             e->type = ENTITY_OBJECT;
             //e->mtype = tpkt->objtype+256; // +256 for object entities
             e->mtype = tpkt->objtype; //update for 16.2 i think it works better if we dont add 256
@@ -1193,22 +1951,15 @@ void gs_packet(MCPacket *pkt) {
         } _GSP;
 
         GSP(SP_SpawnExperienceOrb) {
-            entity *e = lh_arr_new_c(GAR(gs.entity));
-            e->id = tpkt->eid;
-            e->x  = tpkt->x;
-            e->y  = tpkt->y;
-            e->z  = tpkt->z;
+            entity *e = new_entity(tpkt->eid, tpkt->x, tpkt->y, tpkt->z);
             e->type = ENTITY_OTHER;
             e->mtype = ExperienceOrb;
             e->mdata = NULL;
         } _GSP;
 
         GSP(SP_SpawnPainting) {
-            entity *e = lh_arr_new_c(GAR(gs.entity));
-            e->id = tpkt->eid;
-            e->x  = (double)tpkt->pos.x;
-            e->y  = (double)tpkt->pos.y;
-            e->z  = (double)tpkt->pos.z;
+            entity *e = new_entity(tpkt->eid, (double)tpkt->pos.x,
+                                   (double)tpkt->pos.y, (double)tpkt->pos.z);
             e->type = ENTITY_OTHER;
             e->mtype = Painting;
             e->mdata = NULL;
@@ -1221,6 +1972,7 @@ void gs_packet(MCPacket *pkt) {
             e->x += ((double)tpkt->dx)/4096.0;
             e->y += ((double)tpkt->dy)/4096.0;
             e->z += ((double)tpkt->dz)/4096.0;
+            entity_moved(idx);
         } _GSP;
 
         GSP(SP_EntityLookRelMove) {
@@ -1230,6 +1982,7 @@ void gs_packet(MCPacket *pkt) {
             e->x += ((double)tpkt->dx)/4096.0;
             e->y += ((double)tpkt->dy)/4096.0;
             e->z += ((double)tpkt->dz)/4096.0;
+            entity_moved(idx);
         } _GSP;
 
         GSP(SP_EntityTeleport) {
@@ -1239,6 +1992,7 @@ void gs_packet(MCPacket *pkt) {
             e->x = tpkt->x;
             e->y = tpkt->y;
             e->z = tpkt->z;
+            entity_moved(idx);
         } _GSP;
 
         GSP(SP_EntityMetadata) {
@@ -1322,6 +2076,18 @@ void gs_packet(MCPacket *pkt) {
             gs.own.saturation = tpkt->saturation;
         } _GSP;
 
+        GSP(SP_TimeUpdate) {
+            // the server sends the world age every 20 ticks
+            uint64_t ts = gettimestamp();
+            if (gs.tick.ts && ts > gs.tick.ts && tpkt->worldage > gs.tick.age) {
+                float tps = (float)(tpkt->worldage-gs.tick.age)*1000000/(ts-gs.tick.ts);
+                if (tps > 20) tps = 20;
+                gs.tick.tps = gs.tick.tps ? gs.tick.tps*0.75+tps*0.25 : tps;
+            }
+            gs.tick.age = tpkt->worldage;
+            gs.tick.ts  = ts;
+        } _GSP;
+
         GSP(CP_EntityAction) {
             if (tpkt->eid == gs.own.eid) {
                 switch (tpkt->action) {
@@ -1345,22 +2111,22 @@ void gs_packet(MCPacket *pkt) {
             for(i=0; i<tpkt->te->count; i++) {
                 nbt_t *te = nbt_aget(tpkt->te, i);
                 assert(te->type == NBT_COMPOUND);
-                //DISABLED: transition to dev_3.0
-                //store_tile_entity(tpkt->chunk.X, tpkt->chunk.Z, nbt_clone(te));
+                store_tile_entity(nbt_clone(te));
             }
+
+            // full chunk - tile entities of removed blocks are gone
+            if (tpkt->cont)
+                prune_tile_entities(find_chunk(gs.world, tpkt->chunk.X, tpkt->chunk.Z, 0));
         } _GSP;
 
-#if 0
-        //DISABLED: transition to dev_3.0
         GSP(SP_UpdateBlockEntity) {
-            nbt_t *te = tpkt->nbt;
-            store_tile_entity(tpkt->loc.x>>4, tpkt->loc.z>>4, nbt_clone(te));
+            if (tpkt->nbt)
+                store_tile_entity(nbt_clone(tpkt->nbt));
         } _GSP;
-#endif
 
         GSP(SP_UnloadChunk) {
             if (gs.opt.prune_chunks)
-                remove_chunk(tpkt->X,tpkt->Z);
+                remove_chunk(gs.world, tpkt->X,tpkt->Z);
         } _GSP;
 
         GSP(SP_BlockChange) {
@@ -1461,6 +2227,9 @@ void gs_packet(MCPacket *pkt) {
                         printf("\n");
                     }
 
+                    // keep the stored container contents up to date
+                    if (tpkt->wid == gs.inv.wid && tpkt->sid < gs.inv.woffset)
+                        update_container_slot(tpkt->sid, &tpkt->slot);
                 }
             }
         } _GSP;
@@ -1707,9 +2476,8 @@ void gs_packet(MCPacket *pkt) {
                 printf("*** WindowItems, woffset=%d, ioffset=%d, nslots=%d tpkt->count=%d\n",
                        woffset, ioffset, nslots, tpkt->count);
 
-            //DISABLED: transition to dev_3.0
-            //if (tpkt->wid!=0 && tpkt->wid!=255)
-            //    update_container_items(tpkt);
+            if (tpkt->wid!=0 && tpkt->wid!=255 && tpkt->wid==gs.inv.wid)
+                update_container_items(tpkt);
 
             int i;
             for(i=0; i<nslots; i++) {
@@ -1767,6 +2535,7 @@ void gs_destroy() {
     for(i=0; i<C(gs.entity); i++)
         free_metadata(P(gs.entity)[i].mdata);
     lh_free(P(gs.entity));
+    lh_free(gs.ehash);
 
     for(i=0; i<64; i++)
         clear_slot(&gs.inv.slots[i]);
@@ -1814,6 +2583,19 @@ int gs_setopt(int optid, int value) {
         case GSOP_ZMAX:
             gs.zmax = value;
             break;
+        case GSOP_CHUNK_BUDGET:
+            gs.opt.chunk_budget = value;
+            evict_chunks(NULL);
+            break;
+        case GSOP_CACHE_OVERWORLD:
+            gs.overworld.cache = value;
+            break;
+        case GSOP_CACHE_NETHER:
+            gs.nether.cache = value;
+            break;
+        case GSOP_CACHE_END:
+            gs.end.cache = value;
+            break;
 
         default:
             LH_ERROR(-1,"Unknown option ID %d\n", optid);
@@ -1832,6 +2614,19 @@ int gs_getopt(int optid) {
             return gs.opt.track_entities;
         case GSOP_TRACK_INVENTORY:
             return gs.opt.track_entities;
+        case GSOP_CHUNK_BUDGET:
+            return gs.opt.chunk_budget;
+        case GSOP_CHUNK_USAGE:
+            return (int)((int64_t)(gs.overworld.nchunks+gs.nether.nchunks+gs.end.nchunks)
+                         *sizeof(gschunk)/1024);
+        case GSOP_CHUNK_SPILLED:
+            return gs.overworld.nspilled+gs.nether.nspilled+gs.end.nspilled;
+        case GSOP_CACHE_OVERWORLD:
+            return gs.overworld.cache;
+        case GSOP_CACHE_NETHER:
+            return gs.nether.cache;
+        case GSOP_CACHE_END:
+            return gs.end.cache;
 
         default:
             LH_ERROR(-1,"Unknown option ID %d\n", optid);
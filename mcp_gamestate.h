@@ -10,8 +10,12 @@
 
 #pragma once
 
+#include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <math.h>
+#include <sys/types.h>
 
 #include "mcp_packet.h"
 #include "mcp_ids.h"
@@ -29,6 +33,12 @@
 #define GSOP_ZMIN               7
 #define GSOP_XMAX               8
 #define GSOP_ZMAX               9
+#define GSOP_CHUNK_BUDGET      10   // chunk storage budget in MB, 0=unlimited
+#define GSOP_CHUNK_USAGE       11   // (read-only) memory used by resident chunks, in kB
+#define GSOP_CHUNK_SPILLED     12   // (read-only) number of chunks spilled to disk
+#define GSOP_CACHE_OVERWORLD   13   // chunks retained in MB when leaving the dimension
+#define GSOP_CACHE_NETHER      14   //   with chunk pruning enabled, 0=discard all
+#define GSOP_CACHE_END         15
 
 ////////////////////////////////////////////////////////////////////////////////
 // entity tracking
@@ -58,8 +68,19 @@ typedef struct _entity {
     uint64_t lasthit;   // timestamp when this entity was last attacked - for limiting the attack rate
     char     name[256]; // only valid for players
     metadata *mdata;    // entity metadata
+
+    int      gcell;     // spatial grid bucket
+    int      gprev;     // previous/next entity in the same grid bucket
+    int      gnext;     // (index+1, 0 if none)
 } entity;
 
+// spatial grid - 32x32 buckets of 16x16 block cells, wrapping around
+#define EGRID_BITS  5
+#define EGRID_CELL  4
+#define EGRID_MASK  ((1<<EGRID_BITS)-1)
+#define EGRID_IDX(x,z) ( ((((int32_t)floor(x))>>EGRID_CELL)&EGRID_MASK) | \
+                         (((((int32_t)floor(z))>>EGRID_CELL)&EGRID_MASK)<<EGRID_BITS) )
+
 ////////////////////////////////////////////////////////////////////////////////
 // player list
 
@@ -69,17 +90,79 @@ typedef struct {
     char       *dispname;
 } pli;
 
+////////////////////////////////////////////////////////////////////////////////
+// tile entities
+
+// container slot - only non-empty slots are stored
+typedef struct {
+    uint8_t     sid;        // slot number in the container
+    int8_t      count;
+    int16_t     item;       // item ID
+    nbt_t      *tag;        // extra item data (enchantments etc.), NULL if none
+} gsslot;
+
+// tile entity stored with a chunk
+typedef struct {
+    uint16_t    off;        // block offset in the chunk, as in gschunk.blocks
+    nbt_t      *nbt;        // tile entity data, without the container items
+    int         known;      // container contents were seen
+    lh_arr_declare(gsslot, slot); // container contents
+} gstent;
+
+// block coords -> tile entity offset in the chunk
+#define TEOFF(x,y,z) ((uint16_t)((((y)&0xff)<<8)|(((z)&15)<<4)|((x)&15)))
+
 ////////////////////////////////////////////////////////////////////////////////
 // chunk storage
 
+// immutable copy of a chunk section, shared between the chunk and snapshots
 typedef struct {
+    int32_t     refs;           // reference count, modified atomically
+    bid_t       blocks[4096];
+} gssect;
+
+typedef struct _gschunk {
     bid_t       blocks[65536];
     light_t     light[32768];
     light_t     skylight[32768];
     uint8_t     biome[1024];
-    nbt_t      *tent;
+
+    // surface index - topmost non-air block in each column (offset z*16+x)
+    int16_t     height[256];    // -1 if the column is empty
+    bid_t       surface[256];
+
+    // block type presence per section, one bit per block ID (bid_t.bid)
+    // a set bit means the section may contain blocks of this type
+    uint64_t    bpres[16][64];
+
+    // items stored in the containers of this chunk, one bit per item ID
+    uint64_t    citems[16];
+
+    // tile entities, sorted by offset - kept in memory when the chunk is spilled
+    lh_arr_declare(gstent, te);
+
+    // LRU tracking for the chunk storage budget
+    int32_t     X,Z;
+    struct _gschunk *lprev, *lnext;
+
+    // frozen copies of unmodified sections, handed out to snapshots
+    // dropped when the section is modified, NULL if none
+    gssect     *frozen[16];
 } gschunk;
 
+#define GSC_BPRES_SET(gc,Y,b)   ((gc)->bpres[Y][(b)>>6] |= (1ULL<<((b)&63)))
+#define GSC_BPRES_HAS(gc,Y,b)   (((gc)->bpres[Y][(b)>>6]>>((b)&63))&1)
+
+// size of the chunk data written to the spill file
+#define GSCHUNK_DATASIZE offsetof(gschunk, C(te))
+
+// location of a chunk evicted to the spill file
+typedef struct {
+    off_t       off;            // offset in the spill file
+    uint32_t    len;            // compressed length, 0 if not spilled
+    lh_arr_declare(gstent, te); // tile entities are kept in memory
+} gsspill;
+
 // chunk coord -> offset within region (1x1 regions, 32x32 chunks, 512x512 blocks)
 #define CC_0(X,Z)   (uint32_t)((((uint64_t)(X))&0x1f)|((((uint64_t)(Z))&0x1f)<<5))
 
@@ -96,16 +179,45 @@ typedef struct {
 
 typedef struct {
     gschunk *chunk[32*32];
+    gsspill spill[32*32];
 } gsregion;
 
 typedef struct {
     gsregion *region[256*256];
 } gssreg;
 
+// unused space in the spill file
+typedef struct {
+    off_t       off;
+    off_t       len;
+} gsextent;
+
 typedef struct {
     gssreg *sreg[512*512];
+
+    // resident chunks, most recently used first
+    gschunk *lru_head, *lru_tail;
+    int     nchunks;            // number of resident chunks
+    int     nspilled;           // number of chunks in the spill file
+    FILE   *spill;              // spill file, created on first eviction
+    lh_arr_declare(gsextent, sfree); // freed extents in the spill file
+    int     cache;              // MB of chunks kept when leaving the dimension
 } gsworld;
 
+// chunk in a snapshot
+typedef struct {
+    int32_t     X,Z;
+    gssect     *sect[16];       // NULL for empty sections
+} gssnapchunk;
+
+// read-only view of the world at a point in time, safe to use from
+// other threads - the sections are shared with the live state and
+// between the snapshots as long as they are not modified
+typedef struct {
+    double      x,y,z;          // player position
+    lh_arr_declare(gssnapchunk, chunk); // sorted by Z,X
+} gssnap;
+
 ////////////////////////////////////////////////////////////////////////////////
 
 typedef struct _gamestate {
@@ -119,8 +231,15 @@ typedef struct _gamestate {
         int track_entities;
         int track_inventory;
         int region_limit;
+        int chunk_budget;       // in MB, 0=unlimited
     } opt;
 
+    // chunk area (in chunk coords) that must stay resident, e.g. the buildtask
+    struct {
+        int         active;
+        int32_t     Xmin,Zmin,Xmax,Zmax;
+    } pin;
+
     struct {
         uint32_t    eid;
         uuid_t      uuid;
@@ -142,6 +261,13 @@ typedef struct _gamestate {
         float       saturation;
     } own;
 
+    // server tick rate, estimated from SP_TimeUpdate
+    struct {
+        int64_t     age;        // world age from the last update
+        uint64_t    ts;         // timestamp of the last update
+        float       tps;        // smoothed ticks per second, 0 if not known yet
+    } tick;
+
     struct {
         uint8_t     held;
         slot_t      slots[64];
@@ -163,6 +289,9 @@ typedef struct _gamestate {
 
     // tracked entities
     lh_arr_declare(entity, entity);
+    int32_t        *ehash;      // EID -> entity index+1, open addressing
+    int             ehsize;     // size of the hash table, power of 2
+    int32_t         egrid[1<<(2*EGRID_BITS)]; // first entity in each grid bucket (index+1)
 
     lh_arr_declare(pli, players);
 
@@ -186,14 +315,24 @@ int  gs_getopt(int optid);
 void gs_packet(MCPacket *pkt);
 
 void dump_entities();
+int  find_entities_in_range(double x, double y, double z, double r, int *idx, int max);
 void dump_inventory();
 
 gschunk * find_chunk(gsworld *w, int32_t X, int32_t Z, int allocate);
+gschunk * region_chunk(gsworld *w, gsregion *region, int32_t X, int32_t Z);
+void gs_pin_extent(extent_t *ex);
 cuboid_t export_cuboid_extent(extent_t ex);
+gssnap * gs_snapshot(extent_t *ex);
+void gs_snapshot_free(gssnap *sn);
+bid_t snap_get_block(gssnap *sn, int32_t x, int32_t z, int32_t y);
+cuboid_t snap_export_cuboid(gssnap *sn, extent_t ex);
 bid_t get_block_at(int32_t x, int32_t z, int32_t y);
+int get_height_at(int32_t x, int32_t z);
+uint16_t chunk_sections_with(gschunk *gc, int bid);
 int get_stored_area(gsworld *w, int32_t *Xmin, int32_t *Xmax, int32_t *Zmin, int32_t *Zmax);
 
-void update_chunk_containers(gschunk *gc, int X, int Z);
+nbt_t * chunk_tile_entities(gschunk *gc);
+int find_stored_item(int item, pos_t *pos, int *count, int max);
 
 int player_direction();
 int sameitem(slot_t *a, slot_t *b);
@@ -1036,6 +1036,7 @@ FREE_BEGIN(SP_ChunkData) {
     for(i=0; i<16; i++) {
         lh_free(tpkt->chunk.cubes[i]);
     }
+    nbt_free(tpkt->chunk.heightmap);
     nbt_free(tpkt->te);
 } FREE_END;
 
@@ -1721,6 +1722,18 @@ DUMP_BEGIN(SP_UpdateHealth) {
            tpkt->health, tpkt->food, tpkt->saturation);
 } DUMP_END;
 
+////////////////////////////////////////////////////////////////////////////////
+// 0x4e SP_TimeUpdate
+
+DECODE_BEGIN(SP_TimeUpdate,_1_8_1) {
+    Plong(worldage);
+    Plong(time);
+} DECODE_END;
+
+DUMP_BEGIN(SP_TimeUpdate) {
+    printf("worldage=%lld, time=%lld", (long long)tpkt->worldage, (long long)tpkt->time);
+} DUMP_END;
+
 ////////////////////////////////////////////////////////////////////////////////
 // 0x50 SP_SoundEffect
 
@@ -2196,8 +2209,7 @@ const static packet_methods SUPPORT_1_16_2[2][MAXPACKETTYPES] = {
         SUPPORT_    (0x06,SP_Statistics),
         SUPPORT_    (0x07,SP_AckPlayerDigging),
         SUPPORT_    (0x08,SP_BlockBreakAnimation),
-        //SUPPORT_DDF (0x09,SP_UpdateBlockEntity,_1_8_1),
-        SUPPORT_ (0x09,SP_UpdateBlockEntity),
+        SUPPORT_DDF (0x09,SP_UpdateBlockEntity,_1_8_1),
         SUPPORT_DD  (0x0a,SP_BlockAction,_1_8_1),
         SUPPORT_DED (0x0b,SP_BlockChange,_1_13_2),
         SUPPORT_    (0x0c,SP_BossBar),
@@ -2272,7 +2284,7 @@ const static packet_methods SUPPORT_1_16_2[2][MAXPACKETTYPES] = {
         SUPPORT_    (0x4b,SP_SetPassengers),
         SUPPORT_    (0x4c,SP_Teams),
         SUPPORT_    (0x4d,SP_UpdateScore),
-        SUPPORT_    (0x4e,SP_TimeUpdate),
+        SUPPORT_DD  (0x4e,SP_TimeUpdate,_1_8_1),
         SUPPORT_    (0x4f,SP_Title),
 
         SUPPORT_    (0x50,SP_EntitySoundEffect),
@@ -575,6 +575,12 @@ typedef struct {
     float    saturation;
 } SP_UpdateHealth_pkt;
 
+// 0x4e
+typedef struct {
+    int64_t     worldage;
+    int64_t     time;
+} SP_TimeUpdate_pkt;
+
 // 0x51
 typedef struct {
     int32_t     id;
@@ -845,6 +851,7 @@ typedef struct {
         PKT(SP_EntityMetadata);     // 3f
         PKT(SP_SetExperience);      // 43
         PKT(SP_UpdateHealth);       // 44
+        PKT(SP_TimeUpdate);         // 4e
         PKT(SP_SoundEffect);        // 4d
         PKT(SP_EntityTeleport);     // 50
 
@@ -440,18 +440,15 @@ void extract_height_map() {
             gschunk *c = find_chunk(o_world, X, Z, 0);
             if (!c) continue;
 
-            int x,z,h;
+            int x,z;
             int xoff = (X-Xmin)*16, zoff = (Z-Zmin)*16;
 
             for(z=0; z<16; z++) {
                 for(x=0; x<16; x++) {
-                    for(h=255; h>=0; h--) {
-                        if (c->blocks[x+z*16+h*256].bid) {
-                            uint32_t color = (h<<16)|(h<<8)|h;
-                            IMGDOT(img, x+xoff, z+zoff) = color;
-                            break;
-                        }
-                    }
+                    int h = c->height[x+z*16];
+                    if (h < 0) continue;
+                    uint32_t color = (h<<16)|(h<<8)|h;
+                    IMGDOT(img, x+xoff, z+zoff) = color;
                 }
             }
         }
@@ -516,13 +513,12 @@ int extract_world_data() {
 
             int nch = 0;
             for(c=0; c<REGCHUNKS; c++) {
-                gschunk *ch = re->chunk[c];
-                if (!ch) continue;
-
                 int32_t X = CC_X(s,r,c);
                 int32_t Z = CC_Z(s,r,c);
 
-                update_chunk_containers(ch, X, Z);
+                gschunk *ch = region_chunk(o_world, re, X, Z);
+                if (!ch) continue;
+
                 nbt_t * nbtch = anvil_chunk_create(ch, X, Z);
                 anvil_insert_chunk(reg, X, Z, nbtch);
                 nch++;
@@ -701,13 +697,19 @@ void search_blocks(gsworld *w, int bid, int meta) {
             if (!re) continue;
 
             for(c=0; c<32*32; c++) {
-                gschunk *ch = re->chunk[c];
-                if (!ch) continue;
-
                 int32_t X = CC_X(s,r,c);
                 int32_t Z = CC_Z(s,r,c);
 
+                gschunk *ch = region_chunk(w, re, X, Z);
+                if (!ch) continue;
+
+                // skip sections that don't contain this block type
+                uint16_t smask = chunk_sections_with(ch, bid);
                 for(i=0; i<65536; i++) {
+                    if (!(smask & (1<<(i>>12)))) {
+                        i += 4095;
+                        continue;
+                    }
                     bid_t bl = ch->blocks[i];
                     if (bl.bid == bid && (meta<0 || bl.meta == meta) ) {
                         int32_t x = (X*16+(i&0xf));
@@ -740,12 +742,12 @@ void search_flat_bedrock() {
             if (!re) continue;
 
             for(c=0; c<32*32; c++) {
-                gschunk *ch = re->chunk[c];
-                if (!ch) continue;
-
                 int32_t X = CC_X(s,r,c);
                 int32_t Z = CC_Z(s,r,c);
 
+                gschunk *ch = region_chunk(w, re, X, Z);
+                if (!ch) continue;
+
                 int x,y,z;
                 for(y=123; y<125; y++) {
                     for(x=0; x<16; x++) {
@@ -71,6 +71,8 @@ char         o_raddr[256];
 uint16_t     o_rport;
 int          o_connactive = 0;
 char *       o_profile_path = NULL;
+int          o_chunk_budget = 0;
+int          o_dim_cache[3] = { 64, 32, 16 }; // overworld, nether, end
 
 uint32_t     bind_ip;
 uint32_t     remote_ip;
@@ -1067,10 +1069,15 @@ int handle_server(int sfd, uint32_t ip, uint16_t port) {
     close_session();
 
     gs_reset();
-    gs_setopt(GSOP_PRUNE_CHUNKS, 1);
+    // with a chunk budget set, unloaded chunks are retained and spilled to disk instead
+    gs_setopt(GSOP_PRUNE_CHUNKS, o_chunk_budget ? 0 : 1);
     gs_setopt(GSOP_SEARCH_SPAWNERS, 1);
     gs_setopt(GSOP_TRACK_ENTITIES, 1);
     gs_setopt(GSOP_TRACK_INVENTORY, 1);
+    gs_setopt(GSOP_CHUNK_BUDGET, o_chunk_budget);
+    gs_setopt(GSOP_CACHE_OVERWORLD, o_dim_cache[0]);
+    gs_setopt(GSOP_CACHE_NETHER, o_dim_cache[1]);
+    gs_setopt(GSOP_CACHE_END, o_dim_cache[2]);
     gm_reset();
 
     // open a new .mcp file to capture MC protocol data
@@ -1182,8 +1189,12 @@ void print_usage() {
            "  -b [bindaddr:]bindport  : address and port to bind the proxy socket to. Default: %s:%d\n"
            "  -c                      : allow connections while session is active\n"
            "  -p profile_path         : location of Minecraft profile, default is %%APPDATA%%/.minecraft/launcher_profile.json\n"
+           "  -m budget               : chunk storage budget in MB, cold chunks are spilled to disk. Default: unlimited\n"
+           "  -d ow[,nether[,end]]    : MB of chunks kept for a dimension while in another one. Default: %d,%d,%d\n"
            "  [server[:port]]         : remote Minecraft server address and port. Default: %s:%d\n",
-           o_appname, DEFAULT_BIND_ADDR, DEFAULT_BIND_PORT, DEFAULT_REMOTE_ADDR, DEFAULT_REMOTE_PORT);
+           o_appname, DEFAULT_BIND_ADDR, DEFAULT_BIND_PORT,
+           o_dim_cache[0], o_dim_cache[1], o_dim_cache[2],
+           DEFAULT_REMOTE_ADDR, DEFAULT_REMOTE_PORT);
 }
 
 int parse_args(int ac, char **av) {
@@ -1200,7 +1211,7 @@ int parse_args(int ac, char **av) {
     char addr[256];
     int port,nchars;
 
-    while ( (opt=getopt(ac,av,"b:hcp:")) != -1 ) {
+    while ( (opt=getopt(ac,av,"b:hcp:m:d:")) != -1 ) {
         switch (opt) {
             case 'h':
                 o_help = 1;
@@ -1228,6 +1239,20 @@ int parse_args(int ac, char **av) {
             case 'p':
                 o_profile_path = strdup(optarg);
                 break;
+            case 'm':
+                if (sscanf(optarg,"%d",&o_chunk_budget)!=1 || o_chunk_budget<0) {
+                    printf("Failed to parse chunk budget \"%s\"\n",optarg);
+                    error++;
+                }
+                break;
+            case 'd': {
+                int n = sscanf(optarg,"%d,%d,%d",o_dim_cache,o_dim_cache+1,o_dim_cache+2);
+                if (n<1 || o_dim_cache[0]<0 || o_dim_cache[1]<0 || o_dim_cache[2]<0) {
+                    printf("Failed to parse dimension cache sizes \"%s\"\n",optarg);
+                    error++;
+                }
+                break;
+            }
             case '?': {
                 printf("Unknown option -%c", opt);
                 error++;
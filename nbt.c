@@ -419,6 +419,23 @@ nbt_t * nbt_hget(nbt_t *nbt, const char *name) {
     return NULL;
 }
 
+// detach a named element from a compound, the caller takes ownership
+nbt_t * nbt_hremove(nbt_t *nbt, const char *name) {
+    if (!nbt) return NULL;
+    if (nbt->type != NBT_COMPOUND) return NULL;
+
+    int i;
+    for(i=0; i<nbt->count; i++) {
+        const char *elname = nbt->co[i]->name;
+        if (elname && !strcmp(elname, name)) {
+            nbt_t *el = nbt->co[i];
+            lh_arr_delete(nbt->co, nbt->count, 1, i);
+            return el;
+        }
+    }
+    return NULL;
+}
+
 // access an element in an array by index
 nbt_t * nbt_aget(nbt_t *nbt, int idx) {
     if (!nbt) return NULL;
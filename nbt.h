@@ -105,6 +105,7 @@ nbt_t * nbt_clone(nbt_t *nbt);
 void    nbt_dump(nbt_t *nbt);
 void    nbt_free(nbt_t *nbt);
 nbt_t * nbt_hget(nbt_t *nbt, const char *name);
+nbt_t * nbt_hremove(nbt_t *nbt, const char *name);
 nbt_t * nbt_aget(nbt_t *nbt, int idx);
 nbt_t * nbt_new(int type, const char *name, ...);
 void    nbt_add(nbt_t * nbt, nbt_t * el);